@@ -0,0 +1,310 @@
+// Benchmark of tree build, mass distribution, force pass, integrator steps and the deterministic mode
+//
+// Usage: benchmark [options]
+//   --config <file>       initial conditions of the "Single Galaxy" settings (default config.json)
+//   --sizes <n,n,...>     particle counts (default 1000,10000,100000,1000000)
+//   --threads <t,t,...>   thread counts (default 1,2,4,... and all cores)
+//   --repeat <n>          measurements per phase, the median is reported (default 3)
+//   --format <json|csv>   output format (default json)
+//   --output <file>       write the results to a file instead of the console
+//   --baseline <file>     compare with the results of a previous run (json or csv)
+//   --threshold <percent> slowdown reported as regression (default 10)
+//
+// Exit code is 2 when a regression against the baseline was found.
+
+// Standard includes
+#include <cstdlib>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <map>
+#include <algorithm>
+#include <stdexcept>
+#include <omp.h>
+
+// Library includes
+#include <jsoncpp/json/json.h>
+
+// Project includes
+#include "../Models/NBody.h"
+#include "../Integrators/Euler.h"
+#include "../Integrators/Heun.h"
+#include "../Integrators/RK4.h"
+#include "../Integrators/LowStorageRK.h"
+
+namespace
+{
+  struct Result
+  {
+    std::string phase;
+    int particles;
+    int threads;
+    double median;
+    double minimum;
+    int repeats;
+  };
+
+  std::vector<int> ParseList(const std::string &text)
+  {
+    std::vector<int> values;
+    std::stringstream ss(text);
+    std::string item;
+    while (std::getline(ss, item, ','))
+      values.push_back(atoi(item.c_str()));
+    return values;
+  }
+
+  std::string Key(const std::string &phase, int particles, int threads)
+  {
+    std::stringstream ss;
+    ss << phase << "/" << particles << "/" << threads;
+    return ss.str();
+  }
+
+  template<typename Function>
+  Result Measure(const std::string &phase, int particles, int threads, int repeats, Function function)
+  {
+    std::vector<double> times;
+    function(); // warm up caches and the thread pool
+    for (int r=0; r<repeats; ++r)
+    {
+      double start = omp_get_wtime();
+      function();
+      times.push_back(omp_get_wtime() - start);
+    }
+
+    std::sort(times.begin(), times.end());
+    Result result = {phase, particles, threads, times[times.size()/2], times[0], repeats};
+    std::cerr << std::setw(24) << std::left << phase << std::right
+              << std::setw(10) << particles
+              << std::setw(5) << threads
+              << std::setw(14) << result.median << " s\n";
+    return result;
+  }
+
+  void WriteResults(std::ostream &out, const std::vector<Result> &results, const std::string &format)
+  {
+    if (format=="csv")
+    {
+      out << "phase,particles,threads,median,min,repeats\n";
+      for (std::size_t i=0; i<results.size(); ++i)
+        out << results[i].phase << "," << results[i].particles << "," << results[i].threads << ","
+            << std::setprecision(9) << results[i].median << "," << results[i].minimum << "," << results[i].repeats << "\n";
+    }
+    else
+    {
+      Json::Value root;
+      root["benchmark"] = "GalaxySimulation";
+      root["maxThreads"] = omp_get_num_procs();
+      for (std::size_t i=0; i<results.size(); ++i)
+      {
+        Json::Value entry;
+        entry["phase"] = results[i].phase;
+        entry["particles"] = results[i].particles;
+        entry["threads"] = results[i].threads;
+        entry["median"] = results[i].median;
+        entry["min"] = results[i].minimum;
+        entry["repeats"] = results[i].repeats;
+        root["results"].append(entry);
+      }
+      out << root;
+    }
+  }
+
+  std::map<std::string, double> ReadBaseline(const std::string &fileName)
+  {
+    std::ifstream file(fileName.c_str());
+    if (!file)
+      throw std::runtime_error("Can't open baseline '" + fileName + "'");
+
+    std::map<std::string, double> baseline;
+    if ((file >> std::ws).peek()=='{')
+    {
+      Json::Value root;
+      file >> root;
+      const Json::Value &results = root["results"];
+      for (Json::ArrayIndex i=0; i<results.size(); ++i)
+        baseline[Key(results[i]["phase"].asString(), results[i]["particles"].asInt(), results[i]["threads"].asInt())] = results[i]["median"].asDouble();
+    }
+    else
+    {
+      std::string line;
+      std::getline(file, line); // header
+      while (std::getline(file, line))
+      {
+        std::stringstream ss(line);
+        std::string phase, particles, threads, median;
+        if (std::getline(ss, phase, ',') && std::getline(ss, particles, ',') &&
+            std::getline(ss, threads, ',') && std::getline(ss, median, ','))
+          baseline[Key(phase, atoi(particles.c_str()), atoi(threads.c_str()))] = atof(median.c_str());
+      }
+    }
+
+    return baseline;
+  }
+
+  int CompareBaseline(const std::vector<Result> &results, const std::map<std::string, double> &baseline, double threshold)
+  {
+    int regressions = 0;
+    std::cerr << "\n" << std::setw(24) << std::left << "phase" << std::right
+              << std::setw(10) << "particles" << std::setw(5) << "thr"
+              << std::setw(14) << "baseline" << std::setw(14) << "current" << std::setw(10) << "change\n";
+
+    for (std::size_t i=0; i<results.size(); ++i)
+    {
+      std::map<std::string, double>::const_iterator it = baseline.find(Key(results[i].phase, results[i].particles, results[i].threads));
+      if (it==baseline.end() || it->second<=0)
+        continue;
+
+      double change = 100.0 * (results[i].median - it->second) / it->second;
+      bool regression = change>threshold;
+      regressions += regression;
+
+      std::cerr << std::setw(24) << std::left << results[i].phase << std::right
+                << std::setw(10) << results[i].particles << std::setw(5) << results[i].threads
+                << std::setw(14) << it->second << std::setw(14) << results[i].median
+                << std::setw(9) << std::fixed << std::setprecision(1) << change << "%"
+                << std::defaultfloat << std::setprecision(6)
+                << (regression ? "  REGRESSION" : "") << "\n";
+    }
+
+    return regressions;
+  }
+}
+
+int main(int argc, char** argv)
+{
+  try
+  {
+    std::string configName("config.json"), format("json"), output, baselineName;
+    std::vector<int> sizes = ParseList("1000,10000,100000,1000000"), threads;
+    int repeats = 3;
+    double threshold = 10;
+
+    for (int i=1; i+1<argc; i+=2)
+    {
+      std::string option(argv[i]), value(argv[i+1]);
+      if (option=="--config") configName = value;
+      else if (option=="--sizes") sizes = ParseList(value);
+      else if (option=="--threads") threads = ParseList(value);
+      else if (option=="--repeat") repeats = std::max(1, atoi(value.c_str()));
+      else if (option=="--format") format = value;
+      else if (option=="--output") output = value;
+      else if (option=="--baseline") baselineName = value;
+      else if (option=="--threshold") threshold = atof(value.c_str());
+      else throw std::runtime_error("Unknown option " + option);
+    }
+
+    if (threads.empty())
+    {
+      for (int t=1; t<omp_get_num_procs(); t*=2)
+        threads.push_back(t);
+      threads.push_back(omp_get_num_procs());
+    }
+
+    Json::Value json;
+    std::ifstream configFile(configName.c_str(), std::ifstream::binary);
+    if (configFile)
+      configFile >> json;
+    json["Simulation"] = "Single Galaxy";
+    json["Restart file"] = "";
+    NBody::ConfigureMemory(json);
+    json["Force"] = "Tree";
+
+    std::vector<Result> results;
+    for (std::size_t s=0; s<sizes.size(); ++s)
+    {
+      json["Simulation settings"]["Single Galaxy"]["Number of particles"] = sizes[s];
+      NBody model(json);
+      const int particles = model.GetTotalParticles();
+      const double timeStep = json.get("Time step", 1200).asDouble();
+
+      std::vector<double> state(model.GetInitialState(), model.GetInitialState() + model.GetSimulationDimension());
+      std::vector<double> derivative(state.size());
+      ParticleState2D *particleState = reinterpret_cast<ParticleState2D*>(&state[0]);
+      ParticleNextState2D *particleNextState = reinterpret_cast<ParticleNextState2D*>(&derivative[0]);
+      ParticleData2D particleData(particleState, const_cast<ParticleParameters*>(model.GetParticleParameters()));
+
+      for (std::size_t t=0; t<threads.size(); ++t)
+      {
+        omp_set_num_threads(threads[t]);
+
+        results.push_back(Measure("BuiltTree", particles, threads[t], repeats,
+                                  [&]{ model.BuiltTree(particleData); }));
+        results.push_back(Measure("ComputeMassDistribution", particles, threads[t], repeats,
+                                  [&]{ model.GetTree()->ComputeMassDistribution(); }));
+        results.push_back(Measure("ForcePass", particles, threads[t], repeats,
+                                  [&]{ model.CalculateForces(particleState, particleNextState); }));
+
+        // Group walk with the single precision kernel
+        const bool mixed = model.IsMixedPrecision();
+        model.SetMixedPrecision(true);
+        results.push_back(Measure("ForcePass/Mixed", particles, threads[t], repeats,
+                                  [&]{ model.CalculateForces(particleState, particleNextState); }));
+        model.SetMixedPrecision(mixed);
+
+        IntegratorEuler<NBody> euler(&model, timeStep);
+        IntegratorHeun<NBody> heun(&model, timeStep);
+        IntegratorRK4<NBody> rk4(&model, timeStep);
+        IntegratorLowStorageRK<NBody> lsrk3(&model, timeStep, 3);
+        IntegratorLowStorageRK<NBody> lsrk4(&model, timeStep, 4);
+        IIntegrator *integrators[] = {&euler, &heun, &rk4, &lsrk3, &lsrk4};
+        for (int i=0; i<5; ++i)
+        {
+          integrators[i]->SetInitialState(&state[0]);
+          results.push_back(Measure("SingleStep/" + integrators[i]->GetName(), particles, threads[t], repeats,
+                                    [&]{ integrators[i]->SingleStep(); }));
+          std::cerr << std::setw(24) << std::left << "Workspace/" + integrators[i]->GetName() << std::right
+                    << std::setw(10) << particles
+                    << std::setw(5) << threads[t]
+                    << std::setw(14) << integrators[i]->GetWorkspaceBytes() / 1048576.0 << " MiB\n";
+        }
+
+        // Cost of the deterministic mode, it changes the TreePM mass assignment and the diagnostics sums
+        std::vector<double> potential(particles, -1);
+        const bool configured = model.IsDeterministic();
+        model.BuiltTree(particleData);
+        model.SetForceMode(NBody::TREEPM);
+        for (int d=0; d<2; ++d)
+        {
+          const std::string mode = d ? "/Deterministic" : "";
+          model.SetDeterministic(d==1);
+          results.push_back(Measure("ForcePass/TreePM" + mode, particles, threads[t], repeats,
+                                    [&]{ model.CalculateForces(particleState, particleNextState); }));
+
+          Diagnostics diagnostics;
+          diagnostics.SetDeterministic(d==1);
+          results.push_back(Measure("Diagnostics" + mode, particles, threads[t], repeats,
+                                    [&]{ diagnostics.Sample(particleState, model.GetParticleParameters(), &potential[0],
+                                                            NULL, particles, 0); }));
+        }
+        model.SetForceMode(NBody::TREE);
+        model.SetDeterministic(configured);
+      }
+    }
+
+    if (output.empty())
+    {
+      WriteResults(std::cout, results, format);
+    }
+    else
+    {
+      std::ofstream outputFile(output.c_str());
+      WriteResults(outputFile, results, format);
+    }
+
+    if (!baselineName.empty() && CompareBaseline(results, ReadBaseline(baselineName), threshold)>0)
+      return 2;
+  }
+  catch(std::exception &exc)
+  {
+    std::cout << "Program failed. Exception: " << exc.what() << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  return (EXIT_SUCCESS);
+}
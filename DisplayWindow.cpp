@@ -3,6 +3,9 @@
 #include <cmath>
 #include <cassert>
 #include <limits>
+#include <cstring>
+#include <cstdio>
+#include <chrono>
 #include <omp.h>
 
 // Project includes
@@ -10,11 +13,27 @@
 #include "Integrators/Euler.h"
 #include "Integrators/Heun.h"
 #include "Integrators/RK4.h"
+#include "Integrators/LowStorageRK.h"
+#include "Utils/Tracer.h"
 
 DisplayWindow::DisplayWindow(Json::Value config) : IDisplay(config["Window size"].asInt(), config["Window size"].asInt(), config["Field of view"].asInt(), config["Simulation"].asString())
   ,model(NULL)
   ,integrator(NULL)
+  ,trajectory(NULL)
+  ,replay(NULL)
+  ,replayPosition(0)
+  ,replaySpeed(1)
+  ,replayPrefetch(8)
   ,configuration(config)
+  ,checkpointFile(config["Checkpoint"].get("File", "checkpoint.snap").asString())
+  ,checkpointInterval(config["Checkpoint"]["Interval"].asInt())
+  ,metricsFile(config["Metrics"]["File"].asString())
+  ,metricsFormat(config["Metrics"].get("Format", "json").asString())
+  ,metricsInterval(config["Metrics"].get("Interval", 100).asInt())
+  ,diagnosticsFile(config["Diagnostics"]["File"].asString())
+  ,diagnosticsInterval(config["Diagnostics"].get("Interval", 100).asInt())
+  ,traceFile(config["Trace"]["File"].asString())
+  ,stepCount(0)
   ,cameraSettings(0)
   ,showAxis(true)
   ,showCompleteTree(false)
@@ -22,40 +41,223 @@ DisplayWindow::DisplayWindow(Json::Value config) : IDisplay(config["Window size"
   ,showParticles(true)
   ,showStatistics(true)
   ,isSimulationPaused(false)
-{}
+{
+  // Has to be enabled before any thread records
+  if (!traceFile.empty())
+  {
+    if (Tracer::Enable(config["Trace"].get("Events per thread", 1000000).asUInt()))
+      Tracer::SetThreadName("Main");
+    else
+      std::cerr << "Tracing requested but not compiled in, build with TRACEFLAGS=-DTRACING\n";
+  }
+}
+
+DisplayWindow::~DisplayWindow()
+{
+  // Flush pending trajectory frames
+  delete trajectory;
+  delete replay;
+
+  if (Tracer::IsEnabled())
+    WriteTrace();
+}
+
+void DisplayWindow::WriteTrace()
+{
+  if (!Tracer::IsEnabled())
+    return;
+
+  try
+  {
+    Tracer::Dump(traceFile);
+    std::cout << "Trace written to " << traceFile << " (" << Tracer::GetEventsCount() << " events, "
+              << Tracer::GetDroppedEvents() << " dropped)\n";
+  }
+  catch(std::exception &exc)
+  {
+    std::cerr << exc.what() << "\n";
+  }
+}
 
 void DisplayWindow::Init()
 {
+  // OpenGL initialization
+  glClear(GL_COLOR_BUFFER_BIT  | GL_DEPTH_BUFFER_BIT);
+  SetCamera(Vector3D(0,0,1),Vector3D(0,0,0),Vector3D(0,1,0));
+  glMatrixMode(GL_MODELVIEW);
+  glLoadIdentity();
+
+  // Replay of a recorded trajectory doesn't need the model
+  if (!configuration["Replay"]["File"].asString().empty())
+  {
+    InitReplay(configuration["Replay"]);
+    return;
+  }
+
   // Create the model class
   if (configuration["Model"].asString() == "N-body")
     model = new NBody(configuration);
   else // default if not provided or not correct
     model = new NBody(configuration);
 
+  const Snapshot &snapshot = model->GetSnapshot();
+  if (snapshot.IsOpen())
+  {
+    // Resume the run with the integrator stored in the snapshot
+    const SnapshotHeader &header = snapshot.GetHeader();
+    CreateIntegrator(std::string(header.integrator, strnlen(header.integrator, sizeof(header.integrator))), std::fabs(header.timeStep));
+    integrator->SetInitialState(model->GetInitialState());
+    integrator->SetTimeStep(header.timeStep);
+    integrator->SetTime(header.time);
+    stepCount = header.step;
+  }
+  else
+  {
+    CreateIntegrator(configuration["Integrator"].asString(), configuration["Time step"].asInt());
+    integrator->SetInitialState(model->GetInitialState());
+  }
+
+  // Trajectory output
+  const Json::Value &trajectorySettings = configuration["Trajectory"];
+  if (!trajectorySettings["File"].asString().empty())
+  {
+    delete trajectory;
+    trajectory = new TrajectoryWriter(trajectorySettings["File"].asString(),
+                                      model->GetParticleParameters(),
+                                      model->GetTotalParticles(),
+                                      trajectorySettings.get("Interval", 1).asUInt(),
+                                      integrator->GetTimeStep(),
+                                      trajectorySettings.get("Buffers", 4).asUInt(),
+                                      trajectorySettings["Direct I/O"].asBool(),
+                                      trajectorySettings["Drop frames"].asBool());
+
+    if (trajectorySettings["Compression"].asBool())
+      trajectory->EnableCompression(trajectorySettings.get("Precision", 0.0001).asDouble(),
+                                    trajectorySettings.get("Keyframe interval", 32).asUInt());
+  }
+}
+
+void DisplayWindow::InitReplay(const Json::Value &replaySettings)
+{
+  delete replay;
+  replay = new TrajectoryReader(replaySettings["File"].asString());
+  replaySpeed = replaySettings.get("Speed", 1).asDouble();
+  replayPrefetch = replaySettings.get("Prefetch frames", 8).asUInt();
+  replayPosition = (replaySpeed<0) ? replay->GetFramesCount() - 1 : 0;
+
+  SetWindowName("Replay: " + replaySettings["File"].asString());
+}
+
+void DisplayWindow::ReplayStep()
+{
+  if (!isSimulationPaused)
+  {
+    // Stop at either end of the recording
+    double last = replay->GetFramesCount() - 1;
+    replayPosition = std::min(std::max(replayPosition + replaySpeed, 0.0), last);
+  }
+
+  // Frames shown at this speed, slower than one frame per render still advances frame by frame
+  const int step = (int)std::max(1.0, std::floor(std::fabs(replaySpeed) + 0.5));
+  replay->Prefetch((unsigned)replayPosition, (replaySpeed<0) ? -step : step, replayPrefetch);
+}
+
+void DisplayWindow::CreateIntegrator(const std::string &name, double timeStep)
+{
   // assign model to the integrator and set the time step
   delete integrator;
-  if (configuration["Integrator"].asString() == "Euler")
-    integrator = new IntegratorEuler(model, configuration["Time step"].asInt());
-  else if (configuration["Integrator"].asString() == "Heun")
-    integrator = new IntegratorHeun(model, configuration["Time step"].asInt());
-  else if (configuration["Integrator"].asString() == "RK4")
-    integrator = new IntegratorRK4(model, configuration["Time step"].asInt());
+  if (name == "Euler")
+    integrator = new IntegratorEuler<NBody>(model, timeStep);
+  else if (name == "Heun")
+    integrator = new IntegratorHeun<NBody>(model, timeStep);
+  else if (name == "RK4")
+    integrator = new IntegratorRK4<NBody>(model, timeStep);
+  else if (name == "LSRK3")
+    integrator = new IntegratorLowStorageRK<NBody>(model, timeStep, 3);
+  else if (name == "LSRK4")
+    integrator = new IntegratorLowStorageRK<NBody>(model, timeStep, 4);
   else // default if not provided or not correct
-    integrator = new IntegratorHeun(model, configuration["Time step"].asInt());
+    integrator = new IntegratorHeun<NBody>(model, timeStep);
+}
 
-  integrator->SetInitialState(model->GetInitialState());
+void DisplayWindow::WriteCheckpoint()
+{
+  SnapshotHeader header = model->CreateSnapshotHeader();
+  header.step = stepCount;
+  header.time = integrator->GetTime();
+  header.timeStep = integrator->GetTimeStep();
+  strncpy(header.integrator, integrator->GetName().c_str(), sizeof(header.integrator) - 1);
+
+  Snapshot::Write(checkpointFile,
+                  header,
+                  reinterpret_cast<ParticleState2D*>(integrator->GetState()),
+                  model->GetParticleParameters());
+}
 
-  // OpenGL initialization
-  glClear(GL_COLOR_BUFFER_BIT  | GL_DEPTH_BUFFER_BIT);
-  SetCamera(Vector3D(0,0,1),Vector3D(0,0,0),Vector3D(0,1,0));
-  glMatrixMode(GL_MODELVIEW);
-  glLoadIdentity();
+void DisplayWindow::WriteMetrics()
+{
+  const Metrics &metrics = model->GetMetrics();
+
+  if (metricsFormat=="prometheus")
+  {
+    // Text exposition format, replaced atomically for the scraper
+    std::string tempName = metricsFile + ".tmp";
+    {
+      std::ofstream out(tempName.c_str());
+      metrics.WritePrometheus(out, stepCount, integrator->GetTime());
+    }
+    std::rename(tempName.c_str(), metricsFile.c_str());
+  }
+  else
+  {
+    std::ofstream out(metricsFile.c_str(), std::ofstream::app);
+    metrics.WriteJsonLine(out, stepCount, integrator->GetTime());
+  }
+}
+
+void DisplayWindow::WriteDiagnostics(unsigned long long step)
+{
+  std::ofstream out(diagnosticsFile.c_str(), std::ofstream::app);
+  model->GetDiagnostics().WriteJsonLine(out, step);
 }
 
 void DisplayWindow::Render()
 {
-  if (!isSimulationPaused)
+  if (replay)
+  {
+    ReplayStep();
+  }
+  else if (!isSimulationPaused)
+  {
+    TRACE_SCOPE("Step");
+
+    // Sampled on the state at the beginning of the step by its first force pass
+    bool sampleDiagnostics = diagnosticsInterval>0 && stepCount % diagnosticsInterval == 0;
+    if (sampleDiagnostics)
+      model->RequestDiagnostics();
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
     integrator->SingleStep();
+    std::chrono::duration<double> stepTime = std::chrono::steady_clock::now() - start;
+    model->GetMetrics().EndStep(stepTime.count());
+
+    if (sampleDiagnostics && !diagnosticsFile.empty())
+      WriteDiagnostics(stepCount);
+
+    ++stepCount;
+
+    if (!metricsFile.empty() && metricsInterval>0 && stepCount % metricsInterval == 0)
+      WriteMetrics();
+
+    if (checkpointInterval>0 && stepCount % checkpointInterval == 0)
+      WriteCheckpoint();
+
+    if (trajectory && trajectory->IsFrameDue(stepCount))
+      trajectory->Push(integrator->GetState(), stepCount, integrator->GetTime());
+  }
+
+  std::chrono::steady_clock::time_point renderStart = std::chrono::steady_clock::now();
+  TRACE_SCOPE("Render");
 
   glClear(GL_COLOR_BUFFER_BIT  | GL_DEPTH_BUFFER_BIT);
 
@@ -77,30 +279,39 @@ void DisplayWindow::Render()
 
   if (showAxis) // display axis on the mass center
   {
-    const Vector3D &massCenter = model->GetMassCenter();
+    const Vector3D &massCenter = (replay) ? Vector3D() : model->GetMassCenter();
     DrawAxis(Vector3D(massCenter.x, massCenter.y, massCenter.z));
   }
 
-  if (showCompleteTree || showForceTree)
+  if (!replay && (showCompleteTree || showForceTree))
     DrawTree();
 
   if (showParticles)
-    DrawParticles();
+  {
+    if (replay)
+      DrawParticles(replay->GetFrame((unsigned)replayPosition), replay->GetParticleParameters(), replay->GetParticlesCount());
+    else
+      DrawParticles(reinterpret_cast<ParticleState2D*>(integrator->GetState()), model->GetParticleParameters(), model->GetTotalParticles());
+  }
 
   if (showStatistics)
     ShowStatisticsConsole();
 
   SDL_GL_SwapBuffers();
+
+  if (model)
+  {
+    std::chrono::duration<double> renderTime = std::chrono::steady_clock::now() - renderStart;
+    model->GetMetrics().AddPhaseTime(Metrics::RENDER, renderTime.count());
+  }
 }
 
-void DisplayWindow::DrawParticles()
+void DisplayWindow::DrawParticles(const ParticleState2D *state, const ParticleParameters *parameters, int particles)
 {
-  assert(integrator);
-
-  ParticleState2D *state = reinterpret_cast<ParticleState2D*>(integrator->GetState());
-  const ParticleParameters *parameters  = model->GetParticleParameters();
+  assert(state);
+  assert(parameters);
 
-  for (int i=0; i<model->GetTotalParticles(); ++i)
+  for (int i=0; i<particles; ++i)
   {
     if (parameters[i].radius > 0) // bulge loop
     {
@@ -115,7 +326,7 @@ void DisplayWindow::DrawParticles()
     {
       glDisable(GL_POINT_SMOOTH); // stars loop
       glColor3f(0,0,1); // blue color
-      glPointSize(parameters[i].mass/10);
+      glPointSize(std::max(parameters[i].mass/10, 1.0)); // massless tracers still show
       glBegin(GL_POINTS);
       glVertex3f(state[i].positionX, state[i].positionY, 0.0f);
       glEnd();
@@ -126,17 +337,71 @@ void DisplayWindow::DrawParticles()
 
 void DisplayWindow::ShowStatisticsConsole()
 {
+  if (replay)
+  {
+    const TrajectoryFrameHeader &frame = replay->GetFrameHeader((unsigned)replayPosition);
+
+    std::cout << "                             \n";
+    std::cout << "Replay frame: " << (unsigned)replayPosition + 1 << "/" << replay->GetFramesCount() << (replay->IsCompressed() ? " (compressed)" : "") << "\n";
+    std::cout << "Time: " << frame.time << "\n";
+    std::cout << "Step: " << frame.step << "\n";
+    std::cout << "Playback speed: " << replaySpeed << " frames/render\n";
+    std::cout << "FPS: " << GetFPS() << "\n";
+    std::cout << "FOV: " << GetFOV() << "\n";
+    std::cout << "_____________________________\n";
+    return;
+  }
+
   Quadtree *tree = model->GetTree();
 
   std::cout << "                             \n";
   std::cout << "Time: " << integrator->GetTime() << "\n";
+  std::cout << "Step: " << stepCount << "\n";
   std::cout << "FPS: " << GetFPS() << "\n";
   std::cout << "FOV: " << GetFOV() << "\n";
   std::cout << "Axis scale: " << pow(10, (int)(log10(GetFOV()/2))) << "\n";
   std::cout << "Bodies inside tree: " << tree->GetAllNodesParticles() << "\n";
+  std::cout << "Tracers: " << model->GetTracersCount() << "\n";
+  const HermiteSubsystem &massiveBodies = model->GetMassiveBodies();
+  if (massiveBodies.IsInitialized())
+    std::cout << "Massive bodies: " << massiveBodies.GetIndices().size() << ", Hermite substeps: " << massiveBodies.GetSubsteps() << "\n";
+  std::cout << "Force: " << model->GetForceModeName() << "\n";
   std::cout << "Theta: " << tree->GetTheta() << "\n";
+  std::cout << "Opening: " << model->GetOpeningCriterionName() << ", accuracy " << model->GetOpeningAccuracy() << "\n";
   std::cout << "Time step: " << integrator->GetTimeStep() << "\n";
   std::cout << "Integrator: " << integrator->GetName().c_str() << "\n";
+
+  const Metrics &metrics = model->GetMetrics();
+  std::cout << "Phase times [ms]:";
+  for (int p=0; p<Metrics::PHASES; ++p)
+    std::cout << " " << Metrics::GetPhaseName(Metrics::Phase(p)) << "=" << 1000*metrics.GetPhaseTime(Metrics::Phase(p));
+  std::cout << "\n";
+  std::cout << "Interactions/step: " << metrics.GetCounter(Metrics::INTERACTIONS) << "\n";
+  std::cout << "Nodes opened/step: " << metrics.GetCounter(Metrics::NODES_OPENED) << "\n";
+  std::cout << "Tree nodes: " << metrics.GetTreeNodes() << ", depth: " << metrics.GetTreeDepth() << "\n";
+  for (int n=0; n<metrics.GetMemoryNodes(); ++n)
+  {
+    std::cout << "Memory bandwidth node " << n << ": " << metrics.GetNodeBandwidth(n) / 1e9 << " GB/s";
+    if (metrics.GetNodeUtilization(n)>0)
+      std::cout << " (" << 100 * metrics.GetNodeUtilization(n) << "% of peak)";
+    std::cout << "\n";
+  }
+
+  const Diagnostics &diagnostics = model->GetDiagnostics();
+  if (diagnostics.HasSample())
+  {
+    const DiagnosticsSample &sample = diagnostics.GetSample();
+    std::cout << "Energy (at time " << sample.time << "): " << sample.totalEnergy << ", relative error: " << diagnostics.GetEnergyError() << "\n";
+    std::cout << "Momentum: (" << sample.momentumX << ", " << sample.momentumY << "), angular momentum: " << sample.angularMomentum << "\n";
+    std::cout << "Virial ratio 2K/|W|: " << sample.virialRatio << "\n";
+  }
+  if (trajectory)
+  {
+    std::cout << "Trajectory frames written: " << trajectory->GetWrittenFrames() << "\n";
+    std::cout << "Trajectory frames dropped/blocked: " << trajectory->GetDroppedFrames() << "/" << trajectory->GetBlockedFrames() << "\n";
+    std::cout << "Trajectory bandwidth: " << trajectory->GetBandwidth() / (1024*1024) << " MB/s" << (trajectory->IsPinned() ? "" : " (buffers not pinned)") << "\n";
+    std::cout << "Trajectory compression: " << trajectory->GetCompressionRatio() << "x\n";
+  }
   std::cout << "_____________________________\n";
 }
 
@@ -203,10 +468,10 @@ void DisplayWindow::DrawTree()
         return;
 
       // Draw child nodes
-      for (int i=0; i<4; ++i)
+      for (int i=0; i<Quadtree::Children; ++i)
       {
-        if (treeNode->quadNode[i])
-          DrawTreeNode(treeNode->quadNode[i], level+1, type, fov);
+        if (treeNode->childNode[i])
+          DrawTreeNode(treeNode->childNode[i], level+1, type, fov);
       }
     }
   };
@@ -256,17 +521,72 @@ void DisplayWindow::DrawTreeNode(Quadtree *treeNode, int level)
   if (!treeNode->IsDevided())
     return;
 
-  for (int i=0; i<4; ++i)
+  for (int i=0; i<Quadtree::Children; ++i)
   {
-    if (treeNode->quadNode[i])
+    if (treeNode->childNode[i])
     {
-      DrawTreeNode(treeNode->quadNode[i], level+1);
+      DrawTreeNode(treeNode->childNode[i], level+1);
     }
   }
 }
 
+bool DisplayWindow::ProcessReplayKey(SDLKey key)
+{
+  const double last = replay->GetFramesCount() - 1,
+               jump = std::max(1.0, 0.1 * replay->GetFramesCount());
+
+  switch (key)
+  {
+    case SDLK_r:
+         replaySpeed *= -1;
+         return true;
+
+    case SDLK_RIGHT:
+         replaySpeed = std::min(std::fabs(replaySpeed) * 2, 1024.0) * ((replaySpeed<0) ? -1 : 1);
+         return true;
+
+    case SDLK_LEFT:
+         replaySpeed = std::max(std::fabs(replaySpeed) / 2, 1.0/64) * ((replaySpeed<0) ? -1 : 1);
+         return true;
+
+    case SDLK_PAGEUP:
+         replayPosition = std::min(replayPosition + jump, last);
+         return true;
+
+    case SDLK_PAGEDOWN:
+         replayPosition = std::max(replayPosition - jump, 0.0);
+         return true;
+
+    case SDLK_HOME:
+         replayPosition = 0;
+         return true;
+
+    case SDLK_END:
+         replayPosition = last;
+         return true;
+
+    case SDLK_d:
+         WriteTrace();
+         return true;
+
+    // Simulation only keys
+    case SDLK_UP:
+    case SDLK_DOWN:
+    case SDLK_c:
+    case SDLK_t:
+    case SDLK_f:
+         return true;
+
+    default:
+         return false;
+  }
+}
+
 void DisplayWindow::OnProcessEvents(uint8_t type)
 {
+  if (replay && type==SDL_KEYDOWN && ProcessReplayKey(event.key.keysym.sym))
+    return;
+
   switch (type)
   {
     case SDL_KEYDOWN:
@@ -318,12 +638,27 @@ void DisplayWindow::OnProcessEvents(uint8_t type)
                 showStatistics = !showStatistics;
                 break;
 
+          case  SDLK_c:
+                WriteCheckpoint();
+                break;
+
+          case  SDLK_d:
+                WriteTrace();
+                break;
+
+          // The error bounded criteria are tuned by their accuracy, theta is only their first step
           case SDLK_UP:
-               model->SetTheta(model->GetTheta() + 0.1);
+               if (model->GetOpeningCriterion()==OPENING_SALMON_WARREN || model->GetOpeningCriterion()==OPENING_RELATIVE)
+                 model->SetOpeningCriterion(model->GetOpeningCriterion(), model->GetOpeningAccuracy() * 2);
+               else
+                 model->SetTheta(model->GetTheta() + 0.1);
                break;
 
           case SDLK_DOWN:
-               model->SetTheta(std::max(model->GetTheta() - 0.1, 0.1));
+               if (model->GetOpeningCriterion()==OPENING_SALMON_WARREN || model->GetOpeningCriterion()==OPENING_RELATIVE)
+                 model->SetOpeningCriterion(model->GetOpeningCriterion(), model->GetOpeningAccuracy() / 2);
+               else
+                 model->SetTheta(std::max(model->GetTheta() - 0.1, 0.1));
                break;
 
           case SDLK_RIGHT:
@@ -13,12 +13,15 @@
 #include "Trees/Quadtree.h"
 #include "Models/NBody.h"
 #include "Interfaces/IIntegrator.h"
+#include "IO/TrajectoryWriter.h"
+#include "IO/TrajectoryReader.h"
 
 class DisplayWindow : public IDisplay
 {
 public:
 
     DisplayWindow(Json::Value config);
+    ~DisplayWindow();
     virtual void Render();
     virtual void OnProcessEvents(uint8_t type);
     void Init();
@@ -26,14 +29,36 @@ public:
 private:
 
     DisplayWindow(const DisplayWindow& orig);
-    void DrawParticles();
+    void DrawParticles(const ParticleState2D *state, const ParticleParameters *parameters, int particles);
+    void InitReplay(const Json::Value &replaySettings);
+    void ReplayStep();
+    bool ProcessReplayKey(SDLKey key);
     void ShowStatisticsConsole();
     void DrawTree();
     void DrawTreeNode(Quadtree *treeNode, int level);
+    void CreateIntegrator(const std::string &name, double timeStep);
+    void WriteCheckpoint();
+    void WriteMetrics();
+    void WriteDiagnostics(unsigned long long step);
+    void WriteTrace();
 
     NBody *model;
     IIntegrator *integrator;
+    TrajectoryWriter *trajectory;
+    TrajectoryReader *replay;
+    double replayPosition;
+    double replaySpeed;
+    unsigned replayPrefetch;
     Json::Value configuration;
+    std::string checkpointFile;
+    int checkpointInterval;
+    std::string metricsFile;
+    std::string metricsFormat;
+    int metricsInterval;
+    std::string diagnosticsFile;
+    int diagnosticsInterval;
+    std::string traceFile;
+    unsigned long long stepCount;
 
     int cameraSettings;
     bool showAxis;
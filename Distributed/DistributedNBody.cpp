@@ -0,0 +1,312 @@
+// Standard includes
+#include <cmath>
+#include <limits>
+#include <algorithm>
+#include <stdexcept>
+#include <omp.h>
+
+// Project includes
+#include "DistributedNBody.h"
+#include "../Utils/Tracer.h"
+
+DistributedNBody::DistributedNBody(MPI_Comm comm, double G, double theta, double softening)
+  : IModel("N-Body simulation (2D, MPI)")
+  ,communicator(comm)
+  ,decomposition(comm)
+  ,quadtree(Vector2D(), Vector2D())
+  ,localState()
+  ,localParameters()
+  ,cost()
+  ,importedState()
+  ,importedParameters()
+  ,particlePotential()
+  ,diagnostics()
+  ,diagnosticsRequested(false)
+  ,importedNodes(0)
+  ,exportedNodes(0)
+{
+  quadtree.SetGravitationalConstant(G);
+  quadtree.SetTheta(theta);
+  quadtree.SetSoftening(softening);
+}
+
+void DistributedNBody::SetParticles(const ParticleState2D *state, const ParticleParameters *parameters, int particles)
+{
+  localState.assign(state, state + particles);
+  localParameters.assign(parameters, parameters + particles);
+  cost.assign(particles, 1);
+  SetSimulationDimension(particles*4);
+}
+
+void DistributedNBody::Rebalance(const double *state)
+{
+  TRACE_SCOPE("Rebalance");
+
+  const ParticleState2D *particleState = reinterpret_cast<const ParticleState2D*>(state);
+  if (state!=GetInitialState())
+    std::copy(particleState, particleState + localState.size(), localState.begin());
+
+  decomposition.Exchange(localState, localParameters, cost);
+  SetSimulationDimension(localState.size()*4);
+}
+
+double* DistributedNBody::GetInitialState()
+{
+  return localState.empty() ? NULL : reinterpret_cast<double*>(&localState[0]);
+}
+
+void DistributedNBody::RequestDiagnostics()
+{
+  diagnosticsRequested = true;
+}
+
+const Diagnostics& DistributedNBody::GetDiagnostics() const
+{
+  return diagnostics;
+}
+
+const DomainDecomposition& DistributedNBody::GetDecomposition() const
+{
+  return decomposition;
+}
+
+const ParticleParameters* DistributedNBody::GetParticleParameters() const
+{
+  return localParameters.empty() ? NULL : &localParameters[0];
+}
+
+int DistributedNBody::GetLocalParticles() const
+{
+  return (int)localState.size();
+}
+
+double DistributedNBody::GetLocalCost() const
+{
+  double total = 0;
+  for (std::size_t i=0; i<cost.size(); ++i)
+    total += cost[i];
+  return total;
+}
+
+long long DistributedNBody::GetImportedNodes() const
+{
+  return importedNodes;
+}
+
+long long DistributedNBody::GetExportedNodes() const
+{
+  return exportedNodes;
+}
+
+void DistributedNBody::Evaluate(double *state, double time, double *derivative)
+{
+  ParticleState2D *particleState = reinterpret_cast<ParticleState2D*>(state);
+  ParticleNextState2D *particleNextState = reinterpret_cast<ParticleNextState2D*>(derivative);
+
+  BuiltTree(particleState);
+  ExchangeEssentialTrees(particleState);
+
+  if (!diagnosticsRequested)
+  {
+    CalculateForces(particleState, particleNextState, NULL);
+    return;
+  }
+
+  // The first evaluation of a step sees the state at its beginning
+  diagnosticsRequested = false;
+  particlePotential.resize(localState.size());
+  CalculateForces(particleState, particleNextState, particlePotential.empty() ? NULL : &particlePotential[0]);
+  SampleDiagnostics(particleState, time);
+}
+
+void DistributedNBody::BuiltTree(ParticleState2D *particleState)
+{
+  TRACE_SCOPE("Tree build");
+  const int particles = (int)localState.size();
+
+  // All ranks share the root, so it covers the nodes received from the others
+  Vector2D min, max;
+  decomposition.GetBounds(particleState, particles, min, max);
+  const double half = 0.5 * 1.05 * std::max(std::max(max.x - min.x, max.y - min.y), 1e-6);
+  const Vector2D center(0.5 * (min.x + max.x), 0.5 * (min.y + max.y));
+
+  quadtree.Reset(Vector2D(center.x - half, center.y - half), Vector2D(center.x + half, center.y + half));
+
+  for (int i=0; i<particles; ++i)
+  {
+    if (localParameters[i].mass<=0)
+      continue;
+
+    try
+    {
+      quadtree.Insert(ParticleData2D(&particleState[i], &localParameters[i]), 0);
+    }
+    catch(std::exception &exc)
+    {
+      // Particle outside the area of interest. Do nothing
+    }
+  }
+
+  quadtree.ComputeMassDistribution();
+}
+
+void DistributedNBody::ExportNode(const Quadtree *node, const Vector2D &min, const Vector2D &max, std::vector<double> &out) const
+{
+  // Also skips nodes holding only coinciding particles, they are sent from the outside list
+  if (!(node->GetMass()>0))
+    return;
+
+  const Vector2D &massCenter = node->GetMassCenter();
+  const double dx = std::max(0.0, std::max(min.x - massCenter.x, massCenter.x - max.x)),
+               dy = std::max(0.0, std::max(min.y - massCenter.y, massCenter.y - max.y));
+  const double r = std::sqrt(dx*dx + dy*dy),
+               d = node->GetMaximumDimension().x - node->GetMinimumDimension().x;
+
+  // Accepted for the nearest point of the box, so for every particle in it
+  if (node->GetAllNodesParticles()==1 || (r>0 && d/r <= quadtree.GetTheta()))
+  {
+    out.push_back(massCenter.x);
+    out.push_back(massCenter.y);
+    out.push_back(node->GetMass());
+    return;
+  }
+
+  for (int c=0; c<Quadtree::Children; ++c)
+  {
+    if (node->childNode[c])
+      ExportNode(node->childNode[c], min, max, out);
+  }
+}
+
+void DistributedNBody::ExchangeEssentialTrees(const ParticleState2D *particleState)
+{
+  TRACE_SCOPE("Essential tree exchange");
+  const int ranks = decomposition.GetSize(), rank = decomposition.GetRank();
+  const int particles = (int)localState.size();
+
+  // Bounding boxes of the particles of every rank, empty ranks have inverted boxes
+  const double huge = std::numeric_limits<double>::max();
+  double box[4] = {huge, huge, -huge, -huge};
+  for (int i=0; i<particles; ++i)
+  {
+    box[0] = std::min(box[0], particleState[i].positionX);
+    box[1] = std::min(box[1], particleState[i].positionY);
+    box[2] = std::max(box[2], particleState[i].positionX);
+    box[3] = std::max(box[3], particleState[i].positionY);
+  }
+
+  std::vector<double> boxes(4*ranks);
+  MPI_Allgather(box, 4, MPI_DOUBLE, &boxes[0], 4, MPI_DOUBLE, communicator);
+
+  // Branches for every other rank, three doubles (x, y, mass) per node
+  std::vector< std::vector<double> > exports(ranks);
+  #pragma omp parallel for schedule(dynamic)
+  for (int r=0; r<ranks; ++r)
+  {
+    if (r==rank || boxes[4*r]>boxes[4*r + 2])
+      continue;
+
+    ExportNode(&quadtree, Vector2D(boxes[4*r], boxes[4*r + 1]), Vector2D(boxes[4*r + 2], boxes[4*r + 3]), exports[r]);
+
+    const std::vector<ParticleData2D> &outside = quadtree.GetOutsideParticles();
+    for (std::size_t i=0; i<outside.size(); ++i)
+    {
+      exports[r].push_back(outside[i].particleState->positionX);
+      exports[r].push_back(outside[i].particleState->positionY);
+      exports[r].push_back(outside[i].particleParameters->mass);
+    }
+  }
+
+  std::vector<int> sendCounts(ranks), sendOffsets(ranks, 0), receiveCounts(ranks), receiveOffsets(ranks, 0);
+  for (int r=0; r<ranks; ++r)
+    sendCounts[r] = (int)exports[r].size();
+  MPI_Alltoall(&sendCounts[0], 1, MPI_INT, &receiveCounts[0], 1, MPI_INT, communicator);
+
+  for (int r=1; r<ranks; ++r)
+  {
+    sendOffsets[r] = sendOffsets[r - 1] + sendCounts[r - 1];
+    receiveOffsets[r] = receiveOffsets[r - 1] + receiveCounts[r - 1];
+  }
+
+  std::vector<double> sendBuffer(sendOffsets[ranks - 1] + sendCounts[ranks - 1] + 1);
+  std::vector<double> receiveBuffer(receiveOffsets[ranks - 1] + receiveCounts[ranks - 1] + 1);
+  for (int r=0; r<ranks; ++r)
+    std::copy(exports[r].begin(), exports[r].end(), sendBuffer.begin() + sendOffsets[r]);
+
+  MPI_Alltoallv(&sendBuffer[0], &sendCounts[0], &sendOffsets[0], MPI_DOUBLE,
+                &receiveBuffer[0], &receiveCounts[0], &receiveOffsets[0], MPI_DOUBLE, communicator);
+
+  exportedNodes = (sendBuffer.size() - 1) / 3;
+  importedNodes = (receiveBuffer.size() - 1) / 3;
+
+  // Addresses must stay fixed while the tree points at them
+  importedState.resize(importedNodes);
+  importedParameters.resize(importedNodes);
+  for (long long i=0; i<importedNodes; ++i)
+  {
+    ParticleState2D &s = importedState[i];
+    s.positionX = receiveBuffer[3*i];
+    s.positionY = receiveBuffer[3*i + 1];
+    s.velocityX = s.velocityY = 0;
+    importedParameters[i].mass = receiveBuffer[3*i + 2];
+    importedParameters[i].radius = 0;
+
+    try
+    {
+      quadtree.Insert(ParticleData2D(&importedState[i], &importedParameters[i]), 0);
+    }
+    catch(std::exception &exc)
+    {
+      // Node outside the area of interest. Do nothing
+    }
+  }
+
+  quadtree.ComputeMassDistribution();
+}
+
+void DistributedNBody::CalculateForces(ParticleState2D *particleState, ParticleNextState2D *particleNextState, double *potential)
+{
+  TRACE_SCOPE("Tree force");
+  const int particles = (int)localState.size();
+
+  #pragma omp parallel
+  {
+    TreeCounters counters;
+
+    #pragma omp for schedule(dynamic, 256)
+    for (int i=0; i<particles; ++i)
+    {
+      const long long before = counters.interactions;
+      ParticleData2D particle(&particleState[i], &localParameters[i]);
+      Vector2D acceleration = quadtree.CalculateForce(particle, counters, potential ? &potential[i] : NULL);
+      particleNextState[i].accelerationX = acceleration.x;
+      particleNextState[i].accelerationY = acceleration.y;
+      particleNextState[i].velocityX = particleState[i].velocityX;
+      particleNextState[i].velocityY = particleState[i].velocityY;
+
+      // Measured work of the particle for the next rebalance
+      cost[i] = (double)(counters.interactions - before) + 1;
+    }
+  }
+}
+
+void DistributedNBody::SampleDiagnostics(const ParticleState2D *particleState, double time)
+{
+  // Every rank reduces its own particles, the sums are combined over all ranks
+  Diagnostics local;
+  local.Sample(particleState, GetParticleParameters(), particlePotential.empty() ? NULL : &particlePotential[0],
+               NULL, (int)localState.size(), time);
+
+  const DiagnosticsSample &sample = local.GetSample();
+  double sums[5] = {sample.kineticEnergy, sample.potentialEnergy, sample.momentumX, sample.momentumY, sample.angularMomentum};
+  MPI_Allreduce(MPI_IN_PLACE, sums, 5, MPI_DOUBLE, MPI_SUM, communicator);
+
+  DiagnosticsSample global;
+  global.time = time;
+  global.kineticEnergy = sums[0];
+  global.potentialEnergy = sums[1];
+  global.momentumX = sums[2];
+  global.momentumY = sums[3];
+  global.angularMomentum = sums[4];
+  diagnostics.SetSample(global);
+}
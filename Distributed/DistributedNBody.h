@@ -0,0 +1,71 @@
+#ifndef _DISTRIBUTEDNBODY
+#define _DISTRIBUTEDNBODY
+
+// Standard includes
+#include <vector>
+
+// Library includes
+#include <mpi.h>
+
+// Project includes
+#include "../Interfaces/IModel.h"
+#include "../Trees/Quadtree.h"
+#include "../Structs/Particles.h"
+#include "../Utils/Diagnostics.h"
+#include "DomainDecomposition.h"
+
+// N-body model of the particles owned by one MPI rank. Every evaluation builds the tree of the local particles,
+// sends every other rank the "locally essential" part of it (nodes that pass the opening criterion for that
+// rank's whole bounding box, opened down to single particles otherwise) and adds the received nodes to the
+// local tree as point masses before the force pass. Massless particles are targets only, like tracers in NBody.
+class DistributedNBody : public IModel
+{
+public:
+
+    DistributedNBody(MPI_Comm communicator, double gravitationalConstant, double theta, double softening);
+
+    // Particles of this rank, Rebalance moves them to their domains
+    void SetParticles(const ParticleState2D *state, const ParticleParameters *parameters, int particles);
+    // Redistributes the given local state by the cost of the last force pass,
+    // the simulation dimension changes with the number of local particles
+    void Rebalance(const double *state);
+
+    virtual void Evaluate(double *state, double time, double *derivative);
+    virtual double* GetInitialState();
+
+    void RequestDiagnostics();
+    const Diagnostics& GetDiagnostics() const;
+    const DomainDecomposition& GetDecomposition() const;
+    const ParticleParameters* GetParticleParameters() const;
+    int GetLocalParticles() const;
+    double GetLocalCost() const;
+    long long GetImportedNodes() const;
+    long long GetExportedNodes() const;
+
+private:
+
+    DistributedNBody(const DistributedNBody &ref);
+    DistributedNBody& operator=(const DistributedNBody &ref);
+
+    void BuiltTree(ParticleState2D *state);
+    void ExchangeEssentialTrees(const ParticleState2D *state);
+    void ExportNode(const Quadtree *node, const Vector2D &min, const Vector2D &max, std::vector<double> &out) const;
+    void CalculateForces(ParticleState2D *state, ParticleNextState2D *nextState, double *potential);
+    void SampleDiagnostics(const ParticleState2D *state, double time);
+
+    MPI_Comm communicator;
+    DomainDecomposition decomposition;
+    Quadtree quadtree;
+    std::vector<ParticleState2D> localState;
+    std::vector<ParticleParameters> localParameters;
+    std::vector<double> cost;                       // tree interactions of every particle in the last force pass
+    std::vector<ParticleState2D> importedState;     // nodes of other ranks, as massive points
+    std::vector<ParticleParameters> importedParameters;
+    std::vector<double> particlePotential;
+    Diagnostics diagnostics;
+    bool diagnosticsRequested;
+    long long importedNodes;
+    long long exportedNodes;
+};
+
+#endif
@@ -0,0 +1,205 @@
+// Standard includes
+#include <cmath>
+#include <limits>
+#include <algorithm>
+#include <stdexcept>
+
+// Project includes
+#include "DomainDecomposition.h"
+
+namespace
+{
+  // Particles move between ranks as one record
+  struct MigratingParticle
+  {
+    ParticleState2D state;
+    ParticleParameters parameters;
+    double cost;
+  };
+
+  uint32_t SpreadBits(uint32_t v)
+  {
+    v = (v | (v << 8)) & 0x00FF00FF;
+    v = (v | (v << 4)) & 0x0F0F0F0F;
+    v = (v | (v << 2)) & 0x33333333;
+    v = (v | (v << 1)) & 0x55555555;
+    return v;
+  }
+}
+
+DomainDecomposition::DomainDecomposition(MPI_Comm comm)
+  :communicator(comm)
+  ,rank(0)
+  ,size(1)
+  ,splitters()
+{
+  MPI_Comm_rank(communicator, &rank);
+  MPI_Comm_size(communicator, &size);
+}
+
+int DomainDecomposition::GetRank() const
+{
+  return rank;
+}
+
+int DomainDecomposition::GetSize() const
+{
+  return size;
+}
+
+const std::vector<uint32_t>& DomainDecomposition::GetSplitters() const
+{
+  return splitters;
+}
+
+uint32_t DomainDecomposition::GetKey(double x, double y, const Vector2D &min, double size)
+{
+  const double cells = 65536;
+  uint32_t qx = (uint32_t)std::min(std::max((x - min.x) / size * cells, 0.0), cells - 1),
+           qy = (uint32_t)std::min(std::max((y - min.y) / size * cells, 0.0), cells - 1);
+  return SpreadBits(qx) | (SpreadBits(qy) << 1);
+}
+
+void DomainDecomposition::GetBounds(const ParticleState2D *state, int particles, Vector2D &min, Vector2D &max) const
+{
+  const double huge = std::numeric_limits<double>::max();
+  double minX = huge, minY = huge, maxX = -huge, maxY = -huge;
+
+  #pragma omp parallel for reduction(min:minX,minY) reduction(max:maxX,maxY)
+  for (int i=0; i<particles; ++i)
+  {
+    minX = std::min(minX, state[i].positionX);
+    minY = std::min(minY, state[i].positionY);
+    maxX = std::max(maxX, state[i].positionX);
+    maxY = std::max(maxY, state[i].positionY);
+  }
+
+  // One reduction: the maxima are negated minima
+  double bounds[4] = {minX, minY, -maxX, -maxY};
+  MPI_Allreduce(MPI_IN_PLACE, bounds, 4, MPI_DOUBLE, MPI_MIN, communicator);
+
+  min = Vector2D(bounds[0], bounds[1]);
+  max = Vector2D(-bounds[2], -bounds[3]);
+}
+
+void DomainDecomposition::FindSplitters(const std::vector<uint32_t> &sortedKeys, const std::vector<double> &prefixCost)
+{
+  const int count = size - 1;
+  double total = prefixCost.back();
+  MPI_Allreduce(MPI_IN_PLACE, &total, 1, MPI_DOUBLE, MPI_SUM, communicator);
+
+  // All splitters are bisected together, each round costs one reduction of the cost below every candidate
+  std::vector<uint64_t> low(count, 0), high(count, (uint64_t)1 << 32);
+  std::vector<double> below(count);
+
+  for (int round=0; round<33; ++round)
+  {
+    for (int k=0; k<count; ++k)
+    {
+      const uint64_t middle = (low[k] + high[k]) / 2;
+      const std::size_t index = (middle>std::numeric_limits<uint32_t>::max()) ? sortedKeys.size() :
+        std::lower_bound(sortedKeys.begin(), sortedKeys.end(), (uint32_t)middle) - sortedKeys.begin();
+      below[k] = prefixCost[index];
+    }
+
+    if (count>0)
+      MPI_Allreduce(MPI_IN_PLACE, &below[0], count, MPI_DOUBLE, MPI_SUM, communicator);
+
+    // Smallest key with at least (k+1)/size of the cost below it
+    for (int k=0; k<count; ++k)
+    {
+      if (low[k]>=high[k])
+        continue;
+
+      const uint64_t middle = (low[k] + high[k]) / 2;
+      if (below[k] >= total * (k + 1) / size)
+        high[k] = middle;
+      else
+        low[k] = middle + 1;
+    }
+  }
+
+  splitters.resize(count);
+  for (int k=0; k<count; ++k)
+    splitters[k] = (uint32_t)std::min<uint64_t>(low[k], std::numeric_limits<uint32_t>::max());
+}
+
+void DomainDecomposition::Exchange(std::vector<ParticleState2D> &state,
+                                   std::vector<ParticleParameters> &parameters,
+                                   std::vector<double> &cost)
+{
+  const int particles = (int)state.size();
+  if (parameters.size()!=state.size() || cost.size()!=state.size())
+    throw std::runtime_error("Particle arrays of the decomposition differ in size.");
+
+  Vector2D min, max;
+  GetBounds(particles ? &state[0] : NULL, particles, min, max);
+  const double extent = std::max(std::max(max.x - min.x, max.y - min.y), std::numeric_limits<double>::min());
+
+  // Local particles sorted along the curve
+  std::vector< std::pair<uint32_t, int> > order(particles);
+  #pragma omp parallel for
+  for (int i=0; i<particles; ++i)
+    order[i] = std::make_pair(GetKey(state[i].positionX, state[i].positionY, min, extent), i);
+  std::sort(order.begin(), order.end());
+
+  std::vector<uint32_t> keys(particles);
+  std::vector<double> prefixCost(particles + 1, 0);
+  for (int i=0; i<particles; ++i)
+  {
+    keys[i] = order[i].first;
+    prefixCost[i + 1] = prefixCost[i] + cost[order[i].second];
+  }
+
+  FindSplitters(keys, prefixCost);
+
+  // Sorted keys make the send buffer ordered by destination rank
+  std::vector<MigratingParticle> sendBuffer(particles);
+  std::vector<int> sendCounts(size, 0), sendOffsets(size, 0), receiveCounts(size), receiveOffsets(size, 0);
+  for (int i=0; i<particles; ++i)
+  {
+    const int owner = std::upper_bound(splitters.begin(), splitters.end(), keys[i]) - splitters.begin();
+    MigratingParticle &p = sendBuffer[i];
+    p.state = state[order[i].second];
+    p.parameters = parameters[order[i].second];
+    p.cost = cost[order[i].second];
+    ++sendCounts[owner];
+  }
+
+  MPI_Alltoall(&sendCounts[0], 1, MPI_INT, &receiveCounts[0], 1, MPI_INT, communicator);
+  for (int r=1; r<size; ++r)
+  {
+    sendOffsets[r] = sendOffsets[r - 1] + sendCounts[r - 1];
+    receiveOffsets[r] = receiveOffsets[r - 1] + receiveCounts[r - 1];
+  }
+
+  // Counts and offsets are in particles, so they stay within an int up to 2^31 particles per rank
+  MPI_Datatype particleType;
+  MPI_Type_contiguous(sizeof(MigratingParticle), MPI_BYTE, &particleType);
+  MPI_Type_commit(&particleType);
+
+  const int received = receiveOffsets[size - 1] + receiveCounts[size - 1];
+  std::vector<MigratingParticle> receiveBuffer(received);
+  MPI_Alltoallv(particles ? &sendBuffer[0] : NULL, &sendCounts[0], &sendOffsets[0], particleType,
+                received ? &receiveBuffer[0] : NULL, &receiveCounts[0], &receiveOffsets[0], particleType,
+                communicator);
+  MPI_Type_free(&particleType);
+
+  // Every sender's range is sorted, the ranges of lower ranks come first
+  std::vector< std::pair<uint32_t, int> > receivedOrder(received);
+  #pragma omp parallel for
+  for (int i=0; i<received; ++i)
+    receivedOrder[i] = std::make_pair(GetKey(receiveBuffer[i].state.positionX, receiveBuffer[i].state.positionY, min, extent), i);
+  std::stable_sort(receivedOrder.begin(), receivedOrder.end());
+
+  state.resize(received);
+  parameters.resize(received);
+  cost.resize(received);
+  for (int i=0; i<received; ++i)
+  {
+    const MigratingParticle &p = receiveBuffer[receivedOrder[i].second];
+    state[i] = p.state;
+    parameters[i] = p.parameters;
+    cost[i] = p.cost;
+  }
+}
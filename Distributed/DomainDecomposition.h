@@ -0,0 +1,50 @@
+#ifndef _DOMAINDECOMPOSITION
+#define _DOMAINDECOMPOSITION
+
+// Standard includes
+#include <vector>
+#include <stdint.h>
+
+// Library includes
+#include <mpi.h>
+
+// Project includes
+#include "../Structs/Vectors.h"
+#include "../Structs/Particles.h"
+
+// Splits the particles across MPI ranks into contiguous ranges of a Morton (Z-order) curve,
+// so every rank gets the same share of the measured force cost
+class DomainDecomposition
+{
+public:
+
+  explicit DomainDecomposition(MPI_Comm communicator);
+
+  int GetRank() const;
+  int GetSize() const;
+
+  // Moves the particles to the ranks owning their keys and sorts them along the curve,
+  // cost is the work of every particle in the last force pass and travels with it
+  void Exchange(std::vector<ParticleState2D> &state,
+                std::vector<ParticleParameters> &parameters,
+                std::vector<double> &cost);
+
+  const std::vector<uint32_t>& GetSplitters() const;
+
+  // Global bounding box of the given particles
+  void GetBounds(const ParticleState2D *state, int particles, Vector2D &min, Vector2D &max) const;
+
+  // 16 bits per coordinate, interleaved
+  static uint32_t GetKey(double x, double y, const Vector2D &min, double size);
+
+private:
+
+  void FindSplitters(const std::vector<uint32_t> &sortedKeys, const std::vector<double> &prefixCost);
+
+  MPI_Comm communicator;
+  int rank;
+  int size;
+  std::vector<uint32_t> splitters;    // first key of every rank but the first
+};
+
+#endif
@@ -0,0 +1,362 @@
+// Standard includes
+#include <cstring>
+#include <cstdlib>
+#include <cerrno>
+#include <stdexcept>
+#include <sstream>
+#include <algorithm>
+
+// System includes
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <omp.h>
+
+// Project includes
+#include "ParticleImport.h"
+
+namespace
+{
+  // Text is parsed in chunks of about this size, several per thread for load balance
+  const std::size_t chunkSize = 4 << 20;
+
+  const std::size_t binaryRecordSize = 6*sizeof(double);
+
+  std::string ErrorMessage(const std::string &what, const std::string &fileName)
+  {
+    std::stringstream ss;
+    ss << what << " '" << fileName << "': " << strerror(errno);
+    return ss.str();
+  }
+
+  bool IsSeparator(char c)
+  {
+    return c==' ' || c=='\t' || c==',' || c==';';
+  }
+
+  bool IsLineEnd(char c)
+  {
+    return c=='\n' || c=='\r' || c=='\0';
+  }
+
+  // Particles are on lines starting with a number, anything else is a header or a comment
+  bool IsDataLine(const char *line, const char *end)
+  {
+    while (line<end && (*line==' ' || *line=='\t'))
+      ++line;
+
+    return line<end && ((*line>='0' && *line<='9') || *line=='-' || *line=='+' || *line=='.');
+  }
+
+  // Exactly representable powers of ten
+  const double powersOfTen[23] = {1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+                                  1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+
+  // Clinger's fast path: a mantissa below 2^53 scaled by an exact power of ten is correctly
+  // rounded by a single multiplication or division. Everything else is left to strtod.
+  double ParseNumber(const char *text, char **end)
+  {
+    const char *p = text;
+    bool negative = (*p=='-');
+    if (*p=='-' || *p=='+')
+      ++p;
+
+    uint64_t mantissa = 0;
+    int digits = 0, exponent = 0;
+    const char *start = p;
+
+    for (; *p>='0' && *p<='9'; ++p, ++digits)
+      mantissa = mantissa*10 + (*p - '0');
+
+    if (*p=='.')
+    {
+      for (++p; *p>='0' && *p<='9'; ++p, ++digits, --exponent)
+        mantissa = mantissa*10 + (*p - '0');
+    }
+
+    if (digits==0 || p==start)
+      return strtod(text, end);
+
+    if (*p=='e' || *p=='E')
+    {
+      const char *q = p + 1;
+      bool negativeExponent = (*q=='-');
+      if (*q=='-' || *q=='+')
+        ++q;
+
+      if (!(*q>='0' && *q<='9'))
+        return strtod(text, end);
+
+      int value = 0;
+      for (; *q>='0' && *q<='9' && value<10000; ++q)
+        value = value*10 + (*q - '0');
+
+      exponent += negativeExponent ? -value : value;
+      p = q;
+    }
+
+    if (digits>19 || mantissa>((uint64_t)1 << 53) || exponent<-22 || exponent>22)
+      return strtod(text, end);
+
+    double value = (double)mantissa;
+    value = (exponent<0) ? value / powersOfTen[-exponent] : value * powersOfTen[exponent];
+
+    *end = const_cast<char*>(p);
+    return negative ? -value : value;
+  }
+
+  const char* NextLine(const char *line, const char *end)
+  {
+    const char *newLine = static_cast<const char*>(memchr(line, '\n', end - line));
+    return newLine ? newLine + 1 : end;
+  }
+
+  // The line has to be terminated by a line end inside the readable memory
+  bool ParseLine(const char *line, ParticleState2D &state, ParticleParameters &parameters)
+  {
+    double values[6] = {0, 0, 0, 0, 0, 0};
+    int fields = 0;
+
+    while (fields<6)
+    {
+      while (IsSeparator(*line))
+        ++line;
+
+      if (IsLineEnd(*line))
+        break;
+
+      char *next;
+      values[fields] = ParseNumber(line, &next);
+      if (next==line)
+        return false;
+
+      line = next;
+      ++fields;
+    }
+
+    if (fields<5)
+      return false;
+
+    state.positionX = values[0];
+    state.positionY = values[1];
+    state.velocityX = values[2];
+    state.velocityY = values[3];
+    parameters.mass = values[4];
+    parameters.radius = values[5];
+    return true;
+  }
+}
+
+ParticleImport::ParticleImport()
+  :name()
+  ,format(BINARY)
+  ,mapping(NULL)
+  ,mappingSize(0)
+  ,particles(0)
+  ,chunks()
+{}
+
+ParticleImport::~ParticleImport()
+{
+  Close();
+}
+
+ParticleImport::Format ParticleImport::GetFormat(const std::string &fileName, const std::string &format)
+{
+  if (format=="binary")
+    return BINARY;
+  if (format=="csv")
+    return CSV;
+  if (!format.empty())
+    throw std::runtime_error("Unknown import format '" + format + "'.");
+
+  std::string::size_type dot = fileName.rfind('.');
+  std::string extension = (dot==std::string::npos) ? "" : fileName.substr(dot + 1);
+  std::transform(extension.begin(), extension.end(), extension.begin(), ::tolower);
+
+  return (extension=="csv" || extension=="txt" || extension=="dat") ? CSV : BINARY;
+}
+
+void ParticleImport::Open(const std::string &fileName, const std::string &fileFormat)
+{
+  Close();
+
+  name = fileName;
+  format = GetFormat(fileName, fileFormat);
+
+  int fd = open(fileName.c_str(), O_RDONLY);
+  if (fd<0)
+    throw std::runtime_error(ErrorMessage("Can't open particle file", fileName));
+
+  struct stat fileStat;
+  if (fstat(fd, &fileStat)!=0 || fileStat.st_size==0)
+  {
+    close(fd);
+    throw std::runtime_error("Particle file '" + fileName + "' is empty.");
+  }
+
+  mappingSize = fileStat.st_size;
+  void *map = mmap(NULL, mappingSize, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+
+  if (map==MAP_FAILED)
+  {
+    mappingSize = 0;
+    throw std::runtime_error(ErrorMessage("Can't map particle file", fileName));
+  }
+
+  // The file is read once from the beginning to the end
+  mapping = static_cast<const char*>(map);
+  madvise(map, mappingSize, MADV_SEQUENTIAL);
+  madvise(map, mappingSize, MADV_WILLNEED);
+
+  if (format==BINARY)
+  {
+    if (mappingSize % binaryRecordSize)
+    {
+      Close();
+      throw std::runtime_error("Particle file '" + fileName + "' is not a whole number of 6 double records.");
+    }
+
+    particles = mappingSize / binaryRecordSize;
+  }
+  else
+  {
+    SplitChunks();
+  }
+}
+
+void ParticleImport::SplitChunks()
+{
+  const char *end = mapping + mappingSize;
+  std::size_t count = std::max<std::size_t>(omp_get_max_threads(), mappingSize / chunkSize + 1);
+
+  // Chunk boundaries are moved forward to the next line
+  const char *begin = mapping;
+  for (std::size_t i=1; i<=count && begin<end; ++i)
+  {
+    const char *chunkEnd = (i==count) ? end : NextLine(std::max(begin, mapping + mappingSize / count * i), end);
+    if (chunkEnd>begin)
+    {
+      Chunk chunk = {begin, chunkEnd, 0, 0};
+      chunks.push_back(chunk);
+    }
+    begin = chunkEnd;
+  }
+
+  // First pass counts the particles of every chunk
+  #pragma omp parallel for schedule(dynamic)
+  for (int i=0; i<(int)chunks.size(); ++i)
+  {
+    uint64_t chunkParticles = 0;
+    for (const char *line=chunks[i].begin; line<chunks[i].end; line=NextLine(line, chunks[i].end))
+    {
+      if (IsDataLine(line, chunks[i].end))
+        ++chunkParticles;
+    }
+    chunks[i].particles = chunkParticles;
+  }
+
+  particles = 0;
+  for (std::size_t i=0; i<chunks.size(); ++i)
+  {
+    chunks[i].first = particles;
+    particles += chunks[i].particles;
+  }
+}
+
+void ParticleImport::Close()
+{
+  if (mapping)
+    munmap(const_cast<char*>(mapping), mappingSize);
+
+  mapping = NULL;
+  mappingSize = 0;
+  particles = 0;
+  chunks.clear();
+}
+
+ParticleImport::Format ParticleImport::GetFormat() const
+{
+  return format;
+}
+
+uint64_t ParticleImport::GetParticlesCount() const
+{
+  return particles;
+}
+
+void ParticleImport::Read(ParticleState2D *state, ParticleParameters *parameters) const
+{
+  if (!mapping)
+    throw std::runtime_error("Particle file is not open.");
+
+  if (format==BINARY)
+    ReadBinary(state, parameters);
+  else
+    ReadCSV(state, parameters);
+}
+
+void ParticleImport::ReadBinary(ParticleState2D *state, ParticleParameters *parameters) const
+{
+  const long long count = particles;
+
+  #pragma omp parallel for schedule(static)
+  for (long long i=0; i<count; ++i)
+  {
+    const char *record = mapping + i*binaryRecordSize;
+    memcpy(&state[i], record, sizeof(ParticleState2D));
+    memcpy(&parameters[i], record + sizeof(ParticleState2D), sizeof(ParticleParameters));
+  }
+}
+
+void ParticleImport::ReadCSV(ParticleState2D *state, ParticleParameters *parameters) const
+{
+  const char *fileEnd = mapping + mappingSize;
+  std::vector<long long> failed(chunks.size(), -1);
+
+  // Second pass parses every chunk straight into its particle range
+  #pragma omp parallel for schedule(dynamic)
+  for (int i=0; i<(int)chunks.size(); ++i)
+  {
+    const Chunk &chunk = chunks[i];
+    uint64_t particle = chunk.first;
+
+    for (const char *line=chunk.begin; line<chunk.end && failed[i]<0; )
+    {
+      const char *next = NextLine(line, chunk.end);
+
+      if (IsDataLine(line, chunk.end))
+      {
+        bool parsed;
+        if (next==fileEnd && fileEnd[-1]!='\n')
+        {
+          // Last line without a newline, strtod must not run past the mapping
+          std::string lastLine(line, next);
+          parsed = ParseLine(lastLine.c_str(), state[particle], parameters[particle]);
+        }
+        else
+        {
+          parsed = ParseLine(line, state[particle], parameters[particle]);
+        }
+
+        if (!parsed)
+          failed[i] = particle;
+        ++particle;
+      }
+
+      line = next;
+    }
+  }
+
+  for (std::size_t i=0; i<failed.size(); ++i)
+  {
+    if (failed[i]>=0)
+    {
+      std::stringstream error;
+      error << "Particle file '" << name << "': particle " << failed[i] + 1 << " needs at least 5 numeric fields.";
+      throw std::runtime_error(error.str());
+    }
+  }
+}
@@ -0,0 +1,71 @@
+#ifndef _PARTICLEIMPORT
+#define _PARTICLEIMPORT
+
+// Standard includes
+#include <string>
+#include <vector>
+#include <cstddef>
+#include <stdint.h>
+
+// Project includes
+#include "../Structs/Particles.h"
+
+// Initial conditions produced by other codes. Every particle is a record of
+// positionX, positionY, velocityX, velocityY, mass and radius (optional in text
+// files, 0 for stars), in parsecs, parsecs/year and solar masses.
+//
+// BINARY: native doubles, 6 per particle, no header
+// CSV:    one particle per line, fields separated by commas, semicolons or
+//         blanks; lines not starting with a number (headers, comments) are skipped
+class ParticleImport
+{
+public:
+
+  enum Format
+  {
+    BINARY = 0,
+    CSV
+  };
+
+  ParticleImport();
+  ~ParticleImport();
+
+  // Maps the file and counts the particles, an empty format is taken from the extension
+  void Open(const std::string &fileName, const std::string &format);
+  void Close();
+
+  Format GetFormat() const;
+  uint64_t GetParticlesCount() const;
+
+  // Fills the arrays in parallel, both must hold GetParticlesCount() particles
+  void Read(ParticleState2D *state, ParticleParameters *parameters) const;
+
+  static Format GetFormat(const std::string &fileName, const std::string &format);
+
+private:
+
+  ParticleImport(const ParticleImport &ref);
+  ParticleImport& operator=(const ParticleImport &ref);
+
+  void SplitChunks();
+  void ReadBinary(ParticleState2D *state, ParticleParameters *parameters) const;
+  void ReadCSV(ParticleState2D *state, ParticleParameters *parameters) const;
+
+  // Part of a text file starting at a line, with its first particle index
+  struct Chunk
+  {
+    const char *begin;
+    const char *end;
+    uint64_t first;
+    uint64_t particles;
+  };
+
+  std::string name;
+  Format format;
+  const char *mapping;
+  std::size_t mappingSize;
+  uint64_t particles;
+  std::vector<Chunk> chunks;
+};
+
+#endif
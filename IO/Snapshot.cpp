@@ -0,0 +1,203 @@
+// Standard includes
+#include <cstring>
+#include <cerrno>
+#include <stdexcept>
+#include <sstream>
+
+// System includes
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// Project includes
+#include "Snapshot.h"
+
+const uint32_t Snapshot::version = 2;
+const std::size_t Snapshot::alignment = 4096;
+
+namespace
+{
+  const char snapshotMagic[8] = {'G', 'A', 'L', 'S', 'N', 'A', 'P', '\0'};
+
+  uint64_t AlignOffset(uint64_t offset)
+  {
+    return (offset + Snapshot::alignment - 1) / Snapshot::alignment * Snapshot::alignment;
+  }
+
+  std::string ErrorMessage(const std::string &what, const std::string &fileName)
+  {
+    std::stringstream ss;
+    ss << what << " '" << fileName << "': " << strerror(errno);
+    return ss.str();
+  }
+
+  void WriteBlock(int fd, uint64_t offset, const void *data, uint64_t size, const std::string &fileName)
+  {
+    const char *buffer = static_cast<const char*>(data);
+    while (size>0)
+    {
+      ssize_t written = pwrite(fd, buffer, size, offset);
+      if (written<0)
+      {
+        if (errno==EINTR)
+          continue;
+        throw std::runtime_error(ErrorMessage("Can't write snapshot", fileName));
+      }
+
+      buffer += written;
+      offset += written;
+      size -= written;
+    }
+  }
+}
+
+Snapshot::Snapshot()
+  :mapping(NULL)
+  ,mappingSize(0)
+  ,header(NULL)
+{}
+
+Snapshot::~Snapshot()
+{
+  Close();
+}
+
+SnapshotHeader Snapshot::CreateHeader(uint64_t particles)
+{
+  SnapshotHeader newHeader;
+  memset(&newHeader, 0, sizeof(newHeader));
+  memcpy(newHeader.magic, snapshotMagic, sizeof(snapshotMagic));
+
+  newHeader.version = version;
+  newHeader.headerSize = sizeof(SnapshotHeader);
+  newHeader.particles = particles;
+  newHeader.stateOffset = AlignOffset(sizeof(SnapshotHeader));
+  newHeader.parametersOffset = AlignOffset(newHeader.stateOffset + particles*sizeof(ParticleState2D));
+  newHeader.fileSize = AlignOffset(newHeader.parametersOffset + particles*sizeof(ParticleParameters));
+
+  return newHeader;
+}
+
+void Snapshot::Write(const std::string &fileName,
+                     const SnapshotHeader &header,
+                     const ParticleState2D *state,
+                     const ParticleParameters *parameters)
+{
+  // Write to a temporary file first, so a preempted run never leaves a broken checkpoint behind
+  std::string tempName = fileName + ".tmp";
+  int fd = open(tempName.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd<0)
+    throw std::runtime_error(ErrorMessage("Can't create snapshot", tempName));
+
+  try
+  {
+    if (ftruncate(fd, header.fileSize)!=0)
+      throw std::runtime_error(ErrorMessage("Can't resize snapshot", tempName));
+
+    WriteBlock(fd, 0, &header, sizeof(header), tempName);
+    WriteBlock(fd, header.stateOffset, state, header.particles*sizeof(ParticleState2D), tempName);
+    WriteBlock(fd, header.parametersOffset, parameters, header.particles*sizeof(ParticleParameters), tempName);
+
+    if (fsync(fd)!=0)
+      throw std::runtime_error(ErrorMessage("Can't flush snapshot", tempName));
+  }
+  catch(...)
+  {
+    close(fd);
+    unlink(tempName.c_str());
+    throw;
+  }
+
+  close(fd);
+
+  if (rename(tempName.c_str(), fileName.c_str())!=0)
+    throw std::runtime_error(ErrorMessage("Can't replace snapshot", fileName));
+}
+
+void Snapshot::Open(const std::string &fileName)
+{
+  Close();
+
+  int fd = open(fileName.c_str(), O_RDONLY);
+  if (fd<0)
+    throw std::runtime_error(ErrorMessage("Can't open snapshot", fileName));
+
+  struct stat fileStat;
+  if (fstat(fd, &fileStat)!=0 || (std::size_t)fileStat.st_size<sizeof(SnapshotHeader))
+  {
+    close(fd);
+    throw std::runtime_error("Snapshot '" + fileName + "' is truncated.");
+  }
+
+  // Private writable mapping: particle data is used in place and pages are copied only when modified
+  mappingSize = fileStat.st_size;
+  mapping = mmap(NULL, mappingSize, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+  close(fd);
+
+  if (mapping==MAP_FAILED)
+  {
+    mapping = NULL;
+    mappingSize = 0;
+    throw std::runtime_error(ErrorMessage("Can't map snapshot", fileName));
+  }
+
+  // Version 1 headers end before the tracers count, which then reads the zeros padding the header page
+  header = static_cast<const SnapshotHeader*>(mapping);
+
+  std::stringstream error;
+  if (memcmp(header->magic, snapshotMagic, sizeof(snapshotMagic))!=0)
+    error << "Snapshot '" << fileName << "' has an invalid signature.";
+  else if (!(header->version==version && header->headerSize==sizeof(SnapshotHeader)) &&
+           !(header->version==1 && header->headerSize==offsetof(SnapshotHeader, tracers)))
+    error << "Snapshot '" << fileName << "' has unsupported version " << header->version << ".";
+  else if (header->fileSize>mappingSize ||
+           header->stateOffset % alignment || header->parametersOffset % alignment ||
+           header->stateOffset + header->particles*sizeof(ParticleState2D) > header->parametersOffset ||
+           header->parametersOffset + header->particles*sizeof(ParticleParameters) > header->fileSize ||
+           header->tracers > header->particles)
+    error << "Snapshot '" << fileName << "' is truncated or corrupted.";
+
+  if (!error.str().empty())
+  {
+    Close();
+    throw std::runtime_error(error.str());
+  }
+
+  // Particle data is read once from beginning to the end, start the readahead now
+  madvise(mapping, mappingSize, MADV_SEQUENTIAL);
+  madvise(mapping, mappingSize, MADV_WILLNEED);
+}
+
+void Snapshot::Close()
+{
+  if (mapping)
+    munmap(mapping, mappingSize);
+
+  mapping = NULL;
+  mappingSize = 0;
+  header = NULL;
+}
+
+bool Snapshot::IsOpen() const
+{
+  return mapping!=NULL;
+}
+
+const SnapshotHeader& Snapshot::GetHeader() const
+{
+  if (!header)
+    throw std::runtime_error("Snapshot is not open.");
+
+  return *header;
+}
+
+ParticleState2D* Snapshot::GetParticleState() const
+{
+  return reinterpret_cast<ParticleState2D*>(static_cast<char*>(mapping) + GetHeader().stateOffset);
+}
+
+ParticleParameters* Snapshot::GetParticleParameters() const
+{
+  return reinterpret_cast<ParticleParameters*>(static_cast<char*>(mapping) + GetHeader().parametersOffset);
+}
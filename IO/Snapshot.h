@@ -0,0 +1,73 @@
+#ifndef _SNAPSHOT
+#define _SNAPSHOT
+
+// Standard includes
+#include <string>
+#include <cstddef>
+#include <stdint.h>
+
+// Project includes
+#include "../Structs/Particles.h"
+
+// Pack structure members
+#pragma pack(push, 1)
+
+struct SnapshotHeader
+{
+  char magic[8];                 // "GALSNAP\0"
+  uint32_t version;
+  uint32_t headerSize;
+  uint64_t fileSize;
+  uint64_t particles;
+  uint64_t stateOffset;          // page aligned offset of the ParticleState2D block
+  uint64_t parametersOffset;     // page aligned offset of the ParticleParameters block
+  uint64_t step;
+  double time;
+  double timeStep;
+  char integrator[32];
+  double theta;
+  double softening;
+  double gravitationalConstant;
+  double areaOfInterest;
+  double massCenterX;
+  double massCenterY;
+  uint64_t tracers;              // the last particles are massless tracers (version 2)
+};
+
+#pragma pack(pop)
+
+class Snapshot
+{
+public:
+
+  Snapshot();
+  ~Snapshot();
+
+  static SnapshotHeader CreateHeader(uint64_t particles);
+  static void Write(const std::string &fileName,
+                    const SnapshotHeader &header,
+                    const ParticleState2D *state,
+                    const ParticleParameters *parameters);
+
+  void Open(const std::string &fileName);
+  void Close();
+  bool IsOpen() const;
+
+  const SnapshotHeader& GetHeader() const;
+  ParticleState2D* GetParticleState() const;
+  ParticleParameters* GetParticleParameters() const;
+
+  static const uint32_t version;
+  static const std::size_t alignment;
+
+private:
+
+  Snapshot(const Snapshot &ref);
+  Snapshot& operator=(const Snapshot &ref);
+
+  void *mapping;
+  std::size_t mappingSize;
+  const SnapshotHeader *header;
+};
+
+#endif
@@ -0,0 +1,81 @@
+#ifndef _TRAJECTORY
+#define _TRAJECTORY
+
+// Standard includes
+#include <cstddef>
+#include <stdint.h>
+
+// Trajectory file layout:
+//   TrajectoryHeader         (padded to blockSize)
+//   ParticleParameters[]     (padded to blockSize)
+//   TrajectoryCodecHeader    (compressed only, followed by the particle order, padded to blockSize)
+//   frames                   (raw frames are padded to blockSize and have a fixed stride)
+//   uint64_t index[frames]   (compressed only, offsets of the frames)
+
+// Pack structure members
+#pragma pack(push, 1)
+
+struct TrajectoryHeader
+{
+  char magic[8];                 // "GALTRAJ\0"
+  uint32_t version;
+  uint32_t encoding;             // Trajectory::Encoding
+  uint64_t particles;
+  uint64_t frames;               // updated when the file is closed
+  uint64_t parametersOffset;
+  uint64_t framesOffset;
+  uint64_t frameSize;            // stride of raw frames in bytes
+  uint64_t interval;             // integrator steps between frames
+  double timeStep;
+  uint64_t codecOffset;          // compressed only
+  uint64_t indexOffset;          // compressed only, 0 if the file was not closed
+};
+
+struct TrajectoryFrameHeader
+{
+  uint64_t step;
+  double time;
+  uint64_t particles;
+  uint64_t payloadSize;          // bytes following the frame header
+  uint32_t type;                 // Trajectory::FrameType
+  uint32_t keyframeDistance;     // frames since the last keyframe
+  uint64_t reserved[3];
+};
+
+struct TrajectoryCodecHeader
+{
+  double precision;              // quantization step, positions are exact to precision/2
+  double originX;
+  double originY;
+  uint32_t keyframeInterval;
+  uint32_t chunkSize;            // particles per independently coded chunk
+  uint64_t reserved[4];
+};
+
+#pragma pack(pop)
+
+namespace Trajectory
+{
+  enum Encoding
+  {
+    RAW = 0,
+    COMPRESSED
+  };
+
+  enum FrameType
+  {
+    KEYFRAME = 0,
+    DELTA
+  };
+
+  const uint32_t version = 1;
+  const std::size_t blockSize = 4096;
+  const char magic[8] = {'G', 'A', 'L', 'T', 'R', 'A', 'J', '\0'};
+
+  inline uint64_t AlignSize(uint64_t size)
+  {
+    return (size + blockSize - 1) / blockSize * blockSize;
+  }
+}
+
+#endif
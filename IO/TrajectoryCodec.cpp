@@ -0,0 +1,392 @@
+// Standard includes
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+
+// Project includes
+#include "TrajectoryCodec.h"
+
+namespace
+{
+  // rANS coder with 32 bit state and byte-wise renormalization
+  const uint32_t ransLower = 1u << 23;
+  const uint32_t scaleBits = 12;
+  const uint32_t scale = 1u << scaleBits;
+
+  void NormalizeFrequencies(const std::vector<uint8_t> &data, uint16_t frequency[256])
+  {
+    uint64_t histogram[256] = {0};
+    for (std::size_t i=0; i<data.size(); ++i)
+      ++histogram[data[i]];
+
+    uint32_t sum = 0;
+    for (int s=0; s<256; ++s)
+    {
+      frequency[s] = 0;
+      if (histogram[s])
+        frequency[s] = std::max<uint64_t>(1, histogram[s] * scale / data.size());
+      sum += frequency[s];
+    }
+
+    // Fix rounding so the frequencies sum exactly to the scale
+    while (sum!=scale)
+    {
+      int largest = std::max_element(frequency, frequency + 256) - frequency;
+      if (sum<scale)
+      {
+        frequency[largest] += scale - sum;
+        sum = scale;
+      }
+      else
+      {
+        uint32_t excess = std::min<uint32_t>(sum - scale, frequency[largest] - 1);
+        if (excess==0) // largest is 1, can't happen for at most 256 symbols
+          throw std::runtime_error("Can't normalize symbol frequencies.");
+        frequency[largest] -= excess;
+        sum -= excess;
+      }
+    }
+  }
+
+  void RansEncode(const std::vector<uint8_t> &data, std::vector<char> &output)
+  {
+    uint32_t length = data.size();
+    const char *lengthBytes = reinterpret_cast<const char*>(&length);
+    output.insert(output.end(), lengthBytes, lengthBytes + sizeof(length));
+    if (length==0)
+      return;
+
+    uint16_t frequency[256];
+    uint32_t start[256];
+    NormalizeFrequencies(data, frequency);
+    for (int s=0, cumulative=0; s<256; ++s)
+    {
+      start[s] = cumulative;
+      cumulative += frequency[s];
+    }
+
+    const char *frequencyBytes = reinterpret_cast<const char*>(frequency);
+    output.insert(output.end(), frequencyBytes, frequencyBytes + sizeof(frequency));
+
+    // Symbols are coded in reverse so the decoder reads them forward
+    std::vector<uint8_t> stream(2*data.size() + 8);
+    uint8_t *end = &stream[0] + stream.size(), *ptr = end;
+    uint32_t x = ransLower;
+    for (std::size_t i=data.size(); i-->0;)
+    {
+      uint32_t f = frequency[data[i]];
+      uint32_t xMax = ((ransLower >> scaleBits) << 8) * f;
+      while (x>=xMax)
+      {
+        *--ptr = x & 0xff;
+        x >>= 8;
+      }
+      x = ((x / f) << scaleBits) + (x % f) + start[data[i]];
+    }
+
+    // Final state, least significant byte first
+    for (int shift=24; shift>=0; shift-=8)
+      *--ptr = x >> shift;
+
+    output.insert(output.end(), reinterpret_cast<char*>(ptr), reinterpret_cast<char*>(end));
+  }
+
+  void RansDecode(const char *input, std::vector<uint8_t> &data)
+  {
+    uint32_t length;
+    memcpy(&length, input, sizeof(length));
+    input += sizeof(length);
+
+    data.resize(length);
+    if (length==0)
+      return;
+
+    uint16_t frequency[256];
+    uint32_t start[256];
+    uint8_t lookup[scale];
+    memcpy(frequency, input, sizeof(frequency));
+    input += sizeof(frequency);
+    for (int s=0, cumulative=0; s<256; ++s)
+    {
+      start[s] = cumulative;
+      memset(lookup + cumulative, s, frequency[s]);
+      cumulative += frequency[s];
+    }
+
+    const uint8_t *ptr = reinterpret_cast<const uint8_t*>(input);
+    uint32_t x = ptr[0] | ptr[1] << 8 | ptr[2] << 16 | (uint32_t)ptr[3] << 24;
+    ptr += 4;
+
+    for (uint32_t i=0; i<length; ++i)
+    {
+      uint32_t slot = x & (scale - 1);
+      uint8_t s = lookup[slot];
+      data[i] = s;
+      x = frequency[s] * (x >> scaleBits) + slot - start[s];
+      while (x<ransLower)
+        x = (x << 8) | *ptr++;
+    }
+  }
+
+  void PutVarint(int64_t value, std::vector<uint8_t> &bytes)
+  {
+    uint64_t zigzag = ((uint64_t)value << 1) ^ (uint64_t)(value >> 63);
+    while (zigzag>=0x80)
+    {
+      bytes.push_back((zigzag & 0x7f) | 0x80);
+      zigzag >>= 7;
+    }
+    bytes.push_back(zigzag);
+  }
+
+  int64_t GetVarint(const uint8_t *&ptr)
+  {
+    uint64_t zigzag = 0;
+    for (int shift=0; ; shift+=7)
+    {
+      uint8_t byte = *ptr++;
+      zigzag |= (uint64_t)(byte & 0x7f) << shift;
+      if (!(byte & 0x80))
+        break;
+    }
+    return (int64_t)(zigzag >> 1) ^ -(int64_t)(zigzag & 1);
+  }
+
+  // Prediction of quantized coordinate i (interleaved x, y) for the given keyframe distance
+  inline int64_t Predict(const std::vector<int64_t> *history, unsigned distance, std::size_t i, std::size_t chunkBegin)
+  {
+    if (distance==0)
+      return (i>=chunkBegin+2) ? history[0][i-2] : 0;
+    else if (distance==1)
+      return history[1][i];
+    else
+      return 2*history[1][i] - history[2][i];
+  }
+
+  uint64_t MortonKey(uint32_t x, uint32_t y)
+  {
+    uint64_t key = 0;
+    for (int b=0; b<32; ++b)
+    {
+      key |= (uint64_t)((x >> b) & 1) << (2*b);
+      key |= (uint64_t)((y >> b) & 1) << (2*b+1);
+    }
+    return key;
+  }
+}
+
+TrajectoryEncoder::TrajectoryEncoder(unsigned particlesCount, double precision, unsigned keyframeInterval, unsigned chunkSize)
+  :codec()
+  ,particles(particlesCount)
+  ,keyframeDistance(0)
+  ,initialized(false)
+  ,order()
+{
+  if (precision<=0)
+    throw std::runtime_error("Trajectory precision must be positive.");
+
+  memset(&codec, 0, sizeof(codec));
+  codec.precision = precision;
+  codec.keyframeInterval = std::max(1u, keyframeInterval);
+  codec.chunkSize = std::max(1u, chunkSize);
+  keyframeDistance = codec.keyframeInterval;
+
+  for (int i=0; i<3; ++i)
+    history[i].resize(2*particles);
+}
+
+void TrajectoryEncoder::Initialize(const ParticleState2D *firstFrame)
+{
+  double minX = 0, minY = 0, maxX = 0, maxY = 0;
+  if (particles)
+  {
+    minX = maxX = firstFrame[0].positionX;
+    minY = maxY = firstFrame[0].positionY;
+  }
+
+  for (unsigned i=0; i<particles; ++i)
+  {
+    minX = std::min(minX, firstFrame[i].positionX);
+    maxX = std::max(maxX, firstFrame[i].positionX);
+    minY = std::min(minY, firstFrame[i].positionY);
+    maxY = std::max(maxY, firstFrame[i].positionY);
+  }
+
+  codec.originX = minX;
+  codec.originY = minY;
+
+  // Spatially coherent order of the first frame
+  double scaleX = (maxX>minX) ? 4294967295.0 / (maxX - minX) : 0,
+         scaleY = (maxY>minY) ? 4294967295.0 / (maxY - minY) : 0;
+  std::vector<std::pair<uint64_t, uint32_t> > keys(particles);
+
+  #pragma omp parallel for schedule(static)
+  for (int i=0; i<(int)particles; ++i)
+  {
+    uint32_t x = (uint32_t)((firstFrame[i].positionX - minX) * scaleX),
+             y = (uint32_t)((firstFrame[i].positionY - minY) * scaleY);
+    keys[i] = std::make_pair(MortonKey(x, y), (uint32_t)i);
+  }
+
+  std::sort(keys.begin(), keys.end());
+  order.resize(particles);
+  for (unsigned i=0; i<particles; ++i)
+    order[i] = keys[i].second;
+
+  initialized = true;
+}
+
+bool TrajectoryEncoder::IsInitialized() const
+{
+  return initialized;
+}
+
+void TrajectoryEncoder::ForceKeyframe()
+{
+  keyframeDistance = codec.keyframeInterval;
+}
+
+const TrajectoryCodecHeader& TrajectoryEncoder::GetCodecHeader() const
+{
+  return codec;
+}
+
+const std::vector<uint32_t>& TrajectoryEncoder::GetOrder() const
+{
+  return order;
+}
+
+void TrajectoryEncoder::Encode(const ParticleState2D *state, TrajectoryFrameHeader &frame, std::vector<char> &payload)
+{
+  if (!initialized)
+    Initialize(state);
+
+  if (keyframeDistance>=codec.keyframeInterval)
+    keyframeDistance = 0;
+
+  // history[0] becomes the current frame
+  std::swap(history[2], history[1]);
+  std::swap(history[1], history[0]);
+
+  std::vector<int64_t> &current = history[0];
+  const double inversePrecision = 1.0 / codec.precision;
+  const int count = particles;
+
+  #pragma omp parallel for schedule(static)
+  for (int i=0; i<count; ++i)
+  {
+    const ParticleState2D &p = state[order[i]];
+    current[2*i]   = llround((p.positionX - codec.originX) * inversePrecision);
+    current[2*i+1] = llround((p.positionY - codec.originY) * inversePrecision);
+  }
+
+  // Code chunks independently
+  const int chunks = (particles + codec.chunkSize - 1) / codec.chunkSize;
+  std::vector<std::vector<char> > coded(chunks);
+
+  #pragma omp parallel for schedule(dynamic)
+  for (int c=0; c<chunks; ++c)
+  {
+    std::size_t begin = 2*(std::size_t)c*codec.chunkSize,
+                end = 2*std::min<std::size_t>((std::size_t)(c+1)*codec.chunkSize, particles);
+
+    std::vector<uint8_t> bytes;
+    bytes.reserve(end - begin);
+    for (std::size_t i=begin; i<end; ++i)
+      PutVarint(current[i] - Predict(history, keyframeDistance, i, begin), bytes);
+
+    RansEncode(bytes, coded[c]);
+  }
+
+  // Chunk table followed by the chunks
+  std::size_t tableOffset = payload.size();
+  payload.resize(tableOffset + chunks*sizeof(uint32_t));
+  for (int c=0; c<chunks; ++c)
+  {
+    uint32_t size = coded[c].size();
+    memcpy(&payload[tableOffset + c*sizeof(uint32_t)], &size, sizeof(size));
+    payload.insert(payload.end(), coded[c].begin(), coded[c].end());
+  }
+
+  frame.type = (keyframeDistance==0) ? Trajectory::KEYFRAME : Trajectory::DELTA;
+  frame.keyframeDistance = keyframeDistance;
+  ++keyframeDistance;
+}
+
+TrajectoryDecoder::TrajectoryDecoder(const TrajectoryCodecHeader &codecHeader, const uint32_t *particleOrder, unsigned particlesCount)
+  :codec(codecHeader)
+  ,order(particleOrder)
+  ,particles(particlesCount)
+  ,lastFrame(-1)
+{
+  for (int i=0; i<3; ++i)
+    history[i].resize(2*particles);
+}
+
+void TrajectoryDecoder::DecodeFrame(const TrajectoryFrameHeader *frame)
+{
+  std::swap(history[2], history[1]);
+  std::swap(history[1], history[0]);
+
+  std::vector<int64_t> &current = history[0];
+  const unsigned distance = frame->keyframeDistance;
+  const char *payload = reinterpret_cast<const char*>(frame + 1);
+
+  const int chunks = (particles + codec.chunkSize - 1) / codec.chunkSize;
+  std::vector<std::size_t> offsets(chunks);
+  for (int c=0, offset=chunks*sizeof(uint32_t); c<chunks; ++c)
+  {
+    uint32_t size;
+    memcpy(&size, payload + c*sizeof(uint32_t), sizeof(size));
+    offsets[c] = offset;
+    offset += size;
+  }
+
+  #pragma omp parallel for schedule(dynamic)
+  for (int c=0; c<chunks; ++c)
+  {
+    std::size_t begin = 2*(std::size_t)c*codec.chunkSize,
+                end = 2*std::min<std::size_t>((std::size_t)(c+1)*codec.chunkSize, particles);
+
+    std::vector<uint8_t> bytes;
+    RansDecode(payload + offsets[c], bytes);
+
+    const uint8_t *ptr = bytes.empty() ? NULL : &bytes[0];
+    for (std::size_t i=begin; i<end; ++i)
+      current[i] = GetVarint(ptr) + Predict(history, distance, i, begin);
+  }
+}
+
+void TrajectoryDecoder::Decode(const std::vector<const TrajectoryFrameHeader*> &frames, unsigned frame, ParticleState2D *state)
+{
+  if (frame>=frames.size())
+    throw std::runtime_error("Trajectory frame out of range.");
+
+  if ((long long)frame!=lastFrame)
+  {
+    const TrajectoryFrameHeader *header = frames[frame];
+    if (!(header->type==Trajectory::DELTA && (long long)frame==lastFrame+1))
+    {
+      // Decode forward from the last keyframe
+      for (unsigned f=frame-header->keyframeDistance; f<frame; ++f)
+        DecodeFrame(frames[f]);
+    }
+
+    DecodeFrame(header);
+    lastFrame = frame;
+  }
+
+  const std::vector<int64_t> &current = history[0];
+  const int count = particles;
+
+  #pragma omp parallel for schedule(static)
+  for (int i=0; i<count; ++i)
+  {
+    ParticleState2D &p = state[order[i]];
+    p.positionX = codec.originX + current[2*i]   * codec.precision;
+    p.positionY = codec.originY + current[2*i+1] * codec.precision;
+    p.velocityX = 0;
+    p.velocityY = 0;
+  }
+}
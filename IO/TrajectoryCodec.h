@@ -0,0 +1,64 @@
+#ifndef _TRAJECTORYCODEC
+#define _TRAJECTORYCODEC
+
+// Standard includes
+#include <vector>
+#include <stdint.h>
+
+// Project includes
+#include "Trajectory.h"
+#include "../Structs/Particles.h"
+
+// Positions are quantized on a fixed grid anchored at the first frame, particles are stored in
+// Morton order of the first frame. Keyframes predict each particle from its Morton neighbour,
+// the following frames predict linearly from the two previous frames. Residuals are zigzag/varint
+// packed and rANS coded in independent chunks, so chunks are encoded and decoded in parallel.
+
+class TrajectoryEncoder
+{
+public:
+
+  TrajectoryEncoder(unsigned particles, double precision, unsigned keyframeInterval, unsigned chunkSize=16384);
+
+  void Initialize(const ParticleState2D *firstFrame);
+  bool IsInitialized() const;
+  void ForceKeyframe();
+
+  const TrajectoryCodecHeader& GetCodecHeader() const;
+  const std::vector<uint32_t>& GetOrder() const;
+
+  // Appends the coded positions to payload and fills type and keyframe distance of the frame
+  void Encode(const ParticleState2D *state, TrajectoryFrameHeader &frame, std::vector<char> &payload);
+
+private:
+
+  TrajectoryCodecHeader codec;
+  unsigned particles;
+  unsigned keyframeDistance;
+  bool initialized;
+  std::vector<uint32_t> order;
+  std::vector<int64_t> history[3];   // quantized positions of the current and two previous frames
+};
+
+class TrajectoryDecoder
+{
+public:
+
+  TrajectoryDecoder(const TrajectoryCodecHeader &codec, const uint32_t *order, unsigned particles);
+
+  // Random access decode, continues from the previously decoded frame when possible.
+  // Only positions are stored in compressed trajectories, velocities are set to zero.
+  void Decode(const std::vector<const TrajectoryFrameHeader*> &frames, unsigned frame, ParticleState2D *state);
+
+private:
+
+  void DecodeFrame(const TrajectoryFrameHeader *frame);
+
+  TrajectoryCodecHeader codec;
+  const uint32_t *order;
+  unsigned particles;
+  long long lastFrame;
+  std::vector<int64_t> history[3];
+};
+
+#endif
@@ -0,0 +1,209 @@
+// Standard includes
+#include <algorithm>
+#include <cstring>
+#include <cerrno>
+#include <stdexcept>
+#include <sstream>
+
+// System includes
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// Project includes
+#include "TrajectoryReader.h"
+
+TrajectoryReader::TrajectoryReader(const std::string &fileName)
+  :name(fileName)
+  ,mapping(NULL)
+  ,mappingSize(0)
+  ,header(NULL)
+  ,frames()
+  ,decoder(NULL)
+  ,decoded()
+  ,windowBegin(0)
+  ,windowEnd(-1)
+{
+  int fd = open(name.c_str(), O_RDONLY);
+  if (fd<0)
+    throw std::runtime_error("Can't open trajectory '" + name + "': " + strerror(errno));
+
+  struct stat fileStat;
+  if (fstat(fd, &fileStat)!=0 || (std::size_t)fileStat.st_size<sizeof(TrajectoryHeader))
+  {
+    close(fd);
+    throw std::runtime_error("Trajectory '" + name + "' is truncated.");
+  }
+
+  mappingSize = fileStat.st_size;
+  void *address = mmap(NULL, mappingSize, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (address==MAP_FAILED)
+    throw std::runtime_error("Can't map trajectory '" + name + "': " + strerror(errno));
+
+  mapping = static_cast<char*>(address);
+  header = reinterpret_cast<const TrajectoryHeader*>(mapping);
+
+  // Frames are read ahead explicitly in the playback direction
+  madvise(mapping, mappingSize, MADV_RANDOM);
+
+  try
+  {
+    if (memcmp(header->magic, Trajectory::magic, sizeof(Trajectory::magic))!=0 || header->version!=Trajectory::version)
+      throw std::runtime_error("File '" + name + "' is not a supported trajectory.");
+
+    if (header->framesOffset>mappingSize || header->parametersOffset + header->particles*sizeof(ParticleParameters)>mappingSize)
+      throw std::runtime_error("Trajectory '" + name + "' is truncated.");
+
+    if (header->encoding==Trajectory::RAW)
+    {
+      // Fixed stride, frames of an interrupted run are recovered from the file size
+      for (uint64_t offset=header->framesOffset; offset + header->frameSize<=mappingSize; offset+=header->frameSize)
+        frames.push_back(reinterpret_cast<const TrajectoryFrameHeader*>(mapping + offset));
+    }
+    else if (header->encoding==Trajectory::COMPRESSED)
+    {
+      if (header->indexOffset && header->indexOffset + header->frames*sizeof(uint64_t)<=mappingSize)
+      {
+        const uint64_t *index = reinterpret_cast<const uint64_t*>(mapping + header->indexOffset);
+        for (uint64_t i=0; i<header->frames; ++i)
+          frames.push_back(reinterpret_cast<const TrajectoryFrameHeader*>(mapping + index[i]));
+      }
+      else
+      {
+        // The file was not closed, walk the frames
+        uint64_t end = mappingSize;
+        for (uint64_t offset=header->framesOffset; offset + sizeof(TrajectoryFrameHeader)<=end;)
+        {
+          const TrajectoryFrameHeader *frame = reinterpret_cast<const TrajectoryFrameHeader*>(mapping + offset);
+          if (frame->particles!=header->particles || offset + sizeof(TrajectoryFrameHeader) + frame->payloadSize>end)
+            break;
+          frames.push_back(frame);
+          offset += sizeof(TrajectoryFrameHeader) + frame->payloadSize;
+        }
+      }
+
+      const TrajectoryCodecHeader *codec = reinterpret_cast<const TrajectoryCodecHeader*>(mapping + header->codecOffset);
+      decoder = new TrajectoryDecoder(*codec, reinterpret_cast<const uint32_t*>(codec + 1), header->particles);
+      decoded.resize(header->particles);
+    }
+    else
+    {
+      throw std::runtime_error("Trajectory '" + name + "' has an unknown encoding.");
+    }
+
+    if (frames.empty())
+      throw std::runtime_error("Trajectory '" + name + "' has no frames.");
+  }
+  catch(...)
+  {
+    munmap(mapping, mappingSize);
+    throw;
+  }
+}
+
+TrajectoryReader::~TrajectoryReader()
+{
+  delete decoder;
+  munmap(mapping, mappingSize);
+}
+
+unsigned TrajectoryReader::GetFramesCount() const
+{
+  return frames.size();
+}
+
+unsigned TrajectoryReader::GetParticlesCount() const
+{
+  return header->particles;
+}
+
+bool TrajectoryReader::IsCompressed() const
+{
+  return decoder!=NULL;
+}
+
+const TrajectoryHeader& TrajectoryReader::GetHeader() const
+{
+  return *header;
+}
+
+const ParticleParameters* TrajectoryReader::GetParticleParameters() const
+{
+  return reinterpret_cast<const ParticleParameters*>(mapping + header->parametersOffset);
+}
+
+const TrajectoryFrameHeader& TrajectoryReader::GetFrameHeader(unsigned frame) const
+{
+  if (frame>=frames.size())
+  {
+    std::stringstream ss;
+    ss << "Trajectory frame " << frame << " out of range (" << frames.size() << " frames)";
+    throw std::runtime_error(ss.str());
+  }
+
+  return *frames[frame];
+}
+
+const ParticleState2D* TrajectoryReader::GetFrame(unsigned frame)
+{
+  const TrajectoryFrameHeader &frameHeader = GetFrameHeader(frame);
+
+  if (!decoder)
+    return reinterpret_cast<const ParticleState2D*>(&frameHeader + 1);
+
+  decoder->Decode(frames, frame, &decoded[0]);
+  return &decoded[0];
+}
+
+void TrajectoryReader::Advise(unsigned frame, int advice) const
+{
+  AdviseRange(frame, frame, advice);
+}
+
+void TrajectoryReader::AdviseRange(unsigned firstFrame, unsigned lastFrame, int advice) const
+{
+  // Frames are stored in order, the range is one span of the mapping
+  const char *begin = reinterpret_cast<const char*>(frames[firstFrame]);
+  const char *end = reinterpret_cast<const char*>(frames[lastFrame]) + sizeof(TrajectoryFrameHeader) + frames[lastFrame]->payloadSize;
+
+  // madvise needs a page aligned address
+  const std::size_t page = sysconf(_SC_PAGESIZE);
+  std::size_t first = (begin - mapping) / page * page;
+  std::size_t last = std::min<std::size_t>(end - mapping, mappingSize);
+
+  madvise(mapping + first, last - first, advice);
+}
+
+void TrajectoryReader::Prefetch(unsigned frame, int step, unsigned count)
+{
+  const long long framesCount = frames.size();
+  if (step==0)
+    step = 1;
+  if (framesCount==0 || frame>=framesCount)
+    return;
+
+  // Only the frames that will be shown are read ahead
+  long long farthest = frame;
+  for (unsigned i=1; i<=count; ++i)
+  {
+    long long ahead = (long long)frame + step*(long long)i;
+    if (ahead<0 || ahead>=framesCount)
+      break;
+    Advise(ahead, MADV_WILLNEED);
+    farthest = ahead;
+  }
+
+  // The resident set stays bounded by the window, whatever was spanned before and is not spanned now goes
+  const long long begin = std::min<long long>(frame, farthest), end = std::max<long long>(frame, farthest);
+  if (windowBegin<=windowEnd)
+  {
+    if (windowBegin<begin)
+      AdviseRange(windowBegin, std::min(windowEnd, begin - 1), MADV_DONTNEED);
+    if (windowEnd>end)
+      AdviseRange(std::max(windowBegin, end + 1), windowEnd, MADV_DONTNEED);
+  }
+  windowBegin = begin;
+  windowEnd = end;
+}
@@ -0,0 +1,54 @@
+#ifndef _TRAJECTORYREADER
+#define _TRAJECTORYREADER
+
+// Standard includes
+#include <string>
+#include <vector>
+#include <cstddef>
+
+// Project includes
+#include "Trajectory.h"
+#include "TrajectoryCodec.h"
+#include "../Structs/Particles.h"
+
+class TrajectoryReader
+{
+public:
+
+  TrajectoryReader(const std::string &fileName);
+  ~TrajectoryReader();
+
+  unsigned GetFramesCount() const;
+  unsigned GetParticlesCount() const;
+  bool IsCompressed() const;
+  const TrajectoryHeader& GetHeader() const;
+  const ParticleParameters* GetParticleParameters() const;
+  const TrajectoryFrameHeader& GetFrameHeader(unsigned frame) const;
+
+  // Raw frames are returned directly from the mapping, compressed frames are decoded into a buffer
+  const ParticleState2D* GetFrame(unsigned frame);
+
+  // Read ahead the next count frames step frames apart (negative in reverse) and release every frame of the
+  // previous window outside of the new one, the frames skipped over or left behind and the old window after a seek
+  void Prefetch(unsigned frame, int step, unsigned count);
+
+private:
+
+  TrajectoryReader(const TrajectoryReader &ref);
+  TrajectoryReader& operator=(const TrajectoryReader &ref);
+
+  void Advise(unsigned frame, int advice) const;
+  void AdviseRange(unsigned first, unsigned last, int advice) const;
+
+  std::string name;
+  char *mapping;
+  std::size_t mappingSize;
+  const TrajectoryHeader *header;
+  std::vector<const TrajectoryFrameHeader*> frames;
+  TrajectoryDecoder *decoder;
+  std::vector<ParticleState2D> decoded;
+  long long windowBegin;    // frames spanned by the last prefetch, empty when windowEnd<windowBegin
+  long long windowEnd;
+};
+
+#endif
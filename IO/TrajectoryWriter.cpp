@@ -0,0 +1,381 @@
+// Standard includes
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <chrono>
+#include <stdexcept>
+#include <sstream>
+
+// System includes
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+// Project includes
+#include "TrajectoryWriter.h"
+#include "../Utils/Tracer.h"
+
+namespace
+{
+  std::string ErrorMessage(const std::string &what, const std::string &fileName)
+  {
+    std::stringstream ss;
+    ss << what << " '" << fileName << "': " << strerror(errno);
+    return ss.str();
+  }
+
+  void WriteBlock(int fd, uint64_t offset, const void *data, uint64_t size, const std::string &fileName)
+  {
+    const char *buffer = static_cast<const char*>(data);
+    while (size>0)
+    {
+      ssize_t written = pwrite(fd, buffer, size, offset);
+      if (written<0)
+      {
+        if (errno==EINTR)
+          continue;
+        throw std::runtime_error(ErrorMessage("Can't write trajectory", fileName));
+      }
+
+      buffer += written;
+      offset += written;
+      size -= written;
+    }
+  }
+}
+
+TrajectoryWriter::TrajectoryWriter(const std::string &fileName,
+                                   const ParticleParameters *parameters,
+                                   unsigned particlesCount,
+                                   unsigned framesInterval,
+                                   double timeStep,
+                                   unsigned buffers,
+                                   bool directIO,
+                                   bool drop)
+  :name(fileName)
+  ,bufferedFile(-1)
+  ,directFile(-1)
+  ,particles(particlesCount)
+  ,interval(framesInterval>0 ? framesInterval : 1)
+  ,frameSize(Trajectory::AlignSize(sizeof(TrajectoryFrameHeader) + particlesCount*sizeof(ParticleState2D)))
+  ,header()
+  ,encoder(NULL)
+  ,payload()
+  ,frameOffsets()
+  ,nextOffset(0)
+  ,ring()
+  ,head(0)
+  ,count(0)
+  ,dropFrames(drop)
+  ,pinned(true)
+  ,closing(false)
+  ,writer()
+  ,ringMutex()
+  ,frameReady()
+  ,frameWritten()
+  ,writtenFrames(0)
+  ,droppedFrames(0)
+  ,blockedFrames(0)
+  ,bytesWritten(0)
+  ,rawBytes(0)
+  ,writeSeconds(0)
+{
+  if (buffers<2)
+    throw std::runtime_error("Trajectory writer needs at least two buffers.");
+
+  bufferedFile = open(name.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (bufferedFile<0)
+    throw std::runtime_error(ErrorMessage("Can't create trajectory", name));
+
+  // Header and particle parameters are written once through the page cache
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, Trajectory::magic, sizeof(header.magic));
+  header.version = Trajectory::version;
+  header.encoding = Trajectory::RAW;
+  header.particles = particles;
+  header.parametersOffset = Trajectory::AlignSize(sizeof(TrajectoryHeader));
+  header.framesOffset = Trajectory::AlignSize(header.parametersOffset + particles*sizeof(ParticleParameters));
+  header.frameSize = frameSize;
+  header.interval = interval;
+  header.timeStep = timeStep;
+  nextOffset = header.framesOffset;
+
+  WriteHeader();
+  WriteBlock(bufferedFile, header.parametersOffset, parameters, particles*sizeof(ParticleParameters), name);
+
+  // Frames are written with large sequential writes, optionally bypassing the page cache
+  directFile = bufferedFile;
+  if (directIO)
+  {
+    directFile = open(name.c_str(), O_WRONLY | O_DIRECT);
+    if (directFile<0)
+      directFile = bufferedFile; // O_DIRECT is not supported by every file system
+  }
+
+  // Page aligned (and if possible pinned) frame buffers
+  for (unsigned i=0; i<buffers; ++i)
+  {
+    void *buffer = NULL;
+    if (posix_memalign(&buffer, Trajectory::blockSize, frameSize)!=0)
+      throw std::runtime_error("Can't allocate trajectory buffers.");
+
+    memset(buffer, 0, frameSize);
+    ring.push_back(static_cast<char*>(buffer));
+
+    if (pinned && mlock(buffer, frameSize)!=0)
+      pinned = false;
+  }
+
+  writer = std::thread(&TrajectoryWriter::WriterThread, this);
+}
+
+TrajectoryWriter::~TrajectoryWriter()
+{
+  try
+  {
+    Close();
+  }
+  catch(std::exception &exc)
+  {
+    // Destructor may not throw. Do nothing
+  }
+
+  for (std::size_t i=0; i<ring.size(); ++i)
+  {
+    if (pinned)
+      munlock(ring[i], frameSize);
+    free(ring[i]);
+  }
+
+  delete encoder;
+}
+
+void TrajectoryWriter::EnableCompression(double precision, unsigned keyframeInterval)
+{
+  std::lock_guard<std::mutex> lock(ringMutex);
+  if (encoder || writtenFrames || count)
+    throw std::runtime_error("Compression must be enabled before the first trajectory frame.");
+
+  encoder = new TrajectoryEncoder(particles, precision, keyframeInterval);
+
+  // Codec header and particle order are written with the first frame
+  header.encoding = Trajectory::COMPRESSED;
+  header.frameSize = 0;
+  header.codecOffset = header.framesOffset;
+  header.framesOffset = Trajectory::AlignSize(header.codecOffset + sizeof(TrajectoryCodecHeader) + particles*sizeof(uint32_t));
+  nextOffset = header.framesOffset;
+  WriteHeader();
+}
+
+bool TrajectoryWriter::IsFrameDue(unsigned long long step) const
+{
+  return step % interval == 0;
+}
+
+void TrajectoryWriter::Push(const double *state, unsigned long long step, double time)
+{
+  TRACE_SCOPE("Trajectory push");
+  unsigned slot;
+  {
+    std::unique_lock<std::mutex> lock(ringMutex);
+
+    if (closing)
+      throw std::runtime_error("Trajectory '" + name + "' is already closed.");
+
+    // Backpressure only when the I/O thread falls behind by the whole ring
+    if (count==ring.size())
+    {
+      if (dropFrames)
+      {
+        ++droppedFrames;
+        return;
+      }
+
+      ++blockedFrames;
+      frameWritten.wait(lock, [this]{ return count<ring.size(); });
+    }
+
+    slot = (head + count) % ring.size();
+  }
+
+  // The slot is owned by the producer until it is published, copy without holding the lock
+  char *buffer = ring[slot];
+  TrajectoryFrameHeader *frameHeader = reinterpret_cast<TrajectoryFrameHeader*>(buffer);
+  frameHeader->step = step;
+  frameHeader->time = time;
+  frameHeader->particles = particles;
+  frameHeader->payloadSize = particles*sizeof(ParticleState2D);
+  frameHeader->type = Trajectory::KEYFRAME;
+  frameHeader->keyframeDistance = 0;
+
+  const char *source = reinterpret_cast<const char*>(state);
+  char *destination = buffer + sizeof(TrajectoryFrameHeader);
+  const long long chunk = 1 << 20, size = frameHeader->payloadSize;
+
+  #pragma omp parallel for schedule(static)
+  for (long long offset=0; offset<size; offset+=chunk)
+    memcpy(destination + offset, source + offset, std::min(chunk, size - offset));
+
+  {
+    std::lock_guard<std::mutex> lock(ringMutex);
+    ++count;
+  }
+  frameReady.notify_one();
+}
+
+void TrajectoryWriter::WriterThread()
+{
+  Tracer::SetThreadName("Trajectory writer");
+
+  while (true)
+  {
+    char *buffer = NULL;
+    {
+      std::unique_lock<std::mutex> lock(ringMutex);
+      frameReady.wait(lock, [this]{ return count>0 || closing; });
+
+      if (count==0)
+        return;
+
+      buffer = ring[head];
+    }
+
+    bool failed = false;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    try
+    {
+      WriteFrame(buffer);
+    }
+    catch(std::exception &exc)
+    {
+      // Keep the ring moving so the simulation is never blocked by a failing disk
+      failed = true;
+      if (encoder)
+        encoder->ForceKeyframe();
+    }
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    {
+      std::lock_guard<std::mutex> lock(ringMutex);
+      head = (head + 1) % ring.size();
+      --count;
+      if (failed)
+      {
+        ++droppedFrames;
+      }
+      else
+      {
+        ++writtenFrames;
+        writeSeconds += elapsed.count();
+      }
+    }
+    frameWritten.notify_one();
+  }
+}
+
+void TrajectoryWriter::WriteFrame(char *buffer)
+{
+  TRACE_SCOPE("Trajectory write");
+  uint64_t size = frameSize;
+  if (!encoder)
+  {
+    WriteBlock(directFile, header.framesOffset + writtenFrames*frameSize, buffer, frameSize, name);
+  }
+  else
+  {
+    TrajectoryFrameHeader frameHeader;
+    memcpy(&frameHeader, buffer, sizeof(frameHeader));
+    const ParticleState2D *state = reinterpret_cast<const ParticleState2D*>(buffer + sizeof(TrajectoryFrameHeader));
+
+    if (!encoder->IsInitialized())
+    {
+      encoder->Initialize(state);
+      WriteBlock(bufferedFile, header.codecOffset, &encoder->GetCodecHeader(), sizeof(TrajectoryCodecHeader), name);
+      WriteBlock(bufferedFile, header.codecOffset + sizeof(TrajectoryCodecHeader), &encoder->GetOrder()[0], particles*sizeof(uint32_t), name);
+    }
+
+    // Frame header is placed in front of the coded positions
+    payload.resize(sizeof(TrajectoryFrameHeader));
+    encoder->Encode(state, frameHeader, payload);
+    frameHeader.payloadSize = payload.size() - sizeof(TrajectoryFrameHeader);
+    memcpy(&payload[0], &frameHeader, sizeof(frameHeader));
+
+    WriteBlock(bufferedFile, nextOffset, &payload[0], payload.size(), name);
+    frameOffsets.push_back(nextOffset);
+    nextOffset += payload.size();
+    size = payload.size();
+  }
+
+  std::lock_guard<std::mutex> lock(ringMutex);
+  bytesWritten += size;
+  rawBytes += frameSize;
+}
+
+void TrajectoryWriter::WriteHeader()
+{
+  WriteBlock(bufferedFile, 0, &header, sizeof(header), name);
+}
+
+void TrajectoryWriter::Close()
+{
+  {
+    std::lock_guard<std::mutex> lock(ringMutex);
+    if (closing)
+      return;
+    closing = true;
+  }
+
+  frameReady.notify_one();
+  writer.join();
+
+  header.frames = writtenFrames;
+  if (encoder && !frameOffsets.empty())
+  {
+    // Frame index for random access
+    WriteBlock(bufferedFile, nextOffset, &frameOffsets[0], frameOffsets.size()*sizeof(uint64_t), name);
+    header.indexOffset = nextOffset;
+  }
+  WriteHeader();
+  fsync(bufferedFile);
+
+  if (directFile!=bufferedFile)
+    close(directFile);
+  close(bufferedFile);
+  directFile = bufferedFile = -1;
+}
+
+unsigned long long TrajectoryWriter::GetWrittenFrames() const
+{
+  std::lock_guard<std::mutex> lock(ringMutex);
+  return writtenFrames;
+}
+
+unsigned long long TrajectoryWriter::GetDroppedFrames() const
+{
+  std::lock_guard<std::mutex> lock(ringMutex);
+  return droppedFrames;
+}
+
+unsigned long long TrajectoryWriter::GetBlockedFrames() const
+{
+  std::lock_guard<std::mutex> lock(ringMutex);
+  return blockedFrames;
+}
+
+double TrajectoryWriter::GetBandwidth() const
+{
+  std::lock_guard<std::mutex> lock(ringMutex);
+  return (writeSeconds>0) ? bytesWritten / writeSeconds : 0;
+}
+
+double TrajectoryWriter::GetCompressionRatio() const
+{
+  std::lock_guard<std::mutex> lock(ringMutex);
+  return (bytesWritten>0) ? rawBytes / bytesWritten : 1;
+}
+
+bool TrajectoryWriter::IsPinned() const
+{
+  return pinned;
+}
@@ -0,0 +1,88 @@
+#ifndef _TRAJECTORYWRITER
+#define _TRAJECTORYWRITER
+
+// Standard includes
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <stdint.h>
+
+// Project includes
+#include "Trajectory.h"
+#include "TrajectoryCodec.h"
+#include "../Structs/Particles.h"
+
+class TrajectoryWriter
+{
+public:
+
+  TrajectoryWriter(const std::string &fileName,
+                   const ParticleParameters *parameters,
+                   unsigned particles,
+                   unsigned interval,
+                   double timeStep,
+                   unsigned buffers=4,
+                   bool directIO=false,
+                   bool dropFrames=false);
+  ~TrajectoryWriter();
+
+  void EnableCompression(double precision, unsigned keyframeInterval);
+  bool IsFrameDue(unsigned long long step) const;
+  void Push(const double *state, unsigned long long step, double time);
+  void Close();
+
+  unsigned long long GetWrittenFrames() const;
+  unsigned long long GetDroppedFrames() const;
+  unsigned long long GetBlockedFrames() const;
+  double GetBandwidth() const;
+  double GetCompressionRatio() const;
+  bool IsPinned() const;
+
+private:
+
+  TrajectoryWriter(const TrajectoryWriter &ref);
+  TrajectoryWriter& operator=(const TrajectoryWriter &ref);
+
+  void WriterThread();
+  void WriteHeader();
+  void WriteFrame(char *buffer);
+
+  std::string name;
+  int bufferedFile;
+  int directFile;
+  unsigned particles;
+  unsigned interval;
+  uint64_t frameSize;
+  TrajectoryHeader header;
+
+  // Compressed frames have variable size and are appended at nextOffset
+  TrajectoryEncoder *encoder;
+  std::vector<char> payload;
+  std::vector<uint64_t> frameOffsets;
+  uint64_t nextOffset;
+
+  // Ring of page aligned frame buffers, [head, head+count) are waiting for the I/O thread
+  std::vector<char*> ring;
+  unsigned head;
+  unsigned count;
+  bool dropFrames;
+  bool pinned;
+  bool closing;
+
+  std::thread writer;
+  mutable std::mutex ringMutex;
+  std::condition_variable frameReady;
+  std::condition_variable frameWritten;
+
+  // Statistics
+  unsigned long long writtenFrames;
+  unsigned long long droppedFrames;
+  unsigned long long blockedFrames;
+  double bytesWritten;
+  double rawBytes;
+  double writeSeconds;
+};
+
+#endif
@@ -2,12 +2,18 @@
 #include <cassert>
 #include <stdexcept>
 #include <sstream>
+#include <algorithm>
 
 // Project includes
 #include "Euler.h"
-
-IntegratorEuler::IntegratorEuler(IModel *simulationModel, double dt) : IIntegrator(simulationModel, dt)
-  ,state((simulationModel) ? new double [simulationModel->GetSimulationDimension()] : NULL)
+#include "../Models/NBody.h"
+
+template<class Model>
+IntegratorEuler<Model>::IntegratorEuler(Model *simulationModel, double dt, IntegratorWorkspace *workspace)
+  : IIntegrator(simulationModel, dt, workspace)
+  ,stageModel(simulationModel)
+  ,state(GetBuffer(0))
+  ,next(GetBuffer(1))
 {
   if (simulationModel==NULL)
     throw std::runtime_error("Model pointer may not be NULL.");
@@ -17,18 +23,19 @@ IntegratorEuler::IntegratorEuler(IModel *simulationModel, double dt) : IIntegrat
   SetName(name.str());
 }
 
-void IntegratorEuler::SingleStep()
+template<class Model>
+void IntegratorEuler<Model>::SingleStep()
 {
-  double k1[dimension];
-  model->Evaluate(state, time, k1);
-
-  for (std::size_t i=0; i<dimension; ++i)
-    state[i] += timeStep * k1[i];
+  // The derivative is only read by the fused update of its own particle, next holds it until then
+  stageModel->EvaluateStage(state, time, next, StageUpdate(next, state).Add(timeStep, next));
+  std::swap(state, next);
 
   time += timeStep;
+  stageModel->EndStep(state, time);
 }
 
-void IntegratorEuler::SetInitialState(double *initialState)
+template<class Model>
+void IntegratorEuler<Model>::SetInitialState(double *initialState)
 {
   for (unsigned i=0; i<dimension; ++i)
     state[i] = initialState[i];
@@ -36,7 +43,11 @@ void IntegratorEuler::SetInitialState(double *initialState)
   time = 0;
 }
 
-double* IntegratorEuler::GetState() const
+template<class Model>
+double* IntegratorEuler<Model>::GetState() const
 {
   return state;
-}
\ No newline at end of file
+}
+
+template class IntegratorEuler<IModel>;
+template class IntegratorEuler<NBody>;
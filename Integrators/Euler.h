@@ -4,18 +4,22 @@
 #include <string>
 #include "../Interfaces/IIntegrator.h"
 
+// Model is the concrete model type, stage evaluations are resolved at compile time when it is final
+template<class Model=IModel>
 class IntegratorEuler : public IIntegrator
 {
 public:
 
-  IntegratorEuler(IModel *simulationModel, double dt);
+  IntegratorEuler(Model *simulationModel, double dt, IntegratorWorkspace *workspace=NULL);
   virtual void SingleStep();
   virtual void SetInitialState(double *initialState);
   virtual double* GetState() const;
 
 private:
 
+  Model *stageModel;
   double *state;
+  double *next;   // written while the tree still reads state, the two are swapped after the step
 };
 
-#endif
\ No newline at end of file
+#endif
@@ -5,12 +5,16 @@
 
 // Project includes
 #include "Heun.h"
-
-IntegratorHeun::IntegratorHeun(IModel *simulationModel, double dt) : IIntegrator(simulationModel, dt)
-  ,state(new double[dimension])
-  ,temp(new double[dimension])
-  ,k1(new double[dimension])
-  ,k2(new double[dimension])
+#include "../Models/NBody.h"
+
+template<class Model>
+IntegratorHeun<Model>::IntegratorHeun(Model *simulationModel, double dt, IntegratorWorkspace *workspace)
+  : IIntegrator(simulationModel, dt, workspace)
+  ,stageModel(simulationModel)
+  ,state(GetBuffer(0))
+  ,temp(GetBuffer(1))
+  ,k1(GetBuffer(2))
+  ,k2(GetBuffer(3))
 {
   if (simulationModel==NULL)
     throw std::runtime_error("Model pointer may not be NULL.");
@@ -20,23 +24,22 @@ IntegratorHeun::IntegratorHeun(IModel *simulationModel, double dt) : IIntegrator
   SetName(name.str());
 }
 
-void IntegratorHeun::SingleStep()
+template<class Model>
+void IntegratorHeun<Model>::SingleStep()
 {
-  // k1
-  model->Evaluate(state, time, k1);
-  for (std::size_t i=0; i<dimension; ++i)
-    temp[i] = state[i] + 2.0/3.0 * timeStep * k1[i];
-
+  // k1, temp = state + 2/3 dt k1
+  stageModel->EvaluateStage(state, time, k1, StageUpdate(temp, state).Add(2.0/3.0 * timeStep, k1));
 
-  // k2
-  model->Evaluate(temp, time + 2.0/3.0 * timeStep, k2);
-  for (std::size_t i=0; i<dimension; ++i)
-    state[i] += timeStep/4.0 * (k1[i] + 3*k2[i]);
+  // k2, state += dt/4 (k1 + 3 k2)
+  stageModel->EvaluateStage(temp, time + 2.0/3.0 * timeStep, k2,
+                            StageUpdate(state, state).Add(timeStep/4.0, k1).Add(3*timeStep/4.0, k2));
 
   time += timeStep;
+  stageModel->EndStep(state, time);
 }
 
-void IntegratorHeun::SetInitialState(double *initialState)
+template<class Model>
+void IntegratorHeun<Model>::SetInitialState(double *initialState)
 {
   for (unsigned i=0; i<dimension; ++i)
   {
@@ -48,7 +51,11 @@ void IntegratorHeun::SetInitialState(double *initialState)
   time = 0;
 }
 
-double* IntegratorHeun::GetState() const
+template<class Model>
+double* IntegratorHeun<Model>::GetState() const
 {
   return state;
-}
\ No newline at end of file
+}
+
+template class IntegratorHeun<IModel>;
+template class IntegratorHeun<NBody>;
@@ -3,21 +3,24 @@
 
 #include "../Interfaces/IIntegrator.h"
 
+// Model is the concrete model type, stage evaluations are resolved at compile time when it is final
+template<class Model=IModel>
 class IntegratorHeun : public IIntegrator
 {
 public:
 
-  IntegratorHeun(IModel *simulationModel, double dt);
+  IntegratorHeun(Model *simulationModel, double dt, IntegratorWorkspace *workspace=NULL);
   virtual void SingleStep();
   virtual void SetInitialState(double *initialState);
   virtual double* GetState() const;
 
 private:
 
+  Model *stageModel;
   double *state;
   double *temp;
   double *k1;
   double *k2;
 };
 
-#endif
\ No newline at end of file
+#endif
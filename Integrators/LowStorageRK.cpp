@@ -0,0 +1,99 @@
+// Standard includes
+#include <cassert>
+#include <stdexcept>
+#include <sstream>
+
+// Project includes
+#include "LowStorageRK.h"
+#include "../Models/NBody.h"
+
+namespace
+{
+  // J. H. Williamson, Low-storage Runge-Kutta schemes, J. Comput. Phys. 35 (1980)
+  const double williamsonA[] = {0, -5.0/9.0, -153.0/128.0};
+  const double williamsonB[] = {1.0/3.0, 15.0/16.0, 8.0/15.0};
+  const double williamsonC[] = {0, 1.0/3.0, 3.0/4.0};
+
+  // M. H. Carpenter, C. A. Kennedy, Fourth-order 2N-storage Runge-Kutta schemes, NASA TM-109112 (1994)
+  const double carpenterKennedyA[] = {0,
+                                      -567301805773.0/1357537059087.0,
+                                      -2404267990393.0/2016746695238.0,
+                                      -3550918686646.0/2091501179385.0,
+                                      -1275806237668.0/842570457699.0};
+  const double carpenterKennedyB[] = {1432997174477.0/9575080441755.0,
+                                      5161836677717.0/13612068292357.0,
+                                      1720146321549.0/2090206949498.0,
+                                      3134564353537.0/4481467310338.0,
+                                      2277821191437.0/14882151754819.0};
+  const double carpenterKennedyC[] = {0,
+                                      1432997174477.0/9575080441755.0,
+                                      2526269341429.0/6820363962896.0,
+                                      2006345519317.0/3224310063776.0,
+                                      2802321613138.0/2924317926251.0};
+}
+
+template<class Model>
+IntegratorLowStorageRK<Model>::IntegratorLowStorageRK(Model *simulationModel, double dt, int order,
+                                                      IntegratorWorkspace *workspace)
+  : IIntegrator(simulationModel, dt, workspace)
+  ,stageModel(simulationModel)
+  ,stages((order==3) ? 3 : 5)
+  ,A((order==3) ? williamsonA : carpenterKennedyA)
+  ,B((order==3) ? williamsonB : carpenterKennedyB)
+  ,C((order==3) ? williamsonC : carpenterKennedyC)
+  ,state(GetBuffer(0))
+  ,increment(GetBuffer(1))
+  ,derivative(GetBuffer(2))
+{
+  if (simulationModel==NULL)
+    throw std::runtime_error("Model pointer may not be NULL.");
+
+  if (order!=3 && order!=4)
+    throw std::runtime_error("Low-storage Runge-Kutta is available with order 3 and 4.");
+
+  std::stringstream name;
+  name << "LSRK" << order;
+  SetName(name.str());
+}
+
+template<class Model>
+void IntegratorLowStorageRK<Model>::SingleStep()
+{
+  assert(stageModel);
+
+  for (int s=0; s<stages; ++s)
+  {
+    // The register only belongs to the particle being written, it is updated with the force
+    stageModel->EvaluateStage(state, time + C[s] * timeStep, derivative,
+                              StageUpdate(increment, increment).Scale(A[s]).Add(timeStep, derivative));
+
+    // The state is still read by the force pass until it ends
+    StageUpdate(state, state).Add(B[s], increment).ApplyAll(dimension);
+  }
+
+  time += timeStep;
+  stageModel->EndStep(state, time);
+}
+
+template<class Model>
+void IntegratorLowStorageRK<Model>::SetInitialState(double *initialState)
+{
+  // The first stage scales the register by zero, it must not hold NaN
+  for (unsigned i=0; i<dimension; ++i)
+  {
+    state[i] = initialState[i];
+    increment[i] = 0;
+    derivative[i] = 0;
+  }
+
+  time = 0;
+}
+
+template<class Model>
+double* IntegratorLowStorageRK<Model>::GetState() const
+{
+  return state;
+}
+
+template class IntegratorLowStorageRK<IModel>;
+template class IntegratorLowStorageRK<NBody>;
@@ -0,0 +1,31 @@
+#ifndef _LOWSTORAGERK
+#define _LOWSTORAGERK
+
+#include "../Interfaces/IIntegrator.h"
+
+// 2N-storage Runge-Kutta in Williamson form, dS = A_i dS + dt f(S), S += B_i dS. Order 3 is Williamson's
+// three stage scheme, order 4 the five stage RK4(3)5[2N] of Carpenter and Kennedy. Besides the derivative only
+// the state and one register are kept, three arrays against the six of RK4.
+template<class Model=IModel>
+class IntegratorLowStorageRK : public IIntegrator
+{
+public:
+
+  IntegratorLowStorageRK(Model *simulationModel, double dt, int order, IntegratorWorkspace *workspace=NULL);
+  virtual void SingleStep();
+  virtual void SetInitialState(double *initialState);
+  virtual double* GetState() const;
+
+private:
+
+  Model *stageModel;
+  int stages;
+  const double *A;
+  const double *B;
+  const double *C;
+  double *state;
+  double *increment;
+  double *derivative;
+};
+
+#endif
@@ -5,14 +5,18 @@
 
 // Project includes
 #include "RK4.h"
+#include "../Models/NBody.h"
 
-IntegratorRK4::IntegratorRK4(IModel *simulationModel, double dt) : IIntegrator(simulationModel, dt)
-  ,state(new double [dimension])
-  ,temp(new double [dimension])
-  ,k1(new double [dimension])
-  ,k2(new double [dimension])
-  ,k3(new double [dimension])
-  ,k4(new double [dimension])
+template<class Model>
+IntegratorRK4<Model>::IntegratorRK4(Model *simulationModel, double dt, IntegratorWorkspace *workspace)
+  : IIntegrator(simulationModel, dt, workspace)
+  ,stageModel(simulationModel)
+  ,state(GetBuffer(0))
+  ,temp(GetBuffer(1))
+  ,k1(GetBuffer(2))
+  ,k2(GetBuffer(3))
+  ,k3(GetBuffer(4))
+  ,k4(GetBuffer(5))
 {
   if (simulationModel==NULL)
     throw std::runtime_error("Model pointer may not be NULL.");
@@ -22,35 +26,32 @@ IntegratorRK4::IntegratorRK4(IModel *simulationModel, double dt) : IIntegrator(s
   SetName(name.str());
 }
 
-void IntegratorRK4::SingleStep()
+template<class Model>
+void IntegratorRK4<Model>::SingleStep()
 {
-  assert(model);
+  assert(stageModel);
 
-  // k1
-  model->Evaluate(state, time, k1);
-  for (std::size_t i=0; i<dimension; ++i)
-    temp[i] = state[i] + timeStep*0.5 * k1[i];
+  // k1, temp = state + dt/2 k1
+  stageModel->EvaluateStage(state, time, k1, StageUpdate(temp, state).Add(timeStep*0.5, k1));
 
-  // k2
-  model->Evaluate(temp, time + timeStep*0.5, k2);
-  for (std::size_t i=0; i<dimension; ++i)
-    temp[i] = state[i] + timeStep*0.5 * k2[i];
+  // k2, k4 = state + dt/2 k2. The model reads a stage state while it writes the update, so it goes to the slot
+  // of k4, unused until the last stage.
+  stageModel->EvaluateStage(temp, time + timeStep*0.5, k2, StageUpdate(k4, state).Add(timeStep*0.5, k2));
 
-  // k3
-  model->Evaluate(temp, time + timeStep*0.5, k3);
-  for (std::size_t i=0; i<dimension; ++i)
-    temp[i] = state[i] + timeStep * k3[i];
+  // k3, temp = state + dt k3
+  stageModel->EvaluateStage(k4, time + timeStep*0.5, k3, StageUpdate(temp, state).Add(timeStep, k3));
 
-  // k4
-  model->Evaluate(temp, time + timeStep, k4);
-
-  for (std::size_t i=0; i<dimension; ++i)
-    state[i] += timeStep/6 * (k1[i] + 2*(k2[i]+k3[i]) + k4[i]);
+  // k4, state += dt/6 (k1 + 2 k2 + 2 k3 + k4)
+  stageModel->EvaluateStage(temp, time + timeStep, k4,
+                            StageUpdate(state, state).Add(timeStep/6, k1).Add(timeStep/3, k2)
+                                                     .Add(timeStep/3, k3).Add(timeStep/6, k4));
 
   time += timeStep;
+  stageModel->EndStep(state, time);
 }
 
-void IntegratorRK4::SetInitialState(double *initialState)
+template<class Model>
+void IntegratorRK4<Model>::SetInitialState(double *initialState)
 {
   for (unsigned i=0; i<dimension; ++i)
   {
@@ -64,7 +65,11 @@ void IntegratorRK4::SetInitialState(double *initialState)
   time = 0;
 }
 
-double* IntegratorRK4::GetState() const
+template<class Model>
+double* IntegratorRK4<Model>::GetState() const
 {
   return state;
-}
\ No newline at end of file
+}
+
+template class IntegratorRK4<IModel>;
+template class IntegratorRK4<NBody>;
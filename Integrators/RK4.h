@@ -3,23 +3,26 @@
 
 #include "../Interfaces/IIntegrator.h"
 
+// Model is the concrete model type, stage evaluations are resolved at compile time when it is final
+template<class Model=IModel>
 class IntegratorRK4 : public IIntegrator
 {
 public:
 
-  IntegratorRK4(IModel *simulationModel, double dt);
+  IntegratorRK4(Model *simulationModel, double dt, IntegratorWorkspace *workspace=NULL);
   virtual void SingleStep();
   virtual void SetInitialState(double *initialState);
   virtual double* GetState() const;
 
 private:
 
+  Model *stageModel;
   double *state;
   double *temp;
   double *k1;
   double *k2;
   double *k3;
-  double *k4;
+  double *k4;     // holds the third stage state until the last stage writes it
 };
 
-#endif
\ No newline at end of file
+#endif
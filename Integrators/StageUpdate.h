@@ -0,0 +1,102 @@
+#ifndef _STAGEUPDATE
+#define _STAGEUPDATE
+
+// Standard includes
+#include <cstddef>
+#include <algorithm>
+
+// Runge-Kutta stage combination output = a base + sum c_j k_j, a is 1 unless scaled. Models apply it to the rows of
+// a particle as soon as its derivative is final, so every stage streams the state once. The output must not be the
+// evaluated state, other particles still read it.
+struct StageUpdate
+{
+  static const int maximumTerms = 4;
+
+  StageUpdate()
+    :output(NULL)
+    ,base(NULL)
+    ,scale(1)
+    ,terms(0)
+  {}
+
+  StageUpdate(double *out, const double *in)
+    :output(out)
+    ,base(in)
+    ,scale(1)
+    ,terms(0)
+  {}
+
+  // Low-storage schemes carry the previous stages in the base
+  StageUpdate& Scale(double baseCoefficient)
+  {
+    scale = baseCoefficient;
+    return *this;
+  }
+
+  StageUpdate& Add(double coefficient, const double *derivative)
+  {
+    coefficients[terms] = coefficient;
+    derivatives[terms] = derivative;
+    ++terms;
+    return *this;
+  }
+
+  bool IsSet() const
+  {
+    return output!=NULL;
+  }
+
+  // Elements [begin, end) of the state vector
+  void Apply(std::size_t begin, std::size_t end) const
+  {
+    double *out = output;
+    const double *in = base, *k0 = derivatives[0], *k1 = derivatives[1], *k2 = derivatives[2], *k3 = derivatives[3];
+    const double a = scale, c0 = coefficients[0], c1 = coefficients[1], c2 = coefficients[2], c3 = coefficients[3];
+
+    switch (terms)
+    {
+    case 1:
+      #pragma omp simd
+      for (std::size_t i=begin; i<end; ++i)
+        out[i] = a*in[i] + c0*k0[i];
+      break;
+    case 2:
+      #pragma omp simd
+      for (std::size_t i=begin; i<end; ++i)
+        out[i] = a*in[i] + c0*k0[i] + c1*k1[i];
+      break;
+    case 3:
+      #pragma omp simd
+      for (std::size_t i=begin; i<end; ++i)
+        out[i] = a*in[i] + c0*k0[i] + c1*k1[i] + c2*k2[i];
+      break;
+    case 4:
+      #pragma omp simd
+      for (std::size_t i=begin; i<end; ++i)
+        out[i] = a*in[i] + c0*k0[i] + c1*k1[i] + c2*k2[i] + c3*k3[i];
+      break;
+    default:
+      break;
+    }
+  }
+
+  // Separate parallel pass for models that can't fuse it
+  void ApplyAll(std::size_t dimension) const
+  {
+    const std::size_t block = 4096;
+    const long long blocks = (long long)((dimension + block - 1) / block);
+
+    #pragma omp parallel for schedule(static)
+    for (long long b=0; b<blocks; ++b)
+      Apply(b*block, std::min<std::size_t>((b + 1)*block, dimension));
+  }
+
+  double *output;
+  const double *base;
+  double scale;
+  int terms;
+  const double *derivatives[maximumTerms];
+  double coefficients[maximumTerms];
+};
+
+#endif
@@ -0,0 +1,54 @@
+// Project includes
+#include "Workspace.h"
+#include "../Utils/Numa.h"
+
+IntegratorWorkspace::IntegratorWorkspace()
+{}
+
+IntegratorWorkspace::~IntegratorWorkspace()
+{
+  Release();
+}
+
+double* IntegratorWorkspace::GetBuffer(int index, std::size_t size)
+{
+  if (index>=(int)buffers.size())
+  {
+    Buffer empty = {NULL, 0};
+    buffers.resize(index + 1, empty);
+  }
+
+  Buffer &buffer = buffers[index];
+  if (buffer.size<size)
+  {
+    Numa::Free(buffer.data);
+    buffer.data = NULL;
+    buffer.size = 0;
+    buffer.data = Numa::AllocateArray<double>(size);
+    buffer.size = size;
+  }
+
+  return (size>0) ? buffer.data : NULL;
+}
+
+int IntegratorWorkspace::GetBuffers() const
+{
+  return (int)buffers.size();
+}
+
+std::size_t IntegratorWorkspace::GetBytes() const
+{
+  std::size_t bytes = 0;
+  for (std::size_t i=0; i<buffers.size(); ++i)
+    bytes += buffers[i].size * sizeof(double);
+
+  return bytes;
+}
+
+void IntegratorWorkspace::Release()
+{
+  for (std::size_t i=0; i<buffers.size(); ++i)
+    Numa::Free(buffers[i].data);
+
+  buffers.clear();
+}
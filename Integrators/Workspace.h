@@ -0,0 +1,37 @@
+#ifndef _WORKSPACE
+#define _WORKSPACE
+
+// Standard includes
+#include <cstddef>
+#include <vector>
+
+// Heap buffers of the integrators. They only grow, so a workspace passed to the integrators created one after
+// another (ensemble members, integrators recreated after a rebalance) allocates once. Only one integrator may
+// use a workspace at a time. The buffers are first touched in the partition of the force loop, their content is
+// not kept when one grows.
+class IntegratorWorkspace
+{
+public:
+
+  IntegratorWorkspace();
+  ~IntegratorWorkspace();
+  double* GetBuffer(int index, std::size_t size);
+  int GetBuffers() const;
+  std::size_t GetBytes() const;
+  void Release();
+
+private:
+
+  IntegratorWorkspace(const IntegratorWorkspace &ref);
+  IntegratorWorkspace& operator=(const IntegratorWorkspace &ref);
+
+  struct Buffer
+  {
+    double *data;
+    std::size_t size;
+  };
+
+  std::vector<Buffer> buffers;
+};
+
+#endif
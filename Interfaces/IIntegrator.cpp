@@ -5,10 +5,12 @@
 // Project includes
 #include "IIntegrator.h"
 
-IIntegrator::IIntegrator(IModel *simulationModel, double dt) : model(simulationModel)
+IIntegrator::IIntegrator(IModel *simulationModel, double dt, IntegratorWorkspace *sharedWorkspace) : model(simulationModel)
   ,timeStep(dt)
   ,time(0)
   ,dimension( (simulationModel) ? simulationModel->GetSimulationDimension() : 0)
+  ,ownWorkspace(sharedWorkspace ? NULL : new IntegratorWorkspace())
+  ,workspace(sharedWorkspace ? sharedWorkspace : ownWorkspace.get())
 {
   if (!simulationModel)
     throw std::runtime_error("Model pointer may not be NULL");
@@ -17,6 +19,19 @@ IIntegrator::IIntegrator(IModel *simulationModel, double dt) : model(simulationM
     throw std::runtime_error("Step size may not be negative or NULL.");
 }
 
+IIntegrator::~IIntegrator()
+{}
+
+double* IIntegrator::GetBuffer(int index)
+{
+  return workspace->GetBuffer(index, dimension);
+}
+
+std::size_t IIntegrator::GetWorkspaceBytes() const
+{
+  return workspace->GetBytes();
+}
+
 double IIntegrator::GetTimeStep() const
 {
   return timeStep;
@@ -45,4 +60,9 @@ const std::string& IIntegrator::GetName() const
 double IIntegrator::GetTime() const
 {
   return time;
-}
\ No newline at end of file
+}
+
+void IIntegrator::SetTime(double t)
+{
+  time = t;
+}
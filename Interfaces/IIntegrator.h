@@ -3,24 +3,30 @@
 
 #include <memory>
 #include "IModel.h"
+#include "../Integrators/Workspace.h"
 
 class IIntegrator
 {
 public:
   
-    IIntegrator(IModel *simulationModel, double dt);
+    // Buffers come from the workspace if one is given, otherwise from one owned by the integrator
+    IIntegrator(IModel *simulationModel, double dt, IntegratorWorkspace *sharedWorkspace=NULL);
+    virtual ~IIntegrator();
     void SetTimeStep(double dt);
     double GetTimeStep() const;
     double GetTime() const;
+    void SetTime(double t);
     virtual void Reverse();
     virtual void SetInitialState(double *initialState) = 0;
     virtual void SingleStep() = 0;
     virtual double* GetState() const = 0;
     const std::string& GetName() const;
+    std::size_t GetWorkspaceBytes() const;
 
 protected:
 
     void SetName(const std::string &integratorName);
+    double* GetBuffer(int index);
 
     IModel *model;
     double timeStep;
@@ -30,6 +36,9 @@ protected:
 
 private:
 
+    std::unique_ptr<IntegratorWorkspace> ownWorkspace;
+    IntegratorWorkspace *workspace;
+
     IIntegrator(const IIntegrator &ref);
     IIntegrator& operator=(const IIntegrator &ref);
 };
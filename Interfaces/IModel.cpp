@@ -17,3 +17,13 @@ std::string IModel::GetName() const
 {
   return name;
 }
+
+void IModel::EndStep(double *state, double time)
+{}
+
+void IModel::EvaluateStage(double *state, double time, double *derivative, const StageUpdate &update)
+{
+  Evaluate(state, time, derivative);
+  if (update.IsSet())
+    update.ApplyAll(dimension);
+}
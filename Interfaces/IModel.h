@@ -2,6 +2,7 @@
 #define	_IMODEL
 
 #include <string>
+#include "../Integrators/StageUpdate.h"
 
 class IModel
 {
@@ -13,6 +14,10 @@ public:
     void SetSimulationDimension(unsigned dim) ;
     std::string GetName() const;
     virtual void Evaluate(double *state, double time, double *derivative) = 0;
+    // Evaluate followed by the integrator's stage update, models may fuse both into one pass
+    virtual void EvaluateStage(double *state, double time, double *derivative, const StageUpdate &update);
+    // Called by the integrators with the state at the end of every step
+    virtual void EndStep(double *state, double time);
     virtual double* GetInitialState() = 0;
 
 private:
@@ -4,18 +4,24 @@
 #include <limits>
 #include <iostream>
 #include <string>
+#include <stdexcept>
 #include <omp.h>
 
 // Project includes
 #include "NBody.h"
+#include "../Utils/Tracer.h"
+#include "../Utils/Philox.h"
+#include "../Utils/Numa.h"
+#include "../IO/ParticleImport.h"
 
 using namespace std;
 
-NBody::NBody(Json::Value config) : IModel("N-Body simulation (2D)")
+NBody::NBody(Json::Value config, int particleShare, int particleShares) : IModel("N-Body simulation (2D)")
   ,particleState(NULL)
   ,particleParameters(NULL)
   ,configuration(config)
-  ,quadtree(Quadtree(Vector2D(), Vector2D()))
+  ,snapshot()
+  ,quadtree(Vector2D(), Vector2D())
   ,cornerNW()
   ,cornerSE()
   ,massCenter()
@@ -26,15 +32,68 @@ NBody::NBody(Json::Value config) : IModel("N-Body simulation (2D)")
   ,gravitationalConstant(6.67428e-11) // G
   ,g(gravitationalConstant/(pc*pc*pc)*massSun*year*year) // G but in parsecs, sun-mass and years
   ,particles(0)
+  ,sources(0)
+  ,share(particleShare)
+  ,shares(particleShares)
+  ,firstParticle(0)
+  ,globalParticles(0)
+  ,seed(config.get("Random seed", 1).asUInt64())
+  ,forceMode(GetForceMode(config["Force"].asString()))
+  ,directSummation(g, quadtree.GetSoftening())
+  ,particleMesh(g, config["TreePM"].get("Grid", 128).asInt(),
+                config["TreePM"].get("Split", 1.25).asDouble(), config["TreePM"].get("Cutoff", 4.5).asDouble())
+  ,externalPotentials(g, quadtree.GetSoftening())
+  ,massiveBodies(g, quadtree.GetSoftening(), config["Hybrid"].get("Accuracy", 0.02).asDouble())
+  ,massiveBodyMass(config["Hybrid"]["Minimum mass"].asDouble())
+  ,isMassiveBody()
+  ,accelerationX()
+  ,accelerationY()
+  ,lastAcceleration()
+  ,inGroup()
+  ,metrics()
+  ,diagnostics()
+  ,particlePotential()
+  ,externalPotential()
+  ,diagnosticsRequested(false)
+  ,deterministic(false)
+  ,massiveBodiesWarned(false)
 {
-  Quadtree::gravitationalConstant = g;
-
-  if (configuration["Simulation"].asString() == "Single Galaxy")
+  quadtree.SetGravitationalConstant(g);
+  quadtree.SetOpeningCriterion(GetOpeningCriterion(config["Opening"]["Criterion"].asString()),
+                               config["Opening"].get("Accuracy", 0.005).asDouble());
+  quadtree.SetMixedPrecision(config.get("Mixed precision", false).asBool());
+
+  metrics.SetPeakBandwidth(config["Memory"].get("Peak bandwidth", 0).asDouble() * 1e9);
+  SetDeterministic(config.get("Deterministic", false).asBool());
+
+  if (shares<1 || share<0 || share>=shares)
+    throw std::runtime_error("Particle share " + to_string(share) + " of " + to_string(shares) + " doesn't exist.");
+
+  if (!configuration["Restart file"].asString().empty())
+    Restart(configuration["Restart file"].asString());
+  else if (!configuration["Import"]["File"].asString().empty())
+    Import(configuration["Import"]["File"].asString(), configuration["Import"]["Format"].asString());
+  else if (configuration["Simulation"].asString() == "Single Galaxy")
     SingleGalaxy();
   else if (configuration["Simulation"].asString() == "Galaxy Collision")
     GalaxyCollision();
   else // default if not provided or not correct
     SingleGalaxy();
+
+  // Potentials not bound to a galaxy
+  const Json::Value &potentials = configuration["External potentials"];
+  for (unsigned i=0; i<potentials.size(); ++i)
+    externalPotentials.Add(ParsePotential(potentials[i]));
+}
+
+NBody::~NBody()
+{
+  // Restarted particles live in the snapshot mapping
+  if (!snapshot.IsOpen())
+  {
+    Numa::Free(particleState);
+    Numa::Free(particleParameters);
+  }
 }
 
 Vector3D NBody::GetMassCenter() const
@@ -48,7 +107,7 @@ double* NBody::GetInitialState()
   return reinterpret_cast<double*>(particleState);
 }
 
-void NBody::GetOrbitalVelocity(const ParticleData2D &p1, const ParticleData2D &p2)
+void NBody::GetOrbitalVelocity(const ParticleData2D &p1, const ParticleData2D &p2, double externalVelocitySquared)
 {
   double x1 = p1.particleState->positionX,
          y1 = p1.particleState->positionY,
@@ -65,7 +124,7 @@ void NBody::GetOrbitalVelocity(const ParticleData2D &p1, const ParticleData2D &p
   dist = sqrt(r[0] * r[0] + r[1] * r[1]);
 
   // Based on the distance from the given body (p1) calculate the velocity needed to maintain a circular orbit
-  double v = sqrt(g * m1 / dist);
+  double v = sqrt(g * m1 / dist + externalVelocitySquared);
 
   // Calculate for 2D vector
   double &vx = p2.particleState->velocityX,
@@ -77,153 +136,394 @@ void NBody::GetOrbitalVelocity(const ParticleData2D &p1, const ParticleData2D &p
 void NBody::SimulationSettings(int totalParticles)
 {
   particles = totalParticles;
+  sources = totalParticles;
+  globalParticles = totalParticles;
   SetSimulationDimension(particles*4);
 
-  particleState = new ParticleState2D[totalParticles];
-  particleParameters = new ParticleParameters[totalParticles];
+  // First touched in the partition of the force loop, the generation loops run per galaxy
+  particleState = Numa::AllocateArray<ParticleState2D>(totalParticles);
+  particleParameters = Numa::AllocateArray<ParticleParameters>(totalParticles);
+}
+
+NBody::GalaxySettings NBody::ParseGalaxySettings(const Json::Value &settings)
+{
+  GalaxySettings galaxy;
+  galaxy.particles = settings["Number of particles"].asInt();
+  galaxy.tracers = std::max(settings["Tracer particles"].asInt(), 0);
+  galaxy.positionX = settings["Initial conditions"]["positionX"].asDouble();
+  galaxy.positionY = settings["Initial conditions"]["positionY"].asDouble();
+  galaxy.velocityX = settings["Initial conditions"]["velocityX"].asDouble(); // parsecs/year
+  galaxy.velocityY = settings["Initial conditions"]["velocityY"].asDouble(); // parsecs/year
+  galaxy.bulgeMass = settings["Bulge mass"].asDouble(); // times sun mass
+  galaxy.bulgeRadius = settings["Bulge radius"].asDouble();
+  galaxy.diskRadius = settings["Disk radius"].asDouble();
+  galaxy.minimumMass = settings["Minimum stellar mass"].asDouble();
+  galaxy.maximumMass = settings["Maximum stellar mass"].asDouble();
+
+  const Json::Value &potentials = settings["Potentials"];
+  for (unsigned i=0; i<potentials.size(); ++i)
+    galaxy.potentials.push_back(ParsePotential(potentials[i]));
+
+  return galaxy;
+}
+
+ExternalPotentials::Potential NBody::ParsePotential(const Json::Value &settings)
+{
+  ExternalPotentials::Potential potential;
+  potential.type = ExternalPotentials::GetType(settings["Type"].asString());
+  potential.mass = settings["Mass"].asDouble(); // times sun mass
+  potential.scaleRadius = settings["Scale radius"].asDouble(); // parsecs
+  potential.scaleHeight = settings["Scale height"].asDouble(); // parsecs
+  potential.centerX = settings["positionX"].asDouble();
+  potential.centerY = settings["positionY"].asDouble();
+  potential.anchor = settings.get("Anchor particle", -1).asInt();
+  return potential;
+}
+
+std::vector<NBody::GalaxySettings> NBody::ParseGalaxies(const std::string &simulation) const
+{
+  std::vector<GalaxySettings> galaxies;
+
+  if (simulation == "Galaxy Collision")
+  {
+    const Json::Value &simSettings = configuration["Simulation settings"]["Galaxy Collision"];
+
+    // Galaxies are numbered from "1"
+    for (unsigned i = 1; i <= simSettings.size(); i++)
+      galaxies.push_back(ParseGalaxySettings(simSettings[to_string(i)]));
+  }
+  else
+  {
+    galaxies.push_back(ParseGalaxySettings(configuration["Simulation settings"]["Single Galaxy"]));
+  }
+
+  return galaxies;
 }
 
 void NBody::SingleGalaxy()
 {
-  Json::Value simSettings = configuration["Simulation settings"]["Single Galaxy"];
-  
-  // Set simulation parameters
-  SimulationSettings(simSettings["Number of particles"].asInt());
+  GenerateGalaxies(ParseGalaxies("Single Galaxy"));
+}
 
-  // Initialize particles
-  ParticleData2D galaxyCore;
+void NBody::GalaxyCollision()
+{
+  GenerateGalaxies(ParseGalaxies("Galaxy Collision"));
+}
 
-  for (int i=0; i<particles; ++i)
+void NBody::AddGalaxyPotentials(const std::vector<GalaxySettings> &galaxies)
+{
+  // Galaxy potentials move with the galaxy core, its first particle
+  int first = 0;
+  for (size_t i=0; i<galaxies.size(); ++i)
   {
-    ParticleState2D &state = particleState[i];
-    ParticleParameters &parameters = particleParameters[i];
+    for (size_t p=0; p<galaxies[i].potentials.size(); ++p)
+    {
+      ExternalPotentials::Potential potential = galaxies[i].potentials[p];
+      potential.anchor = first;
+      externalPotentials.Add(potential);
+    }
+
+    first += galaxies[i].particles;
+  }
+}
 
-    if (i==0)
+void NBody::GenerateGalaxies(const std::vector<GalaxySettings> &galaxies)
+{
+  // Calculate all particles in every galaxy (and initialize particles)
+  int particlesNumber = 0, tracersNumber = 0;
+  for (size_t i=0; i<galaxies.size(); ++i)
+  {
+    particlesNumber += galaxies[i].particles;
+    tracersNumber += galaxies[i].tracers;
+  }
+
+  // Set simulation parameters, the tracers of all galaxies follow the massive particles.
+  // A share holds the particles [firstParticle, lastParticle) of the whole population.
+  const int total = particlesNumber + tracersNumber;
+  firstParticle = (int)((long long)total * share / shares);
+  const int lastParticle = (int)((long long)total * (share + 1) / shares);
+  SimulationSettings(lastParticle - firstParticle);
+  globalParticles = total;
+  sources = std::max(std::min(particlesNumber, lastParticle) - firstParticle, 0);
+  AddGalaxyPotentials(galaxies);
+
+  // Every star draws from its own stream keyed by galaxy and star index,
+  // so the population doesn't depend on the thread count, schedule or share
+  const Philox random(seed);
+
+  int first = 0, firstTracer = particlesNumber;
+  for (size_t i=0; i<galaxies.size(); ++i)
+  {
+    const GalaxySettings &galaxy = galaxies[i];
+    if (galaxy.particles<=0)
     {
-      galaxyCore.particleState = &state;
-      galaxyCore.particleParameters = &parameters;
-      state.positionX = simSettings["Initial conditions"]["positionX"].asFloat();
-      state.positionY = simSettings["Initial conditions"]["positionY"].asFloat();
-      state.velocityX = simSettings["Initial conditions"]["velocityX"].asFloat(); // parsecs/year
-      state.velocityY = simSettings["Initial conditions"]["velocityY"].asFloat(); // parsecs/year
-      parameters.mass = simSettings["Bulge mass"].asFloat(); // times sun mass
-      parameters.radius = simSettings["Bulge radius"].asFloat();
+      firstTracer += galaxy.tracers;
+      continue;
     }
-    else
+
+    // The first particle of every galaxy is its bulge, the orbits need it in every share
+    ParticleState2D coreState;
+    ParticleParameters coreParameters;
+    coreState.positionX = galaxy.positionX;
+    coreState.positionY = galaxy.positionY;
+    coreState.velocityX = galaxy.velocityX;
+    coreState.velocityY = galaxy.velocityY;
+    coreParameters.mass = galaxy.bulgeMass;
+    coreParameters.radius = galaxy.bulgeRadius;
+    ParticleData2D galaxyCore(&coreState, &coreParameters);
+    if (first>=firstParticle && first<lastParticle)
     {
-      double radius = simSettings["Bulge radius"].asFloat() + (double)rand() / RAND_MAX * (simSettings["Disk radius"].asFloat() - simSettings["Bulge radius"].asFloat());
-      double angle = rand();
-      parameters.mass = simSettings["Minimum stellar mass"].asFloat() + (double)rand() / RAND_MAX * (simSettings["Maximum stellar mass"].asFloat() - simSettings["Minimum stellar mass"].asFloat());
-      state.positionX = simSettings["Initial conditions"]["positionX"].asFloat() + radius*sin(angle);
-      state.positionY = simSettings["Initial conditions"]["positionY"].asFloat() + radius*cos(angle);
-
-      GetOrbitalVelocity(galaxyCore, ParticleData2D(&state, &parameters));
-      state.velocityX+=galaxyCore.particleState->velocityX;
-      state.velocityY+=galaxyCore.particleState->velocityY;
+      particleState[first - firstParticle] = coreState;
+      particleParameters[first - firstParticle] = coreParameters;
     }
 
-    // Determine the size of the area including all particles
-    cornerSE.x = std::max(cornerSE.x, state.positionX);
-    cornerSE.y = std::max(cornerSE.y, state.positionY);
-    cornerNW.x = std::min(cornerNW.x, state.positionX);
-    cornerNW.y = std::min(cornerNW.y, state.positionY);
+    const int starsBegin = std::max(1, firstParticle - first),
+              starsEnd = std::min(galaxy.particles, lastParticle - first);
+    #pragma omp parallel for
+    for (int j=starsBegin; j<starsEnd; ++j)
+    {
+      ParticleState2D &state = particleState[first + j - firstParticle];
+      ParticleParameters &parameters = particleParameters[first + j - firstParticle];
+
+      uint32_t bits[8];
+      random.Generate((uint32_t)j, (uint32_t)i, 0, 0, bits);
+      random.Generate((uint32_t)j, (uint32_t)i, 1, 0, bits + 4);
+
+      double radius = galaxy.bulgeRadius + Philox::ToUniform(bits[0], bits[1]) * (galaxy.diskRadius - galaxy.bulgeRadius);
+      double angle = 2 * M_PI * Philox::ToUniform(bits[2], bits[3]);
+      parameters.mass = galaxy.minimumMass + Philox::ToUniform(bits[4], bits[5]) * (galaxy.maximumMass - galaxy.minimumMass);
+      parameters.radius = 0;
+      state.positionX = galaxy.positionX + radius*sin(angle);
+      state.positionY = galaxy.positionY + radius*cos(angle);
+
+      // The galaxy's own potentials add to the mass of the core
+      GetOrbitalVelocity(galaxyCore, ParticleData2D(&state, &parameters),
+                         externalPotentials.GetCircularVelocitySquared(first, radius));
+      state.velocityX+=galaxy.velocityX;
+      state.velocityY+=galaxy.velocityY;
+    }
+
+    // Tracers are drawn from the same disc with streams of their own
+    const int tracersBegin = std::max(0, firstParticle - firstTracer),
+              tracersEnd = std::min(galaxy.tracers, lastParticle - firstTracer);
+    #pragma omp parallel for
+    for (int j=tracersBegin; j<tracersEnd; ++j)
+    {
+      ParticleState2D &state = particleState[firstTracer + j - firstParticle];
+      ParticleParameters &parameters = particleParameters[firstTracer + j - firstParticle];
+
+      uint32_t bits[4];
+      random.Generate((uint32_t)j, (uint32_t)i, 2, 0, bits);
+
+      double radius = galaxy.bulgeRadius + Philox::ToUniform(bits[0], bits[1]) * (galaxy.diskRadius - galaxy.bulgeRadius);
+      double angle = 2 * M_PI * Philox::ToUniform(bits[2], bits[3]);
+      // Massless, whatever reads the masses sees them as no source
+      parameters.mass = 0;
+      parameters.radius = 0;
+      state.positionX = galaxy.positionX + radius*sin(angle);
+      state.positionY = galaxy.positionY + radius*cos(angle);
+
+      GetOrbitalVelocity(galaxyCore, ParticleData2D(&state, &parameters),
+                         externalPotentials.GetCircularVelocitySquared(first, radius));
+      state.velocityX+=galaxy.velocityX;
+      state.velocityY+=galaxy.velocityY;
+    }
+
+    first += galaxy.particles;
+    firstTracer += galaxy.tracers;
   }
 
+  ComputeAreaOfInterest();
+}
+
+void NBody::Import(const std::string &fileName, const std::string &format)
+{
+  ParticleImport import;
+  import.Open(fileName, format);
+
+  if (import.GetParticlesCount()==0 || import.GetParticlesCount()>(uint64_t)std::numeric_limits<int>::max())
+    throw std::runtime_error("Particle file '" + fileName + "' has no or too many particles.");
+
+  // Parsed straight into the simulation arrays
+  SimulationSettings((int)import.GetParticlesCount());
+  import.Read(particleState, particleParameters);
+
+  ComputeAreaOfInterest();
+}
+
+void NBody::ComputeAreaOfInterest()
+{
+  // Determine the size of the area including all particles
+  double minX = cornerNW.x, minY = cornerNW.y,
+         maxX = cornerSE.x, maxY = cornerSE.y;
+
+  #pragma omp parallel for reduction(min:minX,minY) reduction(max:maxX,maxY)
+  for (int i=0; i<particles; ++i)
+  {
+    minX = std::min(minX, particleState[i].positionX);
+    minY = std::min(minY, particleState[i].positionY);
+    maxX = std::max(maxX, particleState[i].positionX);
+    maxY = std::max(maxY, particleState[i].positionY);
+  }
+
+  cornerNW = Vector2D(minX, minY);
+  cornerSE = Vector2D(maxX, maxY);
+
+  // The first tree is centred on the mass centre as well, later ones take it from the previous tree.
+  // Summed in index order, so the first box doesn't depend on the thread count.
+  double mass = 0, massX = 0, massY = 0;
+  for (int i=0; i<sources; ++i)
+  {
+    mass += particleParameters[i].mass;
+    massX += particleParameters[i].mass * particleState[i].positionX;
+    massY += particleParameters[i].mass * particleState[i].positionY;
+  }
+  massCenter = (mass>0) ? Vector2D(massX / mass, massY / mass)
+                        : Vector2D(0.5 * (cornerNW.x + cornerSE.x), 0.5 * (cornerNW.y + cornerSE.y));
+
   // Calculate the dimesion of the quadrant and add little bit more space to it
   areaOfInterest = 1.5 * 1.05 * std::max(cornerSE.x - cornerNW.x, cornerSE.y - cornerNW.y);
 }
 
-void NBody::GalaxyCollision()
+void NBody::Restart(const std::string &fileName)
 {
-  Json::Value simSettings = configuration["Simulation settings"]["Galaxy Collision"];
+  // Particle data is used directly from the mapped snapshot file
+  snapshot.Open(fileName);
+  const SnapshotHeader &header = snapshot.GetHeader();
+  if (header.tracers>header.particles)
+    throw std::runtime_error("Snapshot '" + fileName + "' has more tracers than particles.");
+
+  particles = header.particles;
+  sources = header.particles - header.tracers;
+  globalParticles = particles;
+  SetSimulationDimension(particles*4);
 
-  // Calculate all particles in every galaxy (and initialize particles)
-  int particlesNumber = 0;
-  ParticleData2D galaxyCores [simSettings.size()];
-  for (int i = 1; i <= simSettings.size(); i++)
+  particleState = snapshot.GetParticleState();
+  particleParameters = snapshot.GetParticleParameters();
+
+  areaOfInterest = header.areaOfInterest;
+  massCenter = Vector2D(header.massCenterX, header.massCenterY);
+  quadtree.SetTheta(header.theta);
+  quadtree.SetSoftening(header.softening);
+  directSummation.SetSoftening(header.softening);
+  externalPotentials.SetSoftening(header.softening);
+  massiveBodies.SetSoftening(header.softening);
+
+  // Galaxy potentials are taken from the config the snapshot was started with
+  std::vector<GalaxySettings> galaxies = ParseGalaxies(configuration["Simulation"].asString());
+  int galaxyParticles = 0;
+  size_t galaxyPotentials = 0;
+  for (size_t i=0; i<galaxies.size(); ++i)
   {
-    particlesNumber += simSettings[to_string(i)]["Number of particles"].asInt();
+    galaxyParticles += galaxies[i].particles;
+    galaxyPotentials += galaxies[i].potentials.size();
   }
 
-  int k = 0;
+  if (galaxyParticles==sources)
+    AddGalaxyPotentials(galaxies);
+  else if (galaxyPotentials>0)
+    std::cout << "Warning: snapshot '" << fileName << "' doesn't match the configured galaxies, their potentials are not used" << std::endl;
+
+  if (header.gravitationalConstant!=g)
+    std::cout << "Warning: snapshot '" << fileName << "' was written with a different gravitational constant ("
+              << header.gravitationalConstant << " instead of " << g << ")" << std::endl;
+}
+
+SnapshotHeader NBody::CreateSnapshotHeader() const
+{
+  SnapshotHeader header = Snapshot::CreateHeader(particles);
 
-  // Set simulation parameters
-  SimulationSettings(particlesNumber);
+  header.theta = quadtree.GetTheta();
+  header.softening = quadtree.GetSoftening();
+  header.gravitationalConstant = g;
+  header.areaOfInterest = areaOfInterest;
+  header.massCenterX = massCenter.x;
+  header.massCenterY = massCenter.y;
+  header.tracers = particles - sources;
 
-  for (int i = 1; i <= simSettings.size(); i++)
+  return header;
+}
+
+const Snapshot& NBody::GetSnapshot() const
+{
+  return snapshot;
+}
+
+void NBody::BuiltTree(const ParticleData2D &particleData)
+{
   {
-    Json::Value galaxySettings = simSettings[to_string(i)];
+    ScopedPhase buildPhase(metrics, Metrics::TREE_BUILD);
+    TRACE_SCOPE("Tree build");
+
+    quadtree.Reset(Vector2D(massCenter.x - areaOfInterest, massCenter.y - areaOfInterest),
+                 Vector2D(massCenter.x + areaOfInterest, massCenter.y + areaOfInterest));
 
-    for (int j=0; j<galaxySettings["Number of particles"].asInt(); ++j)
+    // Build the quadtree, tracers are never force sources and massive bodies attract directly.
+    // Insertion in index order fixes the tree, the overflow list and the mass sums for any thread count.
+    for (int i=0; i<sources; ++i)
     {
-      ParticleState2D &state = particleState[k];
-      ParticleParameters &parameters = particleParameters[k];
-      k++;
+      if (massiveBodies.IsInitialized() && isMassiveBody[i])
+        continue;
 
-      if (j==0)
+      try
       {
-        galaxyCores[i].particleState = &state;
-        galaxyCores[i].particleParameters = &parameters;
-        state.positionX = galaxySettings["Initial conditions"]["positionX"].asFloat();
-        state.positionY = galaxySettings["Initial conditions"]["positionY"].asFloat();
-        state.velocityX = galaxySettings["Initial conditions"]["velocityX"].asFloat(); // parsecs/year
-        state.velocityY = galaxySettings["Initial conditions"]["velocityY"].asFloat(); // parsecs/year
-        parameters.mass = galaxySettings["Bulge mass"].asFloat(); // times sun mass
-        parameters.radius = galaxySettings["Bulge radius"].asFloat();
+        // Get data of the particle
+        ParticleData2D particle(&(particleData.particleState[i]), &(particleData.particleParameters[i]));
+
+        // Insert the particle only if its inside the aoi
+        quadtree.Insert(particle, 0);
       }
-      else
+      catch(std::exception &exc)
       {
-        double radius = galaxySettings["Bulge radius"].asFloat() + (double)rand() / RAND_MAX * (galaxySettings["Disk radius"].asFloat() - galaxySettings["Bulge radius"].asFloat());
-        double angle = rand();
-        parameters.mass = galaxySettings["Minimum stellar mass"].asFloat() + (double)rand() / RAND_MAX * (galaxySettings["Maximum stellar mass"].asFloat() - galaxySettings["Minimum stellar mass"].asFloat());
-        state.positionX = galaxySettings["Initial conditions"]["positionX"].asFloat() + radius*sin(angle);
-        state.positionY = galaxySettings["Initial conditions"]["positionY"].asFloat() + radius*cos(angle);
-
-        GetOrbitalVelocity(galaxyCores[i], ParticleData2D(&state, &parameters));
-        state.velocityX+=galaxyCores[i].particleState->velocityX;
-        state.velocityY+=galaxyCores[i].particleState->velocityY;
+        // Particle outside the area of interest. Do nothing
       }
-
-      // Determine the size of the area including all particles
-      cornerSE.x = std::max(cornerSE.x, state.positionX);
-      cornerSE.y = std::max(cornerSE.y, state.positionY);
-      cornerNW.x = std::min(cornerNW.x, state.positionX);
-      cornerNW.y = std::min(cornerNW.y, state.positionY);
     }
   }
 
-  // Calculate the dimesion of the quadrant and add little bit more space to it
-  areaOfInterest = 1.5 * 1.05 * std::max(cornerSE.x - cornerNW.x, cornerSE.y - cornerNW.y);
+  // Compute mass distribution
+  {
+    ScopedPhase massPhase(metrics, Metrics::MASS_DISTRIBUTION);
+    TRACE_SCOPE("Mass distribution");
+    quadtree.ComputeMassDistribution();
+  }
 
+  int nodes, depth;
+  quadtree.GetTreeStatistics(nodes, depth);
+  metrics.SetTreeStatistics(nodes, depth);
+
+  // Update the mass center
+  massCenter = quadtree.GetMassCenter();
 }
 
-void NBody::BuiltTree(const ParticleData2D &particleData)
+void NBody::ConfigureMemory(const Json::Value &config)
 {
-  quadtree.Reset(Vector2D(massCenter.x - areaOfInterest, massCenter.y - areaOfInterest),
-               Vector2D(massCenter.x + areaOfInterest, massCenter.y + areaOfInterest));
+  const Json::Value &memory = config["Memory"];
+  Numa::Configure(memory.get("Huge pages", false).asBool(), Numa::GetAffinity(memory.get("Thread affinity", "none").asString()));
+}
 
-  // Build the quadtree
-  for (int i=0; i<particles; ++i)
-  {
-    try
-    {
-      // Get data of the particle
-      ParticleData2D particle(&(particleData.particleState[i]), &(particleData.particleParameters[i]));
+Metrics& NBody::GetMetrics()
+{
+  return metrics;
+}
 
-      // Insert the particle only if its inside the aoi
-      quadtree.Insert(particle, 0);
-    }
-    catch(std::exception &exc)
-    {
-      // Particle outside the area of interest. Do nothing
-    }
-  }
+void NBody::RequestDiagnostics()
+{
+  diagnosticsRequested = true;
+}
 
-  // Compute mass distribution
-  quadtree.ComputeMassDistribution();
+const ExternalPotentials& NBody::GetExternalPotentials() const
+{
+  return externalPotentials;
+}
 
-  // Update the mass center
-  massCenter = quadtree.GetMassCenter();
+const HermiteSubsystem& NBody::GetMassiveBodies() const
+{
+  return massiveBodies;
+}
+
+const Diagnostics& NBody::GetDiagnostics() const
+{
+  return diagnostics;
 }
 
 const ParticleParameters* NBody::GetParticleParameters() const
@@ -241,6 +541,21 @@ int NBody::GetTotalParticles() const
   return particles;
 }
 
+int NBody::GetFirstParticle() const
+{
+  return firstParticle;
+}
+
+int NBody::GetGlobalParticles() const
+{
+  return globalParticles;
+}
+
+int NBody::GetTracersCount() const
+{
+  return particles - sources;
+}
+
 double NBody::GetTheta() const
 {
   return quadtree.GetTheta();
@@ -251,32 +566,441 @@ void NBody::SetTheta(double theta)
   quadtree.SetTheta(theta);
 }
 
+bool NBody::IsMixedPrecision() const
+{
+  return quadtree.IsMixedPrecision();
+}
+
+void NBody::SetMixedPrecision(bool enabled)
+{
+  quadtree.SetMixedPrecision(enabled);
+}
+
+OpeningCriterion NBody::GetOpeningCriterion() const
+{
+  return quadtree.GetOpeningCriterion();
+}
+
+double NBody::GetOpeningAccuracy() const
+{
+  return quadtree.GetOpeningAccuracy();
+}
+
+void NBody::SetOpeningCriterion(OpeningCriterion criterion, double accuracy)
+{
+  // Only error bounded passes keep |a| up to date, after another criterion it is stale and theta takes over again
+  if (criterion!=quadtree.GetOpeningCriterion())
+    lastAcceleration.clear();
+  quadtree.SetOpeningCriterion(criterion, accuracy);
+}
+
+std::string NBody::GetOpeningCriterionName() const
+{
+  switch (quadtree.GetOpeningCriterion())
+  {
+  case OPENING_OFFSET:        return "Offset";
+  case OPENING_SALMON_WARREN: return "Salmon-Warren";
+  case OPENING_RELATIVE:      return "Relative";
+  default:                    return "Geometric";
+  }
+}
+
+OpeningCriterion NBody::GetOpeningCriterion(const std::string &name)
+{
+  if (name=="Offset")
+    return OPENING_OFFSET;
+  else if (name=="Salmon-Warren")
+    return OPENING_SALMON_WARREN;
+  else if (name=="Relative")
+    return OPENING_RELATIVE;
+  else // default if not provided or not correct
+    return OPENING_GEOMETRIC;
+}
+
+bool NBody::IsDeterministic() const
+{
+  return deterministic;
+}
+
+void NBody::SetDeterministic(bool enabled)
+{
+  // The tree and the per particle forces are always built and summed in index order, the mesh
+  // deposit and the diagnostics are the parallel reductions
+  deterministic = enabled;
+  particleMesh.SetDeterministic(enabled);
+  diagnostics.SetDeterministic(enabled);
+}
+
+NBody::ForceMode NBody::GetForceMode() const
+{
+  return forceMode;
+}
+
+void NBody::SetForceMode(ForceMode mode)
+{
+  forceMode = mode;
+}
+
+std::string NBody::GetForceModeName() const
+{
+  switch (forceMode)
+  {
+  case DIRECT: return "Direct summation";
+  case TREEPM: return "TreePM";
+  default:     return "Barnes-Hut tree";
+  }
+}
+
+NBody::ForceMode NBody::GetForceMode(const std::string &name)
+{
+  if (name=="Direct")
+    return DIRECT;
+  else if (name=="TreePM")
+    return TREEPM;
+  else // default if not provided or not correct
+    return TREE;
+}
+
+const ParticleMesh& NBody::GetParticleMesh() const
+{
+  return particleMesh;
+}
+
 void NBody::Evaluate(double *state, double time, double *derivative)
+{
+  EvaluateStage(state, time, derivative, StageUpdate());
+}
+
+void NBody::EvaluateStage(double *state, double time, double *derivative, const StageUpdate &update)
 {
   ParticleState2D *particleState = reinterpret_cast<ParticleState2D*>(state);
   ParticleNextState2D *particleNextState = reinterpret_cast<ParticleNextState2D*>(derivative);
   ParticleData2D particleData(particleState, particleParameters);
 
+  // Massive bodies are moved to this time by their own integrator
+  UpdateMassiveBodies(particleState, time);
+
+  // The tree is also needed for the display and the mass center
   BuiltTree(particleData);
 
-  // OpenMP parallel calculation
+  const StageUpdate *stageUpdate = update.IsSet() ? &update : NULL;
+  if (!diagnosticsRequested)
+  {
+    CalculateForces(particleState, particleNextState, NULL, NULL, stageUpdate);
+    return;
+  }
+
+  // The first evaluation of a step sees the state at its beginning, the potential comes with the forces
+  diagnosticsRequested = false;
+  particlePotential.resize(particles);
+  externalPotential.resize(particles);
+  CalculateForces(particleState, particleNextState, &particlePotential[0], &externalPotential[0], stageUpdate);
+  // Tracers carry no energy
+  diagnostics.Sample(particleState, particleParameters, &particlePotential[0],
+                     externalPotentials.IsEmpty() ? NULL : &externalPotential[0], sources, time);
+}
+
+void NBody::CalculateForces(ParticleState2D *particleState, ParticleNextState2D *particleNextState, double *potential, double *external,
+                            const StageUpdate *update)
+{
+  ScopedPhase forcePhase(metrics, Metrics::FORCE);
+  TRACE_SCOPE("Force pass");
+  metrics.PrepareThreads(omp_get_max_threads());
+  Numa::PinThreads(omp_get_max_threads());
+
+  // The stage update goes into the write-back unless a later pass still adds to the derivatives
+  const bool fused = update && forceMode!=TREEPM && externalPotentials.IsEmpty() && !massiveBodies.IsInitialized();
+  const StageUpdate *fusedUpdate = fused ? update : NULL;
+
+  if (forceMode==DIRECT)
+    CalculateDirectForces(particleState, particleNextState, potential, fusedUpdate);
+  else if (forceMode==TREEPM)
+    CalculateTreePMForces(particleState, particleNextState, potential);
+  else
+    CalculateTreeForces(particleState, particleNextState, potential, fusedUpdate);
+
+  // Analytic halos and bulges are added on top of the particle forces
+  if (!externalPotentials.IsEmpty())
+  {
+    TRACE_SCOPE("External potentials");
+    externalPotentials.AddAccelerations(particleState, particles, particleNextState, external);
+  }
+
+  if (massiveBodies.IsInitialized())
+    AddMassiveBodiesForces(particleState, particleNextState, potential);
+
+  if (update && !fused)
+  {
+    TRACE_SCOPE("Stage update");
+    update->ApplyAll(particles*4);
+  }
+}
+
+void NBody::UpdateMassiveBodies(ParticleState2D *particleState, double time)
+{
+  // The subsystem runs with the tree only, the direct backend treats every particle alike
+  if (massiveBodyMass<=0 || forceMode!=TREE)
+  {
+    if (massiveBodyMass>0 && !massiveBodiesWarned)
+    {
+      std::cout << "Warning: \"Hybrid\"/\"Minimum mass\" needs the tree force, " << GetForceModeName()
+                << " integrates the massive bodies with all other particles" << std::endl;
+      massiveBodiesWarned = true;
+    }
+    massiveBodies.Reset();
+    return;
+  }
+
+  if (!massiveBodies.IsInitialized())
+  {
+    std::vector<int> indices;
+    isMassiveBody.assign(particles, 0);
+    for (int i=0; i<sources; ++i)
+    {
+      if (particleParameters[i].mass>=massiveBodyMass)
+      {
+        indices.push_back(i);
+        isMassiveBody[i] = 1;
+      }
+    }
+
+    // Nothing to split off
+    if (indices.empty())
+    {
+      massiveBodyMass = 0;
+      return;
+    }
+
+    massiveBodies.Initialize(indices, particleState, particleParameters, time);
+  }
+
+  TRACE_SCOPE("Massive bodies");
+  massiveBodies.AdvanceTo(time);
+  massiveBodies.CopyState(particleState);
+}
+
+void NBody::AddMassiveBodiesForces(ParticleState2D *particleState, ParticleNextState2D *particleNextState, double *potential)
+{
+  TRACE_SCOPE("Massive bodies force");
+
+  // The light particles pull the massive bodies until the next evaluation
+  const std::vector<int> &indices = massiveBodies.GetIndices();
+  for (std::size_t k=0; k<indices.size(); ++k)
+  {
+    ParticleNextState2D &next = particleNextState[indices[k]];
+    massiveBodies.SetExternalAcceleration(k, next.accelerationX, next.accelerationY);
+  }
+
+  massiveBodies.AddAccelerations(particleState, &isMassiveBody[0], particles, particleNextState, potential);
+
+  // Their rows are left alone by the global integrator and set at the end of the step
+  for (std::size_t k=0; k<indices.size(); ++k)
+  {
+    ParticleNextState2D &next = particleNextState[indices[k]];
+    next.accelerationX = next.accelerationY = next.velocityX = next.velocityY = 0;
+  }
+}
+
+void NBody::EndStep(double *state, double time)
+{
+  if (!massiveBodies.IsInitialized())
+    return;
+
+  massiveBodies.AdvanceTo(time);
+  massiveBodies.CopyState(reinterpret_cast<ParticleState2D*>(state));
+}
+
+void NBody::CalculateDirectForces(ParticleState2D *particleState, ParticleNextState2D *particleNextState, double *potential,
+                                  const StageUpdate *update)
+{
+  TRACE_SCOPE("Direct summation");
+  accelerationX.resize(particles);
+  accelerationY.resize(particles);
+  directSummation.CalculateAccelerations(particleState, particleParameters, particles, sources, &accelerationX[0], &accelerationY[0], potential);
+
   #pragma omp parallel for
-  for (int i=1; i<particles; ++i)
+  for (int i=0; i<particles; ++i)
   {
-    ParticleData2D particle(&particleState[i], &particleParameters[i]);
-    Vector2D accleration = quadtree.CalculateForce(particle);
-    particleNextState[i].accelerationX = accleration.x;
-    particleNextState[i].accelerationY = accleration.y;
+    particleNextState[i].accelerationX = accelerationX[i];
+    particleNextState[i].accelerationY = accelerationY[i];
     particleNextState[i].velocityX = particleState[i].velocityX;
     particleNextState[i].velocityY = particleState[i].velocityY;
+    if (update)
+      update->Apply(4*i, 4*i + 4);
   }
 
-  // Particle "0" has statistics data and cannot be calculated parallel
+  metrics.AddThreadCounters(0, (long long)particles*sources, 0);
+}
+
+void NBody::CalculateTreeForces(ParticleState2D *particleState, ParticleNextState2D *particleNextState, double *potential,
+                                const StageUpdate *update)
+{
+  // The error bounded criteria compare against the last |a| of the tree part, which is only the short range
+  // part with TreePM, so they stay on the safe side there. Particles without one fall back to theta.
+  const OpeningCriterion criterion = quadtree.GetOpeningCriterion();
+  const bool errorBounded = criterion==OPENING_SALMON_WARREN || criterion==OPENING_RELATIVE;
+  if (errorBounded)
+    lastAcceleration.resize(particles, 0);
+
+  // Mixed precision walks the tree once per group, the particles left out of the tree follow one by one
+  inGroup.assign(particles, 0);
+  if (quadtree.IsMixedPrecision() && quadtree.GetSplitScale()==0 && quadtree.GetSoftening()>0)
+    CalculateGroupForces(particleState, particleNextState, potential, update, errorBounded);
+
+  // OpenMP parallel calculation, tracers only read the tree
+  #pragma omp parallel
+  {
+    TreeCounters counters;
+    const long long missesStart = Numa::ReadThreadMisses();
+
+    {
+      // Ends after the implicit barrier, so the wait for the slowest thread is visible
+      TRACE_SCOPE("Tree force");
+
+      #pragma omp for schedule(static)
+      for (int i=1; i<particles; ++i)
+      {
+        if (inGroup[i])
+          continue;
+
+        ParticleData2D particle(&particleState[i], &particleParameters[i]);
+        Vector2D accleration = quadtree.CalculateForce(particle, counters, potential ? &potential[i] : NULL,
+                                                       errorBounded ? lastAcceleration[i] : 0);
+        if (errorBounded)
+          lastAcceleration[i] = std::sqrt(accleration.x*accleration.x + accleration.y*accleration.y);
+        particleNextState[i].accelerationX = accleration.x;
+        particleNextState[i].accelerationY = accleration.y;
+        particleNextState[i].velocityX = particleState[i].velocityX;
+        particleNextState[i].velocityY = particleState[i].velocityY;
+        // The rows are still in cache
+        if (update)
+          update->Apply(4*i, 4*i + 4);
+      }
+    }
+
+    metrics.AddThreadCounters(omp_get_thread_num(), counters.interactions, counters.nodesOpened);
+
+    // Every miss of the last level cache is a line moved to the socket of the thread
+    const long long missesEnd = Numa::ReadThreadMisses();
+    if (missesStart>=0 && missesEnd>=0)
+      metrics.AddThreadTraffic(omp_get_thread_num(), Numa::GetCurrentNode(), (missesEnd - missesStart) * Numa::cacheLine);
+  }
+
+  // Particle "0" has statistics data and cannot be calculated parallel. Its row may already be set and updated by
+  // the group walk, which updates the state in place, then the walk only collects the statistics.
+  TRACE_SCOPE("Particle 0 force");
   quadtree.ClearStatistics();
   ParticleData2D particle(&particleState[0], &particleParameters[0]);
-  Vector2D acceleration = quadtree.CalculateForce(particle);
+  TreeCounters counters;
+  double potential0 = 0;
+  Vector2D acceleration = quadtree.CalculateForce(particle, counters, potential ? &potential0 : NULL,
+                                                 errorBounded ? lastAcceleration[0] : 0);
+  if (inGroup[0])
+    return;
+
+  if (errorBounded)
+    lastAcceleration[0] = std::sqrt(acceleration.x*acceleration.x + acceleration.y*acceleration.y);
+  metrics.AddThreadCounters(0, counters.interactions, counters.nodesOpened);
+  if (potential)
+    potential[0] = potential0;
   particleNextState[0].accelerationX = acceleration.x;
   particleNextState[0].accelerationY = acceleration.y;
   particleNextState[0].velocityX = particleState[0].velocityX;
   particleNextState[0].velocityY = particleState[0].velocityY;
+  if (update)
+    update->Apply(0, 4);
+}
+
+void NBody::CalculateGroupForces(ParticleState2D *particleState, ParticleNextState2D *particleNextState, double *potential,
+                                 const StageUpdate *update, bool errorBounded)
+{
+  // Large enough that the walk is shared, small enough that the group criterion opens few extra nodes
+  static const int groupParticles = 32;
+
+  std::vector<const Quadtree*> groups;
+  quadtree.GetGroups(groupParticles, groups);
+
+  #pragma omp parallel
+  {
+    TreeCounters counters;
+    std::vector<ParticleData2D> members;
+    std::vector<double> accelerations, potentials;
+
+    TRACE_SCOPE("Group force");
+
+    #pragma omp for schedule(dynamic, 16)
+    for (int g=0; g<(int)groups.size(); ++g)
+    {
+      members.clear();
+      groups[g]->GetParticles(members);
+
+      // The tolerance has to hold for every member
+      double last = std::numeric_limits<double>::max();
+      for (std::size_t k=0; k<members.size(); ++k)
+        last = std::min(last, errorBounded ? lastAcceleration[members[k].particleState - particleState] : 0);
+
+      accelerations.resize(2*members.size());
+      potentials.resize(members.size());
+      quadtree.CalculateGroupForces(members, last, counters, &accelerations[0], potential ? &potentials[0] : NULL);
+
+      for (std::size_t k=0; k<members.size(); ++k)
+      {
+        const int i = members[k].particleState - particleState;
+        particleNextState[i].accelerationX = accelerations[2*k];
+        particleNextState[i].accelerationY = accelerations[2*k + 1];
+        particleNextState[i].velocityX = particleState[i].velocityX;
+        particleNextState[i].velocityY = particleState[i].velocityY;
+        if (potential)
+          potential[i] = potentials[k];
+        if (errorBounded)
+          lastAcceleration[i] = std::sqrt(accelerations[2*k]*accelerations[2*k] + accelerations[2*k + 1]*accelerations[2*k + 1]);
+        if (update)
+          update->Apply(4*i, 4*i + 4);
+        inGroup[i] = 1;
+      }
+    }
+
+    metrics.AddThreadCounters(omp_get_thread_num(), counters.interactions, counters.nodesOpened);
+  }
+}
+
+void NBody::CalculateTreePMForces(ParticleState2D *particleState, ParticleNextState2D *particleNextState, double *potential)
+{
+  // The mesh covers the root node, the tree only walks the short range part
+  particleMesh.SetDomain(quadtree.GetMinimumDimension(), quadtree.GetMaximumDimension());
+  quadtree.SetShortRange(particleMesh.GetSplitScale(), particleMesh.GetCutoff());
+  CalculateTreeForces(particleState, particleNextState, potential, NULL);
+  quadtree.SetShortRange(0, 0);
+
+  {
+    TRACE_SCOPE("Particle mesh");
+    particleMesh.AddAccelerations(particleState, particleParameters, particles, sources, particleNextState, potential);
+  }
+
+  // Particles that left the area of interest get no long range force, the whole force comes from the tree
+  TRACE_SCOPE("Outside mesh");
+  const OpeningCriterion criterion = quadtree.GetOpeningCriterion();
+  const bool errorBounded = criterion==OPENING_SALMON_WARREN || criterion==OPENING_RELATIVE;
+
+  #pragma omp parallel
+  {
+    TreeCounters counters;
+
+    #pragma omp for schedule(dynamic, 64)
+    for (int i=0; i<particles; ++i)
+    {
+      if (particleMesh.Contains(particleState[i].positionX, particleState[i].positionY))
+        continue;
+
+      ParticleData2D particle(&particleState[i], &particleParameters[i]);
+      Vector2D accleration = quadtree.CalculateForce(particle, counters, potential ? &potential[i] : NULL,
+                                                     errorBounded ? lastAcceleration[i] : 0);
+      if (errorBounded)
+        lastAcceleration[i] = std::sqrt(accleration.x*accleration.x + accleration.y*accleration.y);
+      particleNextState[i].accelerationX = accleration.x;
+      particleNextState[i].accelerationY = accleration.y;
+    }
+
+    metrics.AddThreadCounters(omp_get_thread_num(), counters.interactions, counters.nodesOpened);
+  }
 }
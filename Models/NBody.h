@@ -1,6 +1,10 @@
 #ifndef _NBODY
 #define	_NBODY
 
+// Standard includes
+#include <stdint.h>
+#include <vector>
+
 // Library includes
 #include <jsoncpp/json/json.h>
 
@@ -9,32 +13,119 @@
 #include "../Structs/Vectors.h"
 #include "../Trees/Quadtree.h"
 #include "../Structs/Particles.h"
+#include "../IO/Snapshot.h"
+#include "../Solvers/DirectSummation.h"
+#include "../Solvers/ExternalPotentials.h"
+#include "../Solvers/HermiteSubsystem.h"
+#include "../Solvers/ParticleMesh.h"
+#include "../Utils/Metrics.h"
+#include "../Utils/Diagnostics.h"
 
-class NBody : public IModel
+// Final, so integrators templated on it call EvaluateStage directly
+class NBody final : public IModel
 {
 public:
 
-    NBody(Json::Value config);
+    enum ForceMode
+    {
+      TREE = 0,
+      DIRECT,
+      TREEPM
+    };
+
+    // With shares above 1 generated galaxies hold only the share-th contiguous range of the particle indices, drawn
+    // exactly as in the whole population. Restarts and imports are read whole.
+    NBody(Json::Value config, int share=0, int shares=1);
+    ~NBody();
     void SingleGalaxy();
     void GalaxyCollision();
+    void Restart(const std::string &fileName);
+    void Import(const std::string &fileName, const std::string &format);
     virtual void Evaluate(double *state, double time, double *deriv);
+    virtual void EvaluateStage(double *state, double time, double *deriv, const StageUpdate &update);
+    virtual void EndStep(double *state, double time);
+    void BuiltTree(const ParticleData2D &p);
+    void CalculateForces(ParticleState2D *state, ParticleNextState2D *nextState, double *potential=NULL, double *external=NULL,
+                         const StageUpdate *update=NULL);
     virtual double* GetInitialState();
     Quadtree* GetTree();
     const ParticleParameters* GetParticleParameters() const;
     int GetTotalParticles() const;
+    // Index of particle 0 in the whole population and its size, differ from 0 and GetTotalParticles() with shares
+    int GetFirstParticle() const;
+    int GetGlobalParticles() const;
+    int GetTracersCount() const;
     Vector3D GetMassCenter() const;
     double GetTheta() const;
     void SetTheta(double theta);
+    OpeningCriterion GetOpeningCriterion() const;
+    double GetOpeningAccuracy() const;
+    void SetOpeningCriterion(OpeningCriterion criterion, double accuracy);
+    std::string GetOpeningCriterionName() const;
+    static OpeningCriterion GetOpeningCriterion(const std::string &name);
+    ForceMode GetForceMode() const;
+    void SetForceMode(ForceMode mode);
+    std::string GetForceModeName() const;
+    static ForceMode GetForceMode(const std::string &name);
+    const ParticleMesh& GetParticleMesh() const;
+    // Tree force in single precision with double sums, positions stay in double
+    bool IsMixedPrecision() const;
+    void SetMixedPrecision(bool enabled);
+    // Fixed order reductions, trajectories and diagnostics do not depend on the thread count
+    bool IsDeterministic() const;
+    void SetDeterministic(bool enabled);
+    // "Memory" placement and pinning apply to the whole process, set once before the first model is built
+    static void ConfigureMemory(const Json::Value &config);
+    Metrics& GetMetrics();
+    const ExternalPotentials& GetExternalPotentials() const;
+    const HermiteSubsystem& GetMassiveBodies() const;
+    void RequestDiagnostics();
+    const Diagnostics& GetDiagnostics() const;
+    SnapshotHeader CreateSnapshotHeader() const;
+    const Snapshot& GetSnapshot() const;
 
 private:
 
-    void BuiltTree(const ParticleData2D &p);
-    void GetOrbitalVelocity(const ParticleData2D &p1, const ParticleData2D &p2);
+    NBody(const NBody &ref);
+    NBody& operator=(const NBody &ref);
+
+    // Galaxy parameters parsed once from the config
+    struct GalaxySettings
+    {
+      int particles;
+      int tracers;
+      double positionX;
+      double positionY;
+      double velocityX;
+      double velocityY;
+      double bulgeMass;
+      double bulgeRadius;
+      double diskRadius;
+      double minimumMass;
+      double maximumMass;
+      std::vector<ExternalPotentials::Potential> potentials;
+    };
+
+    static GalaxySettings ParseGalaxySettings(const Json::Value &settings);
+    static ExternalPotentials::Potential ParsePotential(const Json::Value &settings);
+    std::vector<GalaxySettings> ParseGalaxies(const std::string &simulation) const;
+    void AddGalaxyPotentials(const std::vector<GalaxySettings> &galaxies);
+    void GenerateGalaxies(const std::vector<GalaxySettings> &galaxies);
+    void GetOrbitalVelocity(const ParticleData2D &p1, const ParticleData2D &p2, double externalVelocitySquared=0);
     void SimulationSettings(int num);
+    void ComputeAreaOfInterest();
+    void CalculateDirectForces(ParticleState2D *state, ParticleNextState2D *nextState, double *potential, const StageUpdate *update);
+    void CalculateTreeForces(ParticleState2D *state, ParticleNextState2D *nextState, double *potential, const StageUpdate *update);
+    void CalculateGroupForces(ParticleState2D *state, ParticleNextState2D *nextState, double *potential, const StageUpdate *update,
+                              bool errorBounded);
+    void CalculateTreePMForces(ParticleState2D *state, ParticleNextState2D *nextState, double *potential);
+    void UpdateMassiveBodies(ParticleState2D *state, double time);
+    void AddMassiveBodiesForces(ParticleState2D *state, ParticleNextState2D *nextState, double *potential);
 
     ParticleState2D *particleState;
     ParticleParameters *particleParameters;
     Json::Value configuration;
+    Snapshot snapshot;
     Quadtree quadtree;
     Vector2D cornerNW;
     Vector2D cornerSE;
@@ -46,6 +137,30 @@ private:
     const double gravitationalConstant;
     const double g;
     int particles;
+    int sources;        // particles before the massless tracers, the only ones in the tree
+    int share;
+    int shares;
+    int firstParticle;
+    int globalParticles;
+    uint64_t seed;
+    ForceMode forceMode;
+    DirectSummation directSummation;
+    ParticleMesh particleMesh;
+    ExternalPotentials externalPotentials;
+    HermiteSubsystem massiveBodies;
+    double massiveBodyMass;             // bodies from this mass up leave the tree, 0 disables them
+    std::vector<char> isMassiveBody;
+    std::vector<double> accelerationX;
+    std::vector<double> accelerationY;
+    std::vector<double> lastAcceleration;   // |a| of the last tree force, read by the error bounded opening criteria
+    std::vector<char> inGroup;              // rows already set by the mixed precision group walk
+    Metrics metrics;
+    Diagnostics diagnostics;
+    std::vector<double> particlePotential;
+    std::vector<double> externalPotential;
+    bool diagnosticsRequested;
+    bool deterministic;
+    bool massiveBodiesWarned;
 };
 
 #endif
@@ -0,0 +1,95 @@
+// Standard includes
+#include <cmath>
+#include <algorithm>
+
+// Project includes
+#include "DirectSummation.h"
+
+// Block of targets kept in registers/L1 while a tile of sources is streamed from L2
+const int DirectSummation::targetBlock = 64;
+const int DirectSummation::sourceTile = 1024;
+
+DirectSummation::DirectSummation(double G, double eps)
+  :sourceX()
+  ,sourceY()
+  ,sourceMass()
+  ,gravitationalConstant(G)
+  ,softening(eps)
+{}
+
+void DirectSummation::SetSoftening(double newSoftening)
+{
+  softening = newSoftening;
+}
+
+void DirectSummation::CalculateAccelerations(const ParticleState2D *state,
+                                             const ParticleParameters *parameters,
+                                             int particles,
+                                             int sources,
+                                             double *accelerationX,
+                                             double *accelerationY,
+                                             double *potential)
+{
+  sourceX.resize(sources);
+  sourceY.resize(sources);
+  sourceMass.resize(sources);
+
+  #pragma omp parallel for schedule(static)
+  for (int j=0; j<sources; ++j)
+  {
+    sourceX[j] = state[j].positionX;
+    sourceY[j] = state[j].positionY;
+    sourceMass[j] = gravitationalConstant * parameters[j].mass;
+  }
+
+  const double *x = &sourceX[0], *y = &sourceY[0], *m = &sourceMass[0];
+  const double eps = softening;
+  const int blocks = (particles + targetBlock - 1) / targetBlock;
+
+  #pragma omp parallel for schedule(static)
+  for (int b=0; b<blocks; ++b)
+  {
+    const int begin = b*targetBlock, end = std::min(begin + targetBlock, particles);
+    double ax[targetBlock] = {0}, ay[targetBlock] = {0}, phi[targetBlock] = {0};
+
+    for (int tile=0; tile<sources; tile+=sourceTile)
+    {
+      const int tileEnd = std::min(tile + sourceTile, sources);
+
+      for (int i=begin; i<end; ++i)
+      {
+        const double xi = state[i].positionX, yi = state[i].positionY;
+        double sumX = 0, sumY = 0, sumPhi = 0;
+
+        // The particle itself adds nothing to the force, its distance vector is zero
+        #pragma omp simd reduction(+:sumX,sumY,sumPhi)
+        for (int j=tile; j<tileEnd; ++j)
+        {
+          double dx = x[j] - xi, dy = y[j] - yi;
+          double r2 = dx*dx + dy*dy + eps;
+          double k = m[j] / (r2 * std::sqrt(r2));
+          sumX += k * dx;
+          sumY += k * dy;
+          sumPhi += k * r2;
+        }
+
+        ax[i-begin] += sumX;
+        ay[i-begin] += sumY;
+        phi[i-begin] += sumPhi;
+      }
+    }
+
+    for (int i=begin; i<end; ++i)
+    {
+      accelerationX[i] = ax[i-begin];
+      accelerationY[i] = ay[i-begin];
+    }
+
+    // The softened self term of a source is taken out of the potential
+    if (potential)
+    {
+      for (int i=begin; i<end; ++i)
+        potential[i] = -(phi[i-begin] - ((i<sources) ? m[i] / std::sqrt(eps) : 0));
+    }
+  }
+}
@@ -0,0 +1,44 @@
+#ifndef _DIRECTSUMMATION
+#define _DIRECTSUMMATION
+
+// Standard includes
+#include <vector>
+#include <cstddef>
+
+// Project includes
+#include "../Structs/Particles.h"
+
+class DirectSummation
+{
+public:
+
+  DirectSummation(double gravitationalConstant, double softening);
+
+  void SetSoftening(double newSoftening);
+
+  // O(N^2) reference accelerations, softened the same way as the tree force,
+  // and the potential per unit mass of every particle when potential is not NULL.
+  // Only the first sources particles attract, the rest are massless tracers.
+  void CalculateAccelerations(const ParticleState2D *state,
+                              const ParticleParameters *parameters,
+                              int particles,
+                              int sources,
+                              double *accelerationX,
+                              double *accelerationY,
+                              double *potential=NULL);
+
+private:
+
+  // Sources are copied to separate arrays so the inner loop vectorizes
+  std::vector<double> sourceX;
+  std::vector<double> sourceY;
+  std::vector<double> sourceMass;
+
+  double gravitationalConstant;
+  double softening;
+
+  static const int targetBlock;
+  static const int sourceTile;
+};
+
+#endif
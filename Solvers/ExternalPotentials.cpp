@@ -0,0 +1,234 @@
+// Standard includes
+#include <cmath>
+#include <stdexcept>
+
+// Project includes
+#include "ExternalPotentials.h"
+
+namespace
+{
+  // Every profile gives k = |g|/r and the potential for a softened squared distance,
+  // so the acceleration is k times the vector to the centre
+
+  struct PlummerProfile
+  {
+    PlummerProfile(double gm, double a2) : gm(gm), a2(a2) {}
+
+    void Evaluate(double r2, double &k, double &phi) const
+    {
+      double inverse = 1 / std::sqrt(r2 + a2);
+      phi = -gm * inverse;
+      k = gm * inverse*inverse*inverse;
+    }
+
+    double gm, a2;
+  };
+
+  struct HernquistProfile
+  {
+    HernquistProfile(double gm, double a) : gm(gm), a(a) {}
+
+    void Evaluate(double r2, double &k, double &phi) const
+    {
+      double r = std::sqrt(r2), inverse = 1 / (r + a);
+      phi = -gm * inverse;
+      k = gm * inverse*inverse / r;
+    }
+
+    double gm, a;
+  };
+
+  struct NFWProfile
+  {
+    NFWProfile(double gm, double a) : gm(gm), a(a) {}
+
+    void Evaluate(double r2, double &k, double &phi) const
+    {
+      double r = std::sqrt(r2), x = r / a, logarithm = std::log(1 + x);
+      phi = -gm * logarithm / r;
+      k = gm * (logarithm - x / (1 + x)) / (r2 * r);
+    }
+
+    double gm, a;
+  };
+
+  template<class Profile>
+  void AddProfile(const Profile &profile,
+                  double centerX,
+                  double centerY,
+                  double softening,
+                  const ParticleState2D *state,
+                  int particles,
+                  ParticleNextState2D *nextState,
+                  double *potential)
+  {
+    #pragma omp parallel for simd schedule(static)
+    for (int i=0; i<particles; ++i)
+    {
+      double dx = centerX - state[i].positionX, dy = centerY - state[i].positionY, k, phi;
+      profile.Evaluate(dx*dx + dy*dy + softening, k, phi);
+
+      nextState[i].accelerationX += k * dx;
+      nextState[i].accelerationY += k * dy;
+      if (potential)
+        potential[i] += phi;
+    }
+  }
+
+  template<class Profile>
+  double CircularVelocitySquared(const Profile &profile, double r, double softening)
+  {
+    double k, phi;
+    profile.Evaluate(r*r + softening, k, phi);
+    return k * r*r;
+  }
+}
+
+ExternalPotentials::Potential::Potential()
+  :type(PLUMMER)
+  ,mass(0)
+  ,scaleRadius(1)
+  ,scaleHeight(0)
+  ,centerX(0)
+  ,centerY(0)
+  ,anchor(-1)
+{}
+
+ExternalPotentials::ExternalPotentials(double G, double eps)
+  :potentials()
+  ,gravitationalConstant(G)
+  ,softening(eps)
+{}
+
+void ExternalPotentials::SetSoftening(double newSoftening)
+{
+  softening = newSoftening;
+}
+
+ExternalPotentials::Type ExternalPotentials::GetType(const std::string &name)
+{
+  if (name=="NFW")
+    return NFW;
+  if (name=="Hernquist")
+    return HERNQUIST;
+  if (name=="Plummer")
+    return PLUMMER;
+  if (name=="Miyamoto-Nagai")
+    return MIYAMOTO_NAGAI;
+
+  throw std::runtime_error("Unknown potential type '" + name + "'.");
+}
+
+void ExternalPotentials::Add(const Potential &potential)
+{
+  if (potential.scaleRadius<=0 && potential.type!=MIYAMOTO_NAGAI)
+    throw std::runtime_error("Potential scale radius must be positive.");
+
+  potentials.push_back(potential);
+}
+
+void ExternalPotentials::Clear()
+{
+  potentials.clear();
+}
+
+bool ExternalPotentials::IsEmpty() const
+{
+  return potentials.empty();
+}
+
+std::size_t ExternalPotentials::GetCount() const
+{
+  return potentials.size();
+}
+
+const ExternalPotentials::Potential& ExternalPotentials::GetPotential(std::size_t index) const
+{
+  return potentials[index];
+}
+
+void ExternalPotentials::AddAccelerations(const ParticleState2D *state,
+                                          int particles,
+                                          ParticleNextState2D *nextState,
+                                          double *potential) const
+{
+  if (potential)
+  {
+    #pragma omp parallel for schedule(static)
+    for (int i=0; i<particles; ++i)
+      potential[i] = 0;
+  }
+
+  for (std::size_t p=0; p<potentials.size(); ++p)
+  {
+    const Potential &halo = potentials[p];
+    const double gm = gravitationalConstant * halo.mass;
+
+    // The anchor sits in the centre of its own potentials and feels no force from them
+    double centerX = halo.centerX, centerY = halo.centerY;
+    if (halo.anchor>=0 && halo.anchor<particles)
+    {
+      centerX = state[halo.anchor].positionX;
+      centerY = state[halo.anchor].positionY;
+    }
+
+    switch (halo.type)
+    {
+    case NFW:
+      AddProfile(NFWProfile(gm, halo.scaleRadius), centerX, centerY, softening, state, particles, nextState, potential);
+      break;
+
+    case HERNQUIST:
+      AddProfile(HernquistProfile(gm, halo.scaleRadius), centerX, centerY, softening, state, particles, nextState, potential);
+      break;
+
+    case PLUMMER:
+      AddProfile(PlummerProfile(gm, halo.scaleRadius*halo.scaleRadius), centerX, centerY, softening, state, particles, nextState, potential);
+      break;
+
+    case MIYAMOTO_NAGAI:
+    {
+      double scale = halo.scaleRadius + halo.scaleHeight;
+      AddProfile(PlummerProfile(gm, scale*scale), centerX, centerY, softening, state, particles, nextState, potential);
+      break;
+    }
+    }
+  }
+}
+
+double ExternalPotentials::GetCircularVelocitySquared(int anchor, double r) const
+{
+  double velocitySquared = 0;
+
+  for (std::size_t p=0; p<potentials.size(); ++p)
+  {
+    const Potential &halo = potentials[p];
+    if (halo.anchor!=anchor)
+      continue;
+
+    const double gm = gravitationalConstant * halo.mass;
+    switch (halo.type)
+    {
+    case NFW:
+      velocitySquared += CircularVelocitySquared(NFWProfile(gm, halo.scaleRadius), r, softening);
+      break;
+
+    case HERNQUIST:
+      velocitySquared += CircularVelocitySquared(HernquistProfile(gm, halo.scaleRadius), r, softening);
+      break;
+
+    case PLUMMER:
+      velocitySquared += CircularVelocitySquared(PlummerProfile(gm, halo.scaleRadius*halo.scaleRadius), r, softening);
+      break;
+
+    case MIYAMOTO_NAGAI:
+    {
+      double scale = halo.scaleRadius + halo.scaleHeight;
+      velocitySquared += CircularVelocitySquared(PlummerProfile(gm, scale*scale), r, softening);
+      break;
+    }
+    }
+  }
+
+  return velocitySquared;
+}
@@ -0,0 +1,67 @@
+#ifndef _EXTERNALPOTENTIALS
+#define _EXTERNALPOTENTIALS
+
+// Standard includes
+#include <vector>
+#include <string>
+#include <cstddef>
+
+// Project includes
+#include "../Structs/Particles.h"
+
+// Analytic potentials (dark matter halos, bulges) evaluated in the plane z=0,
+// softened the same way as the tree force
+class ExternalPotentials
+{
+public:
+
+  enum Type
+  {
+    NFW = 0,          // -G M ln(1 + r/a) / r, M is the characteristic mass 4 pi rho0 a^3
+    HERNQUIST,        // -G M / (r + a)
+    PLUMMER,          // -G M / sqrt(r^2 + a^2)
+    MIYAMOTO_NAGAI    // -G M / sqrt(R^2 + (a + sqrt(z^2 + b^2))^2), at z=0
+  };
+
+  struct Potential
+  {
+    Potential();
+
+    Type type;
+    double mass;          // solar masses
+    double scaleRadius;   // a, parsecs
+    double scaleHeight;   // b, parsecs (Miyamoto-Nagai only)
+    double centerX;       // fixed centre when there is no anchor
+    double centerY;
+    int anchor;           // particle carrying the centre, -1 for a fixed centre
+  };
+
+  ExternalPotentials(double gravitationalConstant, double softening);
+
+  void SetSoftening(double newSoftening);
+
+  void Add(const Potential &potential);
+  void Clear();
+  bool IsEmpty() const;
+  std::size_t GetCount() const;
+  const Potential& GetPotential(std::size_t index) const;
+
+  // Adds the accelerations of all potentials and sets the potential per unit mass when not NULL
+  void AddAccelerations(const ParticleState2D *state,
+                        int particles,
+                        ParticleNextState2D *nextState,
+                        double *potential=NULL) const;
+
+  // v^2 of a circular orbit at distance r from the anchor, from the potentials it carries
+  double GetCircularVelocitySquared(int anchor, double r) const;
+
+  static Type GetType(const std::string &name);
+
+private:
+
+  std::vector<Potential> potentials;
+  double gravitationalConstant;
+  double softening;
+};
+
+#endif
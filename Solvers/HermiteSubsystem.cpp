@@ -0,0 +1,258 @@
+// Standard includes
+#include <cmath>
+#include <limits>
+#include <algorithm>
+
+// Project includes
+#include "HermiteSubsystem.h"
+
+HermiteSubsystem::HermiteSubsystem(double G, double eps, double eta)
+  :indices()
+  ,bodies()
+  ,predicted()
+  ,gravitationalConstant(G)
+  ,softening(eps)
+  ,accuracy(eta)
+  ,time(0)
+  ,externalTime(0)
+  ,substeps(0)
+  ,initialized(false)
+{}
+
+void HermiteSubsystem::SetSoftening(double newSoftening)
+{
+  softening = newSoftening;
+}
+
+void HermiteSubsystem::Initialize(const std::vector<int> &bodyIndices,
+                                  const ParticleState2D *state,
+                                  const ParticleParameters *parameters,
+                                  double startTime)
+{
+  indices = bodyIndices;
+  bodies.resize(indices.size());
+
+  for (std::size_t i=0; i<indices.size(); ++i)
+  {
+    Body &body = bodies[i];
+    body.positionX = state[indices[i]].positionX;
+    body.positionY = state[indices[i]].positionY;
+    body.velocityX = state[indices[i]].velocityX;
+    body.velocityY = state[indices[i]].velocityY;
+    body.externalX = body.externalY = body.externalJerkX = body.externalJerkY = 0;
+    body.mass = parameters[indices[i]].mass;
+  }
+
+  time = externalTime = startTime;
+  CalculateForces(bodies, time);
+  initialized = true;
+}
+
+void HermiteSubsystem::Reset()
+{
+  initialized = false;
+}
+
+bool HermiteSubsystem::IsInitialized() const
+{
+  return initialized;
+}
+
+const std::vector<int>& HermiteSubsystem::GetIndices() const
+{
+  return indices;
+}
+
+double HermiteSubsystem::GetTime() const
+{
+  return time;
+}
+
+unsigned long long HermiteSubsystem::GetSubsteps() const
+{
+  return substeps;
+}
+
+void HermiteSubsystem::SetExternalAcceleration(std::size_t body, double accelerationX, double accelerationY)
+{
+  Body &b = bodies[body];
+
+  // The slope from the previous request, repeated requests at the same time only update the value
+  if (time!=externalTime)
+  {
+    b.externalJerkX = (accelerationX - b.externalX) / (time - externalTime);
+    b.externalJerkY = (accelerationY - b.externalY) / (time - externalTime);
+  }
+
+  b.externalX = accelerationX;
+  b.externalY = accelerationY;
+
+  if (body+1==bodies.size())
+  {
+    externalTime = time;
+
+    // Internal and external parts of the acceleration are kept together
+    CalculateForces(bodies, time);
+  }
+}
+
+void HermiteSubsystem::CalculateForces(std::vector<Body> &system, double atTime) const
+{
+  // Few bodies, plain pairwise summation of accelerations and their time derivatives
+  for (std::size_t i=0; i<system.size(); ++i)
+  {
+    Body &bi = system[i];
+    const double dt = atTime - externalTime;
+    bi.accelerationX = bi.externalX + bi.externalJerkX*dt;
+    bi.accelerationY = bi.externalY + bi.externalJerkY*dt;
+    bi.jerkX = bi.externalJerkX;
+    bi.jerkY = bi.externalJerkY;
+
+    for (std::size_t j=0; j<system.size(); ++j)
+    {
+      if (i==j)
+        continue;
+
+      const Body &bj = system[j];
+      double dx = bj.positionX - bi.positionX, dy = bj.positionY - bi.positionY,
+             dvx = bj.velocityX - bi.velocityX, dvy = bj.velocityY - bi.velocityY;
+      double r2 = dx*dx + dy*dy + softening;
+      double k = gravitationalConstant * bj.mass / (r2 * std::sqrt(r2));
+      double rv = 3 * (dx*dvx + dy*dvy) / r2;
+
+      bi.accelerationX += k * dx;
+      bi.accelerationY += k * dy;
+      bi.jerkX += k * (dvx - rv*dx);
+      bi.jerkY += k * (dvy - rv*dy);
+    }
+  }
+}
+
+double HermiteSubsystem::GetSubstep() const
+{
+  // Shared step from the shortest |a|/|j| time scale of the bodies
+  double step = std::numeric_limits<double>::max();
+  for (std::size_t i=0; i<bodies.size(); ++i)
+  {
+    double a2 = bodies[i].accelerationX*bodies[i].accelerationX + bodies[i].accelerationY*bodies[i].accelerationY,
+           j2 = bodies[i].jerkX*bodies[i].jerkX + bodies[i].jerkY*bodies[i].jerkY;
+    if (j2>0)
+      step = std::min(step, accuracy * std::sqrt(a2 / j2));
+  }
+
+  return step;
+}
+
+void HermiteSubsystem::AdvanceTo(double targetTime)
+{
+  if (!initialized)
+    return;
+
+  // Runs backwards as well when the time step was reversed
+  const double direction = (targetTime<time) ? -1 : 1;
+  const double minimumStep = 1e-9 * std::max(std::fabs(targetTime - time), std::fabs(time));
+
+  while ((targetTime - time) * direction > 0)
+  {
+    double dt = std::min(GetSubstep(), std::fabs(targetTime - time));
+    dt = std::max(dt, minimumStep) * direction;
+    double dt2 = dt*dt, dt3 = dt2*dt;
+
+    // Predict
+    predicted = bodies;
+    for (std::size_t i=0; i<predicted.size(); ++i)
+    {
+      const Body &b = bodies[i];
+      predicted[i].positionX = b.positionX + b.velocityX*dt + b.accelerationX*dt2/2 + b.jerkX*dt3/6;
+      predicted[i].positionY = b.positionY + b.velocityY*dt + b.accelerationY*dt2/2 + b.jerkY*dt3/6;
+      predicted[i].velocityX = b.velocityX + b.accelerationX*dt + b.jerkX*dt2/2;
+      predicted[i].velocityY = b.velocityY + b.accelerationY*dt + b.jerkY*dt2/2;
+    }
+
+    // Evaluate and correct
+    CalculateForces(predicted, time + dt);
+    for (std::size_t i=0; i<bodies.size(); ++i)
+    {
+      Body &b = bodies[i];
+      const Body &p = predicted[i];
+
+      double velocityX = b.velocityX + (b.accelerationX + p.accelerationX)*dt/2 + (b.jerkX - p.jerkX)*dt2/12,
+             velocityY = b.velocityY + (b.accelerationY + p.accelerationY)*dt/2 + (b.jerkY - p.jerkY)*dt2/12;
+      b.positionX += (b.velocityX + velocityX)*dt/2 + (b.accelerationX - p.accelerationX)*dt2/12;
+      b.positionY += (b.velocityY + velocityY)*dt/2 + (b.accelerationY - p.accelerationY)*dt2/12;
+      b.velocityX = velocityX;
+      b.velocityY = velocityY;
+    }
+
+    CalculateForces(bodies, time + dt);
+
+    // The last substep ends exactly on the target
+    time = ((targetTime - (time + dt)) * direction <= 0) ? targetTime : time + dt;
+    ++substeps;
+  }
+}
+
+void HermiteSubsystem::CopyState(ParticleState2D *state) const
+{
+  for (std::size_t i=0; i<indices.size(); ++i)
+  {
+    ParticleState2D &s = state[indices[i]];
+    s.positionX = bodies[i].positionX;
+    s.positionY = bodies[i].positionY;
+    s.velocityX = bodies[i].velocityX;
+    s.velocityY = bodies[i].velocityY;
+  }
+}
+
+void HermiteSubsystem::AddAccelerations(const ParticleState2D *state,
+                                        const char *members,
+                                        int particles,
+                                        ParticleNextState2D *nextState,
+                                        double *potential) const
+{
+  const int count = (int)bodies.size();
+  const Body *b = bodies.empty() ? NULL : &bodies[0];
+
+  #pragma omp parallel for schedule(static)
+  for (int i=0; i<particles; ++i)
+  {
+    const double x = state[i].positionX, y = state[i].positionY;
+    double sumX = 0, sumY = 0, sumPhi = 0;
+
+    #pragma omp simd reduction(+:sumX,sumY,sumPhi)
+    for (int k=0; k<count; ++k)
+    {
+      double dx = b[k].positionX - x, dy = b[k].positionY - y;
+      double r2 = dx*dx + dy*dy + softening;
+      double inverse = 1 / std::sqrt(r2), gm = gravitationalConstant * b[k].mass;
+      double kr = gm * inverse*inverse*inverse;
+      sumX += kr * dx;
+      sumY += kr * dy;
+      sumPhi -= gm * inverse;
+    }
+
+    if (!members[i])
+    {
+      nextState[i].accelerationX += sumX;
+      nextState[i].accelerationY += sumY;
+      if (potential)
+        potential[i] += sumPhi;
+    }
+  }
+
+  // Members feel each other in the subsystem only, but their potential is still needed
+  if (potential)
+  {
+    for (int i=0; i<count; ++i)
+    {
+      for (int k=0; k<count; ++k)
+      {
+        if (i==k)
+          continue;
+
+        double dx = b[k].positionX - b[i].positionX, dy = b[k].positionY - b[i].positionY;
+        potential[indices[i]] -= gravitationalConstant * b[k].mass / std::sqrt(dx*dx + dy*dy + softening);
+      }
+    }
+  }
+}
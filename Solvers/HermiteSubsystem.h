@@ -0,0 +1,79 @@
+#ifndef _HERMITESUBSYSTEM
+#define _HERMITESUBSYSTEM
+
+// Standard includes
+#include <vector>
+#include <cstddef>
+
+// Project includes
+#include "../Structs/Particles.h"
+
+// Few massive bodies (galaxy bulges) integrated apart from the rest with a 4th order
+// Hermite predictor-corrector and direct summation between them. They move in shared
+// adaptive substeps to whatever time the global integrator asks for, the force of the
+// light particles on them is extrapolated linearly from the last two requests.
+class HermiteSubsystem
+{
+public:
+
+  HermiteSubsystem(double gravitationalConstant, double softening, double accuracy);
+
+  void SetSoftening(double newSoftening);
+
+  // Takes the given particles from the state, at the given time
+  void Initialize(const std::vector<int> &indices,
+                  const ParticleState2D *state,
+                  const ParticleParameters *parameters,
+                  double time);
+  void Reset();
+  bool IsInitialized() const;
+
+  const std::vector<int>& GetIndices() const;
+  double GetTime() const;
+  unsigned long long GetSubsteps() const;
+
+  void AdvanceTo(double time);
+
+  // Writes positions and velocities of the bodies to their rows
+  void CopyState(ParticleState2D *state) const;
+
+  // Force of the light particles on the body at the current time, body is its index in GetIndices()
+  void SetExternalAcceleration(std::size_t body, double accelerationX, double accelerationY);
+
+  // Adds the attraction of the bodies to all particles not flagged as members and, when
+  // not NULL, their share of the potential per unit mass of every particle
+  void AddAccelerations(const ParticleState2D *state,
+                        const char *members,
+                        int particles,
+                        ParticleNextState2D *nextState,
+                        double *potential) const;
+
+private:
+
+  struct Body
+  {
+    double positionX, positionY;
+    double velocityX, velocityY;
+    double accelerationX, accelerationY;  // with the external part, as the jerk
+    double jerkX, jerkY;
+    double externalX, externalY;          // at externalTime
+    double externalJerkX, externalJerkY;
+    double mass;
+  };
+
+  void CalculateForces(std::vector<Body> &bodies, double time) const;
+  double GetSubstep() const;
+
+  std::vector<int> indices;
+  std::vector<Body> bodies;
+  std::vector<Body> predicted;
+  double gravitationalConstant;
+  double softening;
+  double accuracy;
+  double time;
+  double externalTime;
+  unsigned long long substeps;
+  bool initialized;
+};
+
+#endif
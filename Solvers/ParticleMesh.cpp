@@ -0,0 +1,336 @@
+// Standard includes
+#include <cmath>
+#include <algorithm>
+#include <stdexcept>
+#include <omp.h>
+
+// Project includes
+#include "ParticleMesh.h"
+
+namespace
+{
+  // Chunks of a deterministic mass assignment, the parallelism it allows
+  const int deterministicChunks = 32;
+}
+
+ParticleMesh::ParticleMesh(double G, int size, double split, double cutoff)
+  :gravitationalConstant(G)
+  ,gridSize(size)
+  ,paddedSize(2*size)
+  ,splitCells(split)
+  ,cutoffScales(cutoff)
+  ,origin()
+  ,cellSize(0)
+  ,greensCellSize(0)
+  ,deterministic(false)
+  ,fft(2*size)
+  ,greensFunction()
+  ,forceFunction()
+  ,grid()
+  ,forces()
+  ,threadMasses()
+  ,gridPotential()
+  ,gridAccelerationX()
+  ,gridAccelerationY()
+{
+  if (splitCells<=0 || cutoffScales<=0)
+    throw std::runtime_error("TreePM split scale and cutoff must be positive.");
+  if (gridSize<4)
+    throw std::runtime_error("TreePM grid size must be at least 4.");
+}
+
+void ParticleMesh::SetDomain(const Vector2D &min, const Vector2D &max)
+{
+  // The cloud-in-cell weights need the cell centres on both sides of a particle
+  cellSize = std::max(max.x - min.x, max.y - min.y) / (gridSize - 2);
+  origin = Vector2D(min.x - cellSize, min.y - cellSize);
+
+  if (cellSize!=greensCellSize)
+    ComputeGreensFunction();
+}
+
+bool ParticleMesh::Contains(double x, double y) const
+{
+  int i, j;
+  double wx, wy;
+  return GetWeights(x, y, i, j, wx, wy);
+}
+
+int ParticleMesh::GetGridSize() const
+{
+  return gridSize;
+}
+
+double ParticleMesh::GetCellSize() const
+{
+  return cellSize;
+}
+
+double ParticleMesh::GetSplitScale() const
+{
+  return splitCells * cellSize;
+}
+
+double ParticleMesh::GetCutoff() const
+{
+  return cutoffScales * GetSplitScale();
+}
+
+void ParticleMesh::SetDeterministic(bool enabled)
+{
+  deterministic = enabled;
+}
+
+void ParticleMesh::ComputeGreensFunction()
+{
+  const int M = paddedSize;
+  const double rs = GetSplitScale(), G = gravitationalConstant;
+  greensFunction.resize((std::size_t)M * M);
+  forceFunction.resize((std::size_t)M * M);
+
+  // Distances wrap around the padded grid, the other half only ever meets the zero padding. The force kernel is the
+  // exact gradient of erf(r/2rs)/r, its x and y parts go into the real and imaginary parts of one transform.
+  #pragma omp parallel for schedule(static)
+  for (int i=0; i<M; ++i)
+  {
+    const double dy = ((i<=M/2) ? i : i - M) * cellSize;
+    for (int j=0; j<M; ++j)
+    {
+      const double dx = ((j<=M/2) ? j : j - M) * cellSize;
+      const double r = std::sqrt(dx*dx + dy*dy), u = r / (2*rs);
+      const std::size_t c = (std::size_t)i * M + j;
+
+      if (r>0)
+      {
+        const double phi = std::erf(u) / r;
+        const double slope = (2 / std::sqrt(M_PI) * std::exp(-u*u) * u - std::erf(u)) / (r * r);
+        greensFunction[c] = -G * phi;
+        // Half way around the padded grid the direction is undefined, no pair of cells is that far apart
+        forceFunction[c] = (i==M/2 || j==M/2) ? 0 : G * slope / r * std::complex<double>(dx, dy);
+      }
+      else
+      {
+        greensFunction[c] = -G / (std::sqrt(M_PI) * rs);
+        forceFunction[c] = 0;
+      }
+    }
+  }
+
+  fft.Forward(greensFunction);
+  fft.Forward(forceFunction);
+
+  // Mass assignment and interpolation each smooth with the cloud-in-cell window W(k) = sinc^2(kx h/2) sinc^2(ky h/2),
+  // dividing the force kernel by W^2 undoes both. The Gaussian of the split has cut the kernel off long before W gets
+  // small. The potential keeps the plain kernel, the self energy correction assumes it.
+  std::vector<double> window(M);
+  for (int i=0; i<M; ++i)
+  {
+    const double x = M_PI * std::min(i, M - i) / M;
+    const double sinc = (x>0) ? std::sin(x) / x : 1;
+    window[i] = sinc * sinc;
+  }
+
+  #pragma omp parallel for schedule(static)
+  for (int i=0; i<M; ++i)
+  {
+    for (int j=0; j<M; ++j)
+    {
+      const double w = window[i] * window[j];
+      forceFunction[(std::size_t)i * M + j] /= w * w;
+    }
+  }
+
+  greensCellSize = cellSize;
+}
+
+bool ParticleMesh::GetWeights(double x, double y, int &i, int &j, double &wx, double &wy) const
+{
+  // Cell centres are at (index + 0.5) cells from the origin
+  const double gx = (x - origin.x) / cellSize - 0.5,
+               gy = (y - origin.y) / cellSize - 0.5;
+  if (!(gx>=0 && gy>=0 && gx<gridSize - 1 && gy<gridSize - 1))
+    return false;
+
+  j = (int)gx;
+  i = (int)gy;
+  wx = gx - j;
+  wy = gy - i;
+  return true;
+}
+
+void ParticleMesh::DepositMasses(const ParticleState2D *state, const ParticleParameters *parameters, int begin, int end,
+                                 std::vector<double> &masses) const
+{
+  for (int p=begin; p<end; ++p)
+  {
+    int i, j;
+    double wx, wy;
+    if (!GetWeights(state[p].positionX, state[p].positionY, i, j, wx, wy))
+      continue;
+
+    const double m = parameters[p].mass;
+    double *cell = &masses[(std::size_t)i * gridSize + j];
+    cell[0] += m * (1 - wx) * (1 - wy);
+    cell[1] += m * wx * (1 - wy);
+    cell[gridSize] += m * (1 - wx) * wy;
+    cell[gridSize + 1] += m * wx * wy;
+  }
+}
+
+void ParticleMesh::AssignMasses(const ParticleState2D *state, const ParticleParameters *parameters, int sources)
+{
+  const std::size_t cells = (std::size_t)gridSize * gridSize;
+  int threads = 1;
+
+  if (deterministic)
+  {
+    // Chunk c always holds the same particles in the same order
+    threads = deterministicChunks;
+    threadMasses.resize(threads);
+
+    #pragma omp parallel for schedule(dynamic, 1)
+    for (int c=0; c<threads; ++c)
+    {
+      threadMasses[c].assign(cells, 0);
+      DepositMasses(state, parameters, (int)((long long)sources * c / threads),
+                    (int)((long long)sources * (c + 1) / threads), threadMasses[c]);
+    }
+  }
+  else
+  {
+    threadMasses.resize(omp_get_max_threads());
+
+    // Every thread deposits into a grid of its own, they are summed afterwards
+    #pragma omp parallel
+    {
+      std::vector<double> &masses = threadMasses[omp_get_thread_num()];
+      masses.assign(cells, 0);
+
+      #pragma omp single
+      threads = omp_get_num_threads();
+
+      const int count = omp_get_num_threads(), thread = omp_get_thread_num();
+      DepositMasses(state, parameters, (int)((long long)sources * thread / count),
+                    (int)((long long)sources * (thread + 1) / count), masses);
+    }
+  }
+
+  const int M = paddedSize;
+  grid.resize((std::size_t)M * M);
+
+  #pragma omp parallel for schedule(static)
+  for (int i=0; i<M; ++i)
+  {
+    for (int j=0; j<M; ++j)
+    {
+      double mass = 0;
+      if (i<gridSize && j<gridSize)
+      {
+        for (int t=0; t<threads; ++t)
+          mass += threadMasses[t][(std::size_t)i * gridSize + j];
+      }
+      grid[(std::size_t)i * M + j] = mass;
+    }
+  }
+}
+
+void ParticleMesh::ComputeGridAccelerations()
+{
+  const int M = paddedSize, N = gridSize;
+  const std::size_t cells = (std::size_t)M * M;
+  forces.resize(cells);
+  gridAccelerationX.resize((std::size_t)N * N);
+  gridAccelerationY.resize((std::size_t)N * N);
+
+  // Both components are real, one inverse transform gives x as the real and y as the imaginary part
+  #pragma omp parallel for schedule(static)
+  for (long long c=0; c<(long long)cells; ++c)
+    forces[c] = grid[c] * forceFunction[c];
+
+  fft.Inverse(forces);
+
+  #pragma omp parallel for schedule(static)
+  for (int i=0; i<N; ++i)
+  {
+    for (int j=0; j<N; ++j)
+    {
+      const std::complex<double> &a = forces[(std::size_t)i * M + j];
+      gridAccelerationX[(std::size_t)i * N + j] = a.real();
+      gridAccelerationY[(std::size_t)i * N + j] = a.imag();
+    }
+  }
+}
+
+void ParticleMesh::ComputeGridPotential()
+{
+  const int M = paddedSize;
+  const std::size_t cells = (std::size_t)M * M;
+  gridPotential.resize(cells);
+
+  #pragma omp parallel for schedule(static)
+  for (long long c=0; c<(long long)cells; ++c)
+    grid[c] *= greensFunction[c];
+
+  fft.Inverse(grid);
+
+  #pragma omp parallel for schedule(static)
+  for (long long c=0; c<(long long)cells; ++c)
+    gridPotential[c] = grid[c].real();
+}
+
+void ParticleMesh::AddAccelerations(const ParticleState2D *state,
+                                    const ParticleParameters *parameters,
+                                    int particles,
+                                    int sources,
+                                    ParticleNextState2D *nextState,
+                                    double *potential)
+{
+  AssignMasses(state, parameters, sources);
+
+  // The isolated fields are cyclic convolutions of the padded grid, the potential is only needed for diagnostics
+  fft.Forward(grid);
+  ComputeGridAccelerations();
+  if (potential)
+    ComputeGridPotential();
+
+  // Interpolation back to the particles uses the same cloud-in-cell weights
+  const int N = gridSize, M = paddedSize;
+
+  // Kernel between the cells a particle deposits to and reads from, at offsets 0, 1 and sqrt(2) cells
+  const double rs = GetSplitScale(), h = cellSize;
+  const double kernel0 = -gravitationalConstant / (std::sqrt(M_PI) * rs),
+               kernel1 = -gravitationalConstant * std::erf(h / (2*rs)) / h,
+               kernel2 = -gravitationalConstant * std::erf(std::sqrt(2.0) * h / (2*rs)) / (std::sqrt(2.0) * h);
+
+  #pragma omp parallel for schedule(static)
+  for (int p=0; p<particles; ++p)
+  {
+    int i, j;
+    double wx, wy;
+    if (!GetWeights(state[p].positionX, state[p].positionY, i, j, wx, wy))
+      continue;
+
+    const double w00 = (1 - wx) * (1 - wy), w01 = wx * (1 - wy), w10 = (1 - wx) * wy, w11 = wx * wy;
+    const std::size_t c = (std::size_t)i * N + j;
+
+    nextState[p].accelerationX += w00 * gridAccelerationX[c] + w01 * gridAccelerationX[c + 1] +
+                                  w10 * gridAccelerationX[c + N] + w11 * gridAccelerationX[c + N + 1];
+    nextState[p].accelerationY += w00 * gridAccelerationY[c] + w01 * gridAccelerationY[c + 1] +
+                                  w10 * gridAccelerationY[c + N] + w11 * gridAccelerationY[c + N + 1];
+
+    if (potential)
+    {
+      const double *phi = &gridPotential[(std::size_t)i * M + j];
+      potential[p] += w00 * phi[0] + w01 * phi[1] + w10 * phi[M] + w11 * phi[M + 1];
+
+      // A source reads back its own cloud, weighted by the cell offsets between deposit and interpolation
+      if (p<sources)
+      {
+        const double sameX = (1 - wx) * (1 - wx) + wx * wx, sameY = (1 - wy) * (1 - wy) + wy * wy;
+        const double self = sameX * sameY * kernel0 + ((1 - sameX) * sameY + sameX * (1 - sameY)) * kernel1 +
+                            (1 - sameX) * (1 - sameY) * kernel2;
+        potential[p] -= self * parameters[p].mass;
+      }
+    }
+  }
+}
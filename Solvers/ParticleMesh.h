@@ -0,0 +1,76 @@
+#ifndef _PARTICLEMESH
+#define _PARTICLEMESH
+
+// Standard includes
+#include <vector>
+#include <complex>
+#include <cstddef>
+
+// Project includes
+#include "../Structs/Vectors.h"
+#include "../Structs/Particles.h"
+#include "../Utils/FFT.h"
+
+// Long range part of the TreePM force. Masses are assigned to a square grid with cloud-in-cell weights and
+// convolved by FFT with the gradient of erf(r/2rs)/r, the 1/r kernel of the plane, on a grid padded to twice the
+// size so the boundaries are isolated. The tree adds the erfc(r/2rs)/r remainder within GetCutoff().
+class ParticleMesh
+{
+public:
+
+  ParticleMesh(double gravitationalConstant, int gridSize, double splitCells, double cutoffScales);
+
+  // Places the grid on the square [min, max] with a margin of one cell, so every particle in the square deposits and
+  // reads back. The Green's function is recomputed when the cell size changes.
+  void SetDomain(const Vector2D &min, const Vector2D &max);
+  // Whether a particle at (x, y) gets the long range force
+  bool Contains(double x, double y) const;
+
+  int GetGridSize() const;
+  double GetCellSize() const;
+  double GetSplitScale() const;
+  double GetCutoff() const;
+  // Deposits in a fixed number of chunks summed in order, the result does not depend on the thread count
+  void SetDeterministic(bool enabled);
+
+  // Adds the long range accelerations of the first sources particles and adds the potential per unit mass,
+  // without the self energy, when not NULL. Particles outside the grid get no long range force.
+  void AddAccelerations(const ParticleState2D *state,
+                        const ParticleParameters *parameters,
+                        int particles,
+                        int sources,
+                        ParticleNextState2D *nextState,
+                        double *potential=NULL);
+
+private:
+
+  void ComputeGreensFunction();
+  void AssignMasses(const ParticleState2D *state, const ParticleParameters *parameters, int sources);
+  void DepositMasses(const ParticleState2D *state, const ParticleParameters *parameters, int begin, int end,
+                     std::vector<double> &masses) const;
+  void ComputeGridAccelerations();
+  void ComputeGridPotential();
+  bool GetWeights(double x, double y, int &i, int &j, double &wx, double &wy) const;
+
+  double gravitationalConstant;
+  int gridSize;           // cells per side holding particles
+  int paddedSize;         // FFT size, twice the grid
+  double splitCells;      // rs in cells
+  double cutoffScales;    // short range cutoff in rs
+  Vector2D origin;
+  double cellSize;
+  double greensCellSize;  // cell size the Green's function was computed for
+  bool deterministic;
+
+  FFT2D fft;
+  std::vector< std::complex<double> > greensFunction;
+  std::vector< std::complex<double> > forceFunction;   // x + i y acceleration kernel, deconvolved
+  std::vector< std::complex<double> > grid;
+  std::vector< std::complex<double> > forces;
+  std::vector< std::vector<double> > threadMasses;  // per thread, or per chunk when deterministic
+  std::vector<double> gridPotential;
+  std::vector<double> gridAccelerationX;
+  std::vector<double> gridAccelerationY;
+};
+
+#endif
@@ -0,0 +1,302 @@
+// Distributed-memory N-body run with MPI domain decomposition
+//
+// Usage: mpirun -np <ranks> distributed [config file] [options]
+//   --particles <n>   single galaxy with n particles instead of the configured simulation
+//   --steps <n>       steps to run (default "Distributed"/"Steps")
+//   --check           compare the first force pass with direct summation over all particles
+//
+// Every rank builds the initial conditions of the config file and keeps its share, the particles are
+// then moved to space-filling-curve domains balanced by the measured tree work every "Rebalance interval"
+// steps. Rank 0 reports particles and cost per rank, the exchanged tree nodes, step times and the energy.
+
+// Standard includes
+#include <cstdlib>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <algorithm>
+#include <memory>
+#include <stdexcept>
+#include <omp.h>
+
+// Library includes
+#include <mpi.h>
+#include <jsoncpp/json/json.h>
+
+// Project includes
+#include "../Models/NBody.h"
+#include "../Distributed/DistributedNBody.h"
+#include "../Integrators/Euler.h"
+#include "../Integrators/Heun.h"
+#include "../Integrators/RK4.h"
+#include "../Integrators/LowStorageRK.h"
+
+namespace
+{
+  IIntegrator* CreateIntegrator(const std::string &name, IModel *model, double timeStep, IntegratorWorkspace *workspace)
+  {
+    if (name == "Euler")
+      return new IntegratorEuler<>(model, timeStep, workspace);
+    else if (name == "RK4")
+      return new IntegratorRK4<>(model, timeStep, workspace);
+    else if (name == "LSRK3")
+      return new IntegratorLowStorageRK<>(model, timeStep, 3, workspace);
+    else if (name == "LSRK4")
+      return new IntegratorLowStorageRK<>(model, timeStep, 4, workspace);
+    else // default if not provided or not correct
+      return new IntegratorHeun<>(model, timeStep, workspace);
+  }
+
+  // Relative error of the distributed force pass against direct summation, printed by rank 0
+  void CheckForces(DistributedNBody &model, MPI_Comm communicator, int rank, double G, double softening)
+  {
+    const int particles = model.GetLocalParticles();
+    std::vector<double> state(model.GetInitialState(), model.GetInitialState() + 4*particles), derivative(4*particles);
+    model.Evaluate(particles ? &state[0] : NULL, 0, particles ? &derivative[0] : NULL);
+
+    // All sources are gathered on every rank
+    std::vector<double> local;
+    const ParticleParameters *parameters = model.GetParticleParameters();
+    for (int i=0; i<particles; ++i)
+    {
+      if (parameters[i].mass<=0)
+        continue;
+      local.push_back(state[4*i]);
+      local.push_back(state[4*i + 1]);
+      local.push_back(parameters[i].mass);
+    }
+
+    int ranks, count = (int)local.size();
+    MPI_Comm_size(communicator, &ranks);
+    std::vector<int> counts(ranks), offsets(ranks, 0);
+    MPI_Allgather(&count, 1, MPI_INT, &counts[0], 1, MPI_INT, communicator);
+    for (int r=1; r<ranks; ++r)
+      offsets[r] = offsets[r - 1] + counts[r - 1];
+
+    std::vector<double> sources(offsets[ranks - 1] + counts[ranks - 1] + 1);
+    local.push_back(0);
+    MPI_Allgatherv(&local[0], count, MPI_DOUBLE, &sources[0], &counts[0], &offsets[0], MPI_DOUBLE, communicator);
+    const int sourceCount = (int)(sources.size() - 1) / 3;
+
+    std::vector<double> error(particles + 1);
+    #pragma omp parallel for schedule(dynamic, 64)
+    for (int i=0; i<particles; ++i)
+    {
+      double ax = 0, ay = 0;
+      for (int j=0; j<sourceCount; ++j)
+      {
+        double dx = sources[3*j] - state[4*i], dy = sources[3*j + 1] - state[4*i + 1];
+        double r2 = dx*dx + dy*dy + softening;
+        if (dx==0 && dy==0)
+          continue;
+        double k = G * sources[3*j + 2] / (r2 * std::sqrt(r2));
+        ax += k * dx;
+        ay += k * dy;
+      }
+
+      double ex = derivative[4*i + 2] - ax, ey = derivative[4*i + 3] - ay, a = std::sqrt(ax*ax + ay*ay);
+      error[i] = (a>0) ? std::sqrt(ex*ex + ey*ey) / a : 0;
+    }
+
+    std::vector<int> errorCounts(ranks), errorOffsets(ranks, 0);
+    MPI_Gather(&particles, 1, MPI_INT, &errorCounts[0], 1, MPI_INT, 0, communicator);
+    for (int r=1; r<ranks; ++r)
+      errorOffsets[r] = errorOffsets[r - 1] + errorCounts[r - 1];
+
+    std::vector<double> errors(errorOffsets[ranks - 1] + errorCounts[ranks - 1] + 1);
+    MPI_Gatherv(&error[0], particles, MPI_DOUBLE, &errors[0], &errorCounts[0], &errorOffsets[0], MPI_DOUBLE, 0, communicator);
+
+    if (rank==0)
+    {
+      errors.pop_back();
+      std::sort(errors.begin(), errors.end());
+      const std::size_t n = errors.size();
+      std::cout << "Force error vs direct summation: median " << errors[n/2]
+                << ", 99th " << errors[std::min(n - 1, (std::size_t)(0.99*n))]
+                << ", max " << errors[n - 1] << "\n\n";
+    }
+  }
+}
+
+int main(int argc, char** argv)
+{
+  int provided;
+  MPI_Init_thread(&argc, &argv, MPI_THREAD_FUNNELED, &provided);
+
+  int rank, ranks;
+  MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+  MPI_Comm_size(MPI_COMM_WORLD, &ranks);
+
+  int exitCode = EXIT_SUCCESS;
+  try
+  {
+    Json::Value json;
+    std::string configName = "config.json";
+    int particlesOverride = 0, steps = -1;
+    bool check = false;
+
+    for (int i=1; i<argc; ++i)
+    {
+      if (!strcmp(argv[i], "--particles") && i+1<argc)
+        particlesOverride = atoi(argv[++i]);
+      else if (!strcmp(argv[i], "--steps") && i+1<argc)
+        steps = atoi(argv[++i]);
+      else if (!strcmp(argv[i], "--check"))
+        check = true;
+      else
+        configName = argv[i];
+    }
+
+    std::ifstream configFile(configName.c_str(), std::ifstream::binary);
+    configFile >> json;
+    NBody::ConfigureMemory(json);
+
+    if (particlesOverride>0)
+    {
+      json["Simulation"] = "Single Galaxy";
+      json["Simulation settings"]["Single Galaxy"]["Number of particles"] = particlesOverride;
+    }
+
+    const Json::Value &settings = json["Distributed"];
+    if (steps<0)
+      steps = settings.get("Steps", 100).asInt();
+    const int rebalanceInterval = std::max(settings.get("Rebalance interval", 10).asInt(), 1);
+    const int outputInterval = std::max(settings.get("Output interval", 10).asInt(), 1);
+    const double timeStep = json.get("Time step", 1200).asDouble();
+
+    // Every rank generates only its contiguous share of the initial conditions, restarts and imports are read
+    // whole and cut to the same share
+    std::unique_ptr<DistributedNBody> model;
+    double G, softening;
+    int totalParticles;
+    {
+      NBody initialConditions(json, rank, ranks);
+      G = initialConditions.GetTree()->GetGravitationalConstant();
+      softening = initialConditions.GetTree()->GetSoftening();
+      totalParticles = initialConditions.GetGlobalParticles();
+
+      // The discs are set up on circular orbits in the potentials, without them they start out of equilibrium
+      if (!initialConditions.GetExternalPotentials().IsEmpty())
+        throw std::runtime_error("The distributed run has no external potentials, remove \"External potentials\" "
+                                 "and the galaxy \"Potentials\".");
+
+      // Only the plain double tree force runs distributed
+      if (rank==0 && initialConditions.GetForceMode()!=NBody::TREE)
+        std::cout << "Warning: the distributed run uses the tree force, \"Force\" "
+                  << initialConditions.GetForceModeName() << " is ignored" << std::endl;
+      if (rank==0 && initialConditions.IsMixedPrecision())
+        std::cout << "Warning: the distributed run sums in double, \"Mixed precision\" is ignored" << std::endl;
+      if (rank==0 && json["Hybrid"]["Minimum mass"].asDouble()>0)
+        std::cout << "Warning: the distributed run keeps all bodies in the tree, \"Hybrid\"/\"Minimum mass\" is ignored"
+                  << std::endl;
+
+      const int first = (int)((long long)totalParticles * rank / ranks),
+                last = (int)((long long)totalParticles * (rank + 1) / ranks),
+                offset = first - initialConditions.GetFirstParticle();
+      const ParticleState2D *state = reinterpret_cast<const ParticleState2D*>(initialConditions.GetInitialState());
+
+      model.reset(new DistributedNBody(MPI_COMM_WORLD, G, initialConditions.GetTheta(), softening));
+      model->SetParticles(state + offset, initialConditions.GetParticleParameters() + offset, last - first);
+    }
+
+    model->Rebalance(model->GetInitialState());
+
+    // The essential trees are cut for a whole rank's box, which only the node width over the distance bounds
+    const std::string criterion = json["Opening"]["Criterion"].asString();
+    if (rank==0 && NBody::GetOpeningCriterion(criterion)!=OPENING_GEOMETRIC)
+      std::cout << "Warning: the distributed run opens nodes by their width only, \"Opening\"/\"Criterion\" "
+                << criterion << " is ignored" << std::endl;
+
+    if (rank==0)
+    {
+      std::cout << "Ranks: " << ranks << "\n"
+                << "Threads per rank: " << omp_get_max_threads() << "\n"
+                << "Particles: " << totalParticles << "\n"
+                << "Steps: " << steps << ", rebalance every " << rebalanceInterval << "\n\n";
+    }
+
+    if (check)
+      CheckForces(*model, MPI_COMM_WORLD, rank, G, softening);
+
+    // Kept over the rebalances, the integrators only grow it
+    IntegratorWorkspace workspace;
+    std::unique_ptr<IIntegrator> integrator(CreateIntegrator(json["Integrator"].asString(), model.get(), timeStep,
+                                                             &workspace));
+    integrator->SetInitialState(model->GetInitialState());
+
+    if (rank==0)
+    {
+      std::cout << std::setw(8) << "step"
+                << std::setw(12) << "max local"
+                << std::setw(12) << "imbalance"
+                << std::setw(14) << "LET nodes"
+                << std::setw(12) << "step [s]"
+                << std::setw(16) << "energy error" << "\n";
+    }
+
+    double runStart = MPI_Wtime();
+    for (int step=1; step<=steps; ++step)
+    {
+      if (step>1 && (step - 1) % rebalanceInterval==0)
+      {
+        // The integrator is sized for the local particles, it restarts from the migrated state
+        double time = integrator->GetTime();
+        model->Rebalance(integrator->GetState());
+        integrator.reset();
+        integrator.reset(CreateIntegrator(json["Integrator"].asString(), model.get(), timeStep, &workspace));
+        integrator->SetInitialState(model->GetInitialState());
+        integrator->SetTime(time);
+      }
+
+      const bool output = (step % outputInterval==0 || step==steps || step==1);
+      if (output)
+        model->RequestDiagnostics();
+
+      double stepStart = MPI_Wtime();
+      integrator->SingleStep();
+      double stepTime = MPI_Wtime() - stepStart;
+
+      if (!output)
+        continue;
+
+      // Load balance of the last force pass
+      double cost = model->GetLocalCost(), maxCost, sumCost, maxStepTime;
+      int localParticles = model->GetLocalParticles(), maxParticles;
+      long long imported = model->GetImportedNodes(), totalImported;
+      MPI_Reduce(&cost, &maxCost, 1, MPI_DOUBLE, MPI_MAX, 0, MPI_COMM_WORLD);
+      MPI_Reduce(&cost, &sumCost, 1, MPI_DOUBLE, MPI_SUM, 0, MPI_COMM_WORLD);
+      MPI_Reduce(&stepTime, &maxStepTime, 1, MPI_DOUBLE, MPI_MAX, 0, MPI_COMM_WORLD);
+      MPI_Reduce(&localParticles, &maxParticles, 1, MPI_INT, MPI_MAX, 0, MPI_COMM_WORLD);
+      MPI_Reduce(&imported, &totalImported, 1, MPI_LONG_LONG, MPI_SUM, 0, MPI_COMM_WORLD);
+
+      if (rank==0)
+      {
+        std::cout << std::setw(8) << step
+                  << std::setw(12) << maxParticles
+                  << std::setw(12) << ((sumCost>0) ? maxCost * ranks / sumCost : 1)
+                  << std::setw(14) << totalImported
+                  << std::setw(12) << maxStepTime
+                  << std::setw(16) << model->GetDiagnostics().GetEnergyError() << "\n";
+      }
+    }
+
+    double runTime = MPI_Wtime() - runStart;
+    if (rank==0)
+    {
+      std::cout << "\nWall time: " << runTime << " s, "
+                << (runTime>0 ? (double)totalParticles * steps / runTime : 0) << " particle steps/s\n";
+    }
+  }
+  catch(std::exception &exc)
+  {
+    std::cout << "Rank " << rank << " failed. Exception: " << exc.what() << std::endl;
+    exitCode = EXIT_FAILURE;
+    MPI_Abort(MPI_COMM_WORLD, exitCode);
+  }
+
+  MPI_Finalize();
+  return exitCode;
+}
@@ -0,0 +1,270 @@
+// Ensemble of independent simulations sharing one thread pool
+//
+// Usage: ensemble [config file] [options]
+//   --steps <n>                     steps of every simulation (default "Ensemble"/"Steps")
+//   --threads-per-simulation <n>    threads of one simulation (default "Ensemble"/"Threads per simulation")
+//   --output <file>                 JSON line per simulation (default "Ensemble"/"Output", console if empty)
+//
+// The members are the cartesian product of the "Ensemble"/"Sweep" axes and "Seeds" random seeds per
+// parameter set. An axis sets (or with "Factors" scales) every config value in "Paths", given as keys
+// separated by '/', e.g. "Simulation settings/Galaxy Collision/2/Bulge mass". Simulations are handed out
+// dynamically to the pool threads, a simulation runs its own OpenMP regions with the remaining threads.
+
+// Standard includes
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <memory>
+#include <algorithm>
+#include <stdexcept>
+#include <omp.h>
+
+// Library includes
+#include <jsoncpp/json/json.h>
+
+// Project includes
+#include "../Models/NBody.h"
+#include "../Integrators/Euler.h"
+#include "../Integrators/Heun.h"
+#include "../Integrators/RK4.h"
+#include "../Integrators/LowStorageRK.h"
+
+namespace
+{
+  struct SweepAxis
+  {
+    std::vector<std::string> paths;
+    std::vector<double> values;
+    bool factors;   // values scale the configured ones
+  };
+
+  IIntegrator* CreateIntegrator(const std::string &name, NBody *model, double timeStep, IntegratorWorkspace *workspace)
+  {
+    if (name == "Euler")
+      return new IntegratorEuler<NBody>(model, timeStep, workspace);
+    else if (name == "RK4")
+      return new IntegratorRK4<NBody>(model, timeStep, workspace);
+    else if (name == "LSRK3")
+      return new IntegratorLowStorageRK<NBody>(model, timeStep, 3, workspace);
+    else if (name == "LSRK4")
+      return new IntegratorLowStorageRK<NBody>(model, timeStep, 4, workspace);
+    else // default if not provided or not correct
+      return new IntegratorHeun<NBody>(model, timeStep, workspace);
+  }
+
+  Json::Value& Resolve(Json::Value &root, const std::string &path)
+  {
+    Json::Value *value = &root;
+    std::stringstream ss(path);
+    std::string key;
+    while (std::getline(ss, key, '/'))
+    {
+      if (!value->isMember(key))
+        throw std::runtime_error("Sweep path '" + path + "' is not in the config.");
+      value = &(*value)[key];
+    }
+    return *value;
+  }
+
+  std::vector<SweepAxis> ParseSweep(const Json::Value &sweep)
+  {
+    std::vector<SweepAxis> axes;
+    for (unsigned i=0; i<sweep.size(); ++i)
+    {
+      SweepAxis axis;
+      const Json::Value &paths = sweep[i].isMember("Paths") ? sweep[i]["Paths"] : sweep[i]["Path"];
+      if (paths.isArray())
+      {
+        for (unsigned p=0; p<paths.size(); ++p)
+          axis.paths.push_back(paths[p].asString());
+      }
+      else
+        axis.paths.push_back(paths.asString());
+
+      axis.factors = sweep[i].isMember("Factors");
+      const Json::Value &values = axis.factors ? sweep[i]["Factors"] : sweep[i]["Values"];
+      for (unsigned v=0; v<values.size(); ++v)
+        axis.values.push_back(values[v].asDouble());
+
+      if (axis.values.empty())
+        throw std::runtime_error("Sweep axis without values.");
+      axes.push_back(axis);
+    }
+    return axes;
+  }
+
+  // Config of one member, its parameters are returned for the report
+  Json::Value CreateMember(const Json::Value &base, const std::vector<SweepAxis> &axes, int seeds, int member,
+                           Json::Value &parameters)
+  {
+    Json::Value config = base;
+    int index = member / seeds;
+
+    for (std::size_t a=0; a<axes.size(); ++a)
+    {
+      const SweepAxis &axis = axes[a];
+      const double value = axis.values[index % axis.values.size()];
+      index /= (int)axis.values.size();
+
+      for (std::size_t p=0; p<axis.paths.size(); ++p)
+      {
+        Json::Value &setting = Resolve(config, axis.paths[p]);
+        setting = axis.factors ? setting.asDouble() * value : value;
+        parameters[axis.paths[p]] = setting;
+      }
+    }
+
+    config["Random seed"] = (Json::UInt64)(base.get("Random seed", 1).asUInt64() + member % seeds);
+    config["Restart file"] = "";
+    return config;
+  }
+}
+
+int main(int argc, char** argv)
+{
+  try
+  {
+    Json::Value json;
+    std::string configName = "config.json";
+    int steps = -1, threadsPerSimulation = -1;
+    std::string outputName;
+    bool outputGiven = false;
+
+    for (int i=1; i<argc; ++i)
+    {
+      if (!strcmp(argv[i], "--steps") && i+1<argc)
+        steps = atoi(argv[++i]);
+      else if (!strcmp(argv[i], "--threads-per-simulation") && i+1<argc)
+        threadsPerSimulation = atoi(argv[++i]);
+      else if (!strcmp(argv[i], "--output") && i+1<argc)
+      {
+        outputName = argv[++i];
+        outputGiven = true;
+      }
+      else
+        configName = argv[i];
+    }
+
+    std::ifstream configFile(configName.c_str(), std::ifstream::binary);
+    configFile >> json;
+    NBody::ConfigureMemory(json);
+
+    const Json::Value &settings = json["Ensemble"];
+    if (steps<0)
+      steps = settings.get("Steps", 100).asInt();
+    if (threadsPerSimulation<1)
+      threadsPerSimulation = std::max(settings.get("Threads per simulation", 1).asInt(), 1);
+    if (!outputGiven)
+      outputName = settings["Output"].asString();
+
+    const std::vector<SweepAxis> axes = ParseSweep(settings["Sweep"]);
+    const int seeds = std::max(settings.get("Seeds", 1).asInt(), 1);
+    int members = seeds;
+    for (std::size_t a=0; a<axes.size(); ++a)
+      members *= (int)axes[a].values.size();
+
+    const int allThreads = omp_get_max_threads();
+    threadsPerSimulation = std::min(threadsPerSimulation, allThreads);
+    const int poolThreads = std::max(allThreads / threadsPerSimulation, 1);
+
+    std::cout << "Simulations: " << members << "\n"
+              << "Steps: " << steps << "\n"
+              << "Pool threads: " << poolThreads << ", threads per simulation: " << threadsPerSimulation << "\n\n";
+
+    std::ofstream outputFile;
+    if (!outputName.empty())
+    {
+      outputFile.open(outputName.c_str());
+      if (!outputFile)
+        throw std::runtime_error("Can't create ensemble output '" + outputName + "'.");
+    }
+    std::ostream &output = outputName.empty() ? std::cout : outputFile;
+
+    // Simulations in parallel, their own regions nested inside when they have more than one thread
+    omp_set_max_active_levels(threadsPerSimulation>1 ? 2 : 1);
+    long long particleSteps = 0;
+    int failed = 0;
+    const double start = omp_get_wtime();
+
+    // Integrator buffers of a pool thread are reused by all its members
+    std::vector<IntegratorWorkspace> workspaces(poolThreads);
+
+    #pragma omp parallel for schedule(dynamic, 1) num_threads(poolThreads) reduction(+:particleSteps,failed)
+    for (int member=0; member<members; ++member)
+    {
+      omp_set_num_threads(threadsPerSimulation);
+
+      Json::Value report;
+      report["member"] = member;
+      report["thread"] = omp_get_thread_num();
+      const double memberStart = omp_get_wtime();
+
+      try
+      {
+        Json::Value parameters(Json::objectValue);
+        Json::Value config = CreateMember(json, axes, seeds, member, parameters);
+        report["seed"] = config["Random seed"];
+        report["parameters"] = parameters;
+
+        NBody model(config);
+        std::unique_ptr<IIntegrator> integrator(CreateIntegrator(config["Integrator"].asString(), &model,
+                                                                 config.get("Time step", 1200).asDouble(),
+                                                                 &workspaces[omp_get_thread_num()]));
+        integrator->SetInitialState(model.GetInitialState());
+
+        for (int step=0; step<steps; ++step)
+        {
+          if (step==0 || step==steps - 1)
+            model.RequestDiagnostics();
+          integrator->SingleStep();
+        }
+
+        const Diagnostics &diagnostics = model.GetDiagnostics();
+        report["particles"] = model.GetTotalParticles();
+        report["steps"] = steps;
+        report["time"] = integrator->GetTime();
+        report["energy_error"] = diagnostics.HasSample() ? diagnostics.GetEnergyError() : 0.0;
+        report["virial_ratio"] = diagnostics.HasSample() ? diagnostics.GetSample().virialRatio : 0.0;
+        particleSteps += (long long)model.GetTotalParticles() * steps;
+      }
+      catch(std::exception &exc)
+      {
+        report["error"] = exc.what();
+        ++failed;
+      }
+
+      report["seconds"] = omp_get_wtime() - memberStart;
+
+      Json::FastWriter writer;
+      const std::string line = writer.write(report);
+
+      #pragma omp critical(EnsembleOutput)
+      {
+        output << line;
+        output.flush();
+      }
+    }
+
+    const double seconds = omp_get_wtime() - start;
+    std::cout << "\nWall time: " << seconds << " s\n"
+              << "Throughput: " << ((seconds>0) ? members * 3600.0 / seconds : 0) << " simulations/hour, "
+              << ((seconds>0) ? particleSteps / seconds : 0) << " particle steps/s\n";
+
+    if (failed)
+    {
+      std::cout << failed << " simulations failed.\n";
+      return EXIT_FAILURE;
+    }
+  }
+  catch(std::exception &exc)
+  {
+    std::cout << "Program failed. Exception: " << exc.what() << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  return (EXIT_SUCCESS);
+}
@@ -0,0 +1,233 @@
+// Tree force accuracy against direct summation
+//
+// Usage: accuracy [config file] [particles]
+//   Builds the initial conditions from the config file (a single galaxy with the given number
+//   of particles if provided) and reports the distribution of the relative tree force error
+//   |a_tree - a_direct| / |a_direct| for a range of opening angles, with the plain tree and with TreePM.
+//   Every opening criterion is swept over its parameter, the interactions it saves are those the geometric
+//   criterion needs for the same 99th percentile error. The mixed precision tree is compared with the double one,
+//   with theta 0 its difference to direct summation is the single precision rounding.
+
+// Standard includes
+#include <cstdlib>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <algorithm>
+#include <limits>
+#include <omp.h>
+
+// Library includes
+#include <jsoncpp/json/json.h>
+
+// Project includes
+#include "../Models/NBody.h"
+
+int main(int argc, char** argv)
+{
+  try
+  {
+    Json::Value json;
+    std::ifstream configFile((argc>1) ? argv[1] : "config.json", std::ifstream::binary);
+    configFile >> json;
+
+    if (argc>2)
+    {
+      json["Simulation"] = "Single Galaxy";
+      json["Simulation settings"]["Single Galaxy"]["Number of particles"] = atoi(argv[2]);
+    }
+    json["Restart file"] = "";
+
+    NBody::ConfigureMemory(json);
+    NBody model(json);
+    const double configuredTheta = model.GetTheta();
+    const int particles = model.GetTotalParticles();
+    const int dimension = model.GetSimulationDimension();
+
+    // Evaluate works on a copy, the initial state may be used by the tree
+    std::vector<double> state(model.GetInitialState(), model.GetInitialState() + dimension);
+    std::vector<double> reference(dimension), derivative(dimension);
+
+    model.SetForceMode(NBody::DIRECT);
+    double start = omp_get_wtime();
+    model.Evaluate(&state[0], 0, &reference[0]);
+    double directTime = omp_get_wtime() - start;
+
+    std::cout << "Particles: " << particles << "\n"
+              << "Threads: " << omp_get_max_threads() << "\n"
+              << "Direct summation: " << directTime << " s\n"
+              << "Leaf size: 1 (the quadtree stores one particle per leaf)\n\n";
+
+    const ParticleNextState2D *exact = reinterpret_cast<const ParticleNextState2D*>(&reference[0]);
+    const ParticleNextState2D *approximate = reinterpret_cast<const ParticleNextState2D*>(&derivative[0]);
+    std::vector<double> error(particles);
+
+    const NBody::ForceMode modes[] = {NBody::TREE, NBody::TREEPM};
+    // Smallest step of the geometric error between two settings that is not noise
+    const double minimumRise = 1.05;
+    const OpeningCriterion criteria[] = {OPENING_GEOMETRIC, OPENING_OFFSET, OPENING_SALMON_WARREN, OPENING_RELATIVE};
+    for (int mode=0; mode<2; ++mode)
+    {
+      model.SetForceMode(modes[mode]);
+
+      // 99th percentile error and interactions per particle of the geometric criterion, in order of theta
+      std::vector<double> geometricError, geometricInteractions;
+      for (int c=0; c<4; ++c)
+      {
+        const bool errorBounded = criteria[c]==OPENING_SALMON_WARREN || criteria[c]==OPENING_RELATIVE;
+        model.SetOpeningCriterion(criteria[c], model.GetOpeningAccuracy());
+
+        std::cout << model.GetForceModeName() << ", " << model.GetOpeningCriterionName() << " opening\n"
+                  << std::setw(8) << (errorBounded ? "accuracy" : "theta")
+                  << std::setw(14) << "median"
+                  << std::setw(14) << "99th"
+                  << std::setw(14) << "max"
+                  << std::setw(14) << "interactions"
+                  << std::setw(10) << "saved"
+                  << std::setw(14) << "time [s]" << "\n";
+
+        const int settings = errorBounded ? 10 : 15;
+        for (int k=0; k<settings; ++k)
+        {
+          // Accuracies from 1e-4 to about 5e-2
+          const double parameter = errorBounded ? 1e-4 * std::pow(2.0, k) : 0.1 * (k + 1);
+          if (errorBounded)
+          {
+            // The error bounded criteria need the |a| of a previous evaluation. Switching the criterion drops the
+            // last one, so every setting is seeded by the same evaluation at the configured theta.
+            model.SetTheta(configuredTheta);
+            model.SetOpeningCriterion(OPENING_GEOMETRIC, parameter);
+            model.SetOpeningCriterion(criteria[c], parameter);
+            model.Evaluate(&state[0], 0, &derivative[0]);
+          }
+          else
+          {
+            model.SetTheta(parameter);
+          }
+          model.GetMetrics().EndStep(0);
+
+          start = omp_get_wtime();
+          model.Evaluate(&state[0], 0, &derivative[0]);
+          double treeTime = omp_get_wtime() - start;
+
+          Metrics &metrics = model.GetMetrics();
+          metrics.EndStep(0);
+          const double interactions = (double)metrics.GetCounter(Metrics::INTERACTIONS) / particles;
+
+          for (int i=0; i<particles; ++i)
+          {
+            double dx = approximate[i].accelerationX - exact[i].accelerationX,
+                   dy = approximate[i].accelerationY - exact[i].accelerationY,
+                   a = std::sqrt(exact[i].accelerationX*exact[i].accelerationX + exact[i].accelerationY*exact[i].accelerationY);
+            error[i] = (a>0) ? std::sqrt(dx*dx + dy*dy) / a : 0;
+          }
+
+          std::sort(error.begin(), error.end());
+          const double error99 = error[std::min(particles - 1, (int)(0.99*particles))];
+
+          // Interactions of the geometric criterion at this error, interpolated in log-log between its settings.
+          // Only its rising part counts, where the mesh error dominates the curve is flat and any match is noise.
+          double saved = std::numeric_limits<double>::quiet_NaN();
+          if (criteria[c]==OPENING_GEOMETRIC)
+          {
+            geometricError.push_back(error99);
+            geometricInteractions.push_back(interactions);
+          }
+          else
+          {
+            for (std::size_t g=1; g<geometricError.size(); ++g)
+            {
+              const double e0 = geometricError[g-1], e1 = geometricError[g];
+              if (!(e0>0 && e1>=minimumRise*e0))
+                break;
+              if (error99>=e0 && error99<=e1)
+              {
+                const double f = std::log(error99/e0) / std::log(e1/e0);
+                const double needed = geometricInteractions[g-1] * std::pow(geometricInteractions[g]/geometricInteractions[g-1], f);
+                saved = 1 - interactions/needed;
+                break;
+              }
+            }
+          }
+
+          std::cout << std::setw(8) << parameter
+                    << std::setw(14) << error[particles/2]
+                    << std::setw(14) << error99
+                    << std::setw(14) << error[particles - 1]
+                    << std::setw(14) << interactions;
+          if (std::isnan(saved))
+            std::cout << std::setw(10) << "-";
+          else
+            std::cout << std::setw(9) << std::fixed << std::setprecision(1) << 100*saved << "%" << std::defaultfloat << std::setprecision(6);
+          std::cout << std::setw(14) << treeTime << "\n";
+        }
+
+        std::cout << "\n";
+      }
+
+      model.SetOpeningCriterion(OPENING_GEOMETRIC, model.GetOpeningAccuracy());
+    }
+
+    // Mixed precision walks the tree once per group, compared with the double walk per particle
+    model.SetForceMode(NBody::TREE);
+    std::cout << model.GetForceModeName() << ", mixed precision against double\n"
+              << std::setw(8) << "theta"
+              << std::setw(14) << "99th double"
+              << std::setw(14) << "99th mixed"
+              << std::setw(16) << "inter. double"
+              << std::setw(16) << "inter. mixed"
+              << std::setw(14) << "double [s]"
+              << std::setw(14) << "mixed [s]" << "\n";
+
+    // With theta 0 every particle is summed, the difference to direct summation is the float rounding alone
+    for (int k=0; k<5; ++k)
+    {
+      const double theta = k ? 0.25 * k : 0;
+      model.SetTheta(theta);
+
+      double error99[2], interactions[2], times[2];
+      for (int m=0; m<2; ++m)
+      {
+        model.SetMixedPrecision(m==1);
+        model.GetMetrics().EndStep(0);
+        start = omp_get_wtime();
+        model.Evaluate(&state[0], 0, &derivative[0]);
+        times[m] = omp_get_wtime() - start;
+        model.GetMetrics().EndStep(0);
+        interactions[m] = (double)model.GetMetrics().GetCounter(Metrics::INTERACTIONS) / particles;
+
+        for (int i=0; i<particles; ++i)
+        {
+          double dx = approximate[i].accelerationX - exact[i].accelerationX,
+                 dy = approximate[i].accelerationY - exact[i].accelerationY,
+                 a = std::sqrt(exact[i].accelerationX*exact[i].accelerationX + exact[i].accelerationY*exact[i].accelerationY);
+          error[i] = (a>0) ? std::sqrt(dx*dx + dy*dy) / a : 0;
+        }
+        std::sort(error.begin(), error.end());
+        error99[m] = error[std::min(particles - 1, (int)(0.99*particles))];
+
+        if (k==0 && m==1)
+          std::cout << "Single precision rounding: median " << error[particles/2] << ", 99th " << error99[m]
+                    << ", max " << error[particles - 1] << "\n";
+      }
+
+      std::cout << std::setw(8) << theta
+                << std::setw(14) << error99[0]
+                << std::setw(14) << error99[1]
+                << std::setw(16) << interactions[0]
+                << std::setw(16) << interactions[1]
+                << std::setw(14) << times[0]
+                << std::setw(14) << times[1] << "\n";
+    }
+    model.SetMixedPrecision(false);
+  }
+  catch(std::exception &exc)
+  {
+    std::cout << "Program failed. Exception: " << exc.what() << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  return (EXIT_SUCCESS);
+}
@@ -0,0 +1,954 @@
+// Standard includes
+#include <cstdio>
+#include <cstring>
+#include <cassert>
+#include <cmath>
+#include <cstddef>
+#include <algorithm>
+#include <iostream>
+#include <stdexcept>
+#include <sstream>
+#include <new>
+#include <type_traits>
+
+// Project includes
+#include "SpatialTree.h"
+#include "../Utils/Numa.h"
+
+TreeCounters::TreeCounters()
+  :interactions(0)
+  ,nodesOpened(0)
+{}
+
+template<int Dim>
+TreeInteractions<Dim>::TreeInteractions()
+  :mass()
+  ,softening()
+  ,count(0)
+{}
+
+template<int Dim>
+void TreeInteractions<Dim>::Clear()
+{
+  // Keeps the capacity, the lists are reused for every particle of a thread
+  count = 0;
+}
+
+template<int Dim>
+void TreeInteractions<Dim>::Add(const double *offset, double sourceMass, double sourceSoftening)
+{
+  if (count==(int)mass.size())
+  {
+    const std::size_t capacity = std::max<std::size_t>(256, 2*mass.size());
+    for (int d=0; d<Dim; ++d)
+      delta[d].resize(capacity);
+    mass.resize(capacity);
+    softening.resize(capacity);
+  }
+
+  for (int d=0; d<Dim; ++d)
+    delta[d][count] = (float)offset[d];
+  mass[count] = (float)sourceMass;
+  softening[count] = (float)sourceSoftening;
+  ++count;
+}
+
+template<int Dim>
+int TreeInteractions<Dim>::GetCount() const
+{
+  return count;
+}
+
+template<int Dim>
+TreeContext<Dim>::TreeContext()
+  :theta(TreeTraits<Dim>::DefaultTheta())
+  ,criterion(OPENING_GEOMETRIC)
+  ,accuracy(0.005)
+  ,gravitationalConstant(0)
+  ,softening(0.01)
+  ,splitScale(0)
+  ,cutoff(0)
+  ,mixedPrecision(false)
+  ,outsideParticles()
+  ,nodeBlocks()
+  ,usedNodes(0)
+{}
+
+template<int Dim>
+TreeContext<Dim>::~TreeContext()
+{
+  for (std::size_t b=0; b<nodeBlocks.size(); ++b)
+    Numa::Free(nodeBlocks[b]);
+}
+
+template<int Dim>
+SpatialTree<Dim>::SpatialTree(const Vector &min,
+                              const Vector &max,
+                              SpatialTree *parent)
+  :particleData()
+  ,nodeMass(0)
+  ,secondMoment(0)
+  ,extent(0)
+  ,centerOffset(0)
+  ,parentNode(parent)
+  ,firstChildNode(NULL)
+  ,nextNode(NULL)
+  ,nodeParticlesCount(0)
+  ,maxDivided(false)
+  ,ownContext(parent ? NULL : new TreeContext<Dim>())
+  ,context(parent ? parent->context : ownContext.get())
+{
+  double minimum[Dim], maximum[Dim];
+  TreeTraits<Dim>::GetComponents(min, minimum);
+  TreeTraits<Dim>::GetComponents(max, maximum);
+  SetBox(minimum, maximum);
+
+  for (int c=0; c<Children; ++c)
+    childNode[c] = NULL;
+}
+
+template<int Dim>
+SpatialTree<Dim>::~SpatialTree()
+{
+  // Child nodes hold nothing to release, their memory goes with the blocks of the context
+}
+
+template<int Dim>
+void SpatialTree<Dim>::SetBox(const double *min, const double *max)
+{
+  for (int d=0; d<Dim; ++d)
+  {
+    minBoxPosition[d] = min[d];
+    maxBoxPosition[d] = max[d];
+    nodeCenter[d] = min[d] + (max[d] - min[d])/2.0;
+    massCenter[d] = 0;
+  }
+}
+
+// GetPosition reads the coordinates of a state as an array
+static_assert(std::is_standard_layout<ParticleState2D>::value && std::is_standard_layout<ParticleState3D>::value,
+              "Particle states must be standard layout.");
+static_assert(offsetof(ParticleState2D, positionY)==offsetof(ParticleState2D, positionX) + sizeof(double),
+              "2D particle positions must be contiguous.");
+static_assert(offsetof(ParticleState3D, positionY)==offsetof(ParticleState3D, positionX) + sizeof(double) &&
+              offsetof(ParticleState3D, positionZ)==offsetof(ParticleState3D, positionX) + 2*sizeof(double),
+              "3D particle positions must be contiguous.");
+
+template<int Dim>
+const double* SpatialTree<Dim>::GetPosition(const State *state)
+{
+  return &state->positionX;
+}
+
+template<int Dim>
+bool SpatialTree<Dim>::IsRoot() const
+{
+  return parentNode==NULL;
+}
+
+template<int Dim>
+bool SpatialTree<Dim>::IsExternal() const
+{
+  for (int c=0; c<Children; ++c)
+  {
+    if (childNode[c])
+      return false;
+  }
+  return true;
+}
+
+template<int Dim>
+bool SpatialTree<Dim>::IsDevided() const
+{
+  return maxDivided;
+}
+
+template<int Dim>
+typename SpatialTree<Dim>::Vector SpatialTree<Dim>::GetMinimumDimension() const
+{
+  return TreeTraits<Dim>::MakeVector(minBoxPosition);
+}
+
+template<int Dim>
+typename SpatialTree<Dim>::Vector SpatialTree<Dim>::GetMaximumDimension() const
+{
+  return TreeTraits<Dim>::MakeVector(maxBoxPosition);
+}
+
+template<int Dim>
+double SpatialTree<Dim>::GetMass() const
+{
+  return nodeMass;
+}
+
+template<int Dim>
+typename SpatialTree<Dim>::Vector SpatialTree<Dim>::GetMassCenter() const
+{
+  return TreeTraits<Dim>::MakeVector(massCenter);
+}
+
+template<int Dim>
+double SpatialTree<Dim>::GetTheta() const
+{
+  return context->theta;
+}
+
+template<int Dim>
+void SpatialTree<Dim>::SetTheta(double newTheta)
+{
+  context->theta = newTheta;
+}
+
+template<int Dim>
+OpeningCriterion SpatialTree<Dim>::GetOpeningCriterion() const
+{
+  return context->criterion;
+}
+
+template<int Dim>
+double SpatialTree<Dim>::GetOpeningAccuracy() const
+{
+  return context->accuracy;
+}
+
+template<int Dim>
+void SpatialTree<Dim>::SetOpeningCriterion(OpeningCriterion newCriterion, double newAccuracy)
+{
+  context->criterion = newCriterion;
+  context->accuracy = newAccuracy;
+}
+
+template<int Dim>
+double SpatialTree<Dim>::GetSoftening() const
+{
+  return context->softening;
+}
+
+template<int Dim>
+void SpatialTree<Dim>::SetSoftening(double newSoftening)
+{
+  context->softening = newSoftening;
+}
+
+template<int Dim>
+double SpatialTree<Dim>::GetGravitationalConstant() const
+{
+  return context->gravitationalConstant;
+}
+
+template<int Dim>
+void SpatialTree<Dim>::SetGravitationalConstant(double G)
+{
+  context->gravitationalConstant = G;
+}
+
+template<int Dim>
+double SpatialTree<Dim>::GetSplitScale() const
+{
+  return context->splitScale;
+}
+
+template<int Dim>
+void SpatialTree<Dim>::SetShortRange(double newSplitScale, double newCutoff)
+{
+  context->splitScale = newSplitScale;
+  context->cutoff = newCutoff;
+}
+
+template<int Dim>
+bool SpatialTree<Dim>::IsMixedPrecision() const
+{
+  return context->mixedPrecision;
+}
+
+template<int Dim>
+void SpatialTree<Dim>::SetMixedPrecision(bool enabled)
+{
+  context->mixedPrecision = enabled;
+}
+
+template<int Dim>
+double SpatialTree<Dim>::GetShortRangeFactors(double r, double &potentialFactor) const
+{
+  // Gaussian split of 1/r: the force keeps erfc(u) + 2u/sqrt(pi) exp(-u^2), u = r/2rs
+  const double u = r / (2 * context->splitScale);
+  potentialFactor = std::erfc(u);
+  return potentialFactor + 2 * u / std::sqrt(M_PI) * std::exp(-u*u);
+}
+
+template<int Dim>
+inline double SpatialTree<Dim>::GetSeparation(const double *position, const State *state, double *delta) const
+{
+  const double *position2 = GetPosition(state);
+
+  double r2 = context->softening;
+  for (int d=0; d<Dim; ++d)
+  {
+    delta[d] = position2[d] - position[d];
+    r2 += delta[d] * delta[d];
+  }
+  return r2;
+}
+
+template<int Dim>
+inline void SpatialTree<Dim>::AddMonopole(const double *delta, double r, double mass, double *acceleration,
+                                          double *potential) const
+{
+  const double G = context->gravitationalConstant;
+  double k = G * mass / (r*r*r), potentialFactor = 1;
+  if (context->splitScale>0)
+    k *= GetShortRangeFactors(r, potentialFactor);
+
+  for (int d=0; d<Dim; ++d)
+    acceleration[d] += k * delta[d];
+
+  if (potential)
+    *potential -= potentialFactor * G * mass / r;
+}
+
+template<int Dim>
+bool SpatialTree<Dim>::IsBeyondCutoff(const double *position) const
+{
+  double distance2 = 0;
+  for (int d=0; d<Dim; ++d)
+  {
+    const double outside = std::max(0.0, std::max(minBoxPosition[d] - position[d], position[d] - maxBoxPosition[d]));
+    distance2 += outside * outside;
+  }
+  return distance2 > context->cutoff * context->cutoff;
+}
+
+template<int Dim>
+int SpatialTree<Dim>::GetAllNodesParticles() const
+{
+  return nodeParticlesCount;
+}
+
+template<int Dim>
+void SpatialTree<Dim>::ClearStatistics()
+{
+  if (!IsRoot())
+    throw std::runtime_error("Only the root node may reset statistics data.");
+
+  struct ResetSubdivideFlags
+  {
+    ResetSubdivideFlags(SpatialTree *pRoot)
+    {
+      ResetFlag(pRoot);
+    }
+
+    void ResetFlag(SpatialTree *pNode)
+    {
+      pNode->maxDivided = false;
+      for (int c=0; c<Children; ++c)
+      {
+        if (pNode->childNode[c])
+          ResetFlag(pNode->childNode[c]);
+      }
+    }
+  } ResetFlagNow(this);
+}
+
+template<int Dim>
+void SpatialTree<Dim>::Reset(const Vector &min,
+                             const Vector &max)
+{
+  if (!IsRoot())
+    throw std::runtime_error("Only the root node may reset the tree.");
+
+  for (int c=0; c<Children; ++c)
+    childNode[c] = NULL;
+  firstChildNode = NULL;
+  context->usedNodes = 0;
+
+  double minimum[Dim], maximum[Dim];
+  TreeTraits<Dim>::GetComponents(min, minimum);
+  TreeTraits<Dim>::GetComponents(max, maximum);
+  SetBox(minimum, maximum);
+
+  particleData.Reset();
+  nodeParticlesCount = 0;
+  nodeMass = 0;
+
+  context->outsideParticles.clear();
+}
+
+template<int Dim>
+int SpatialTree<Dim>::GetChildIndex(const double *position) const
+{
+  // One comparison per axis, positions on the centre go to the lower half
+  int index = 0;
+  for (int d=0; d<Dim; ++d)
+    index |= (position[d] > nodeCenter[d]) << d;
+  return index;
+}
+
+template<int Dim>
+SpatialTree<Dim>* SpatialTree<Dim>::CreateChildNode(int index)
+{
+  if (index<0 || index>=Children)
+    throw std::runtime_error("Can't determine the child node!");
+
+  double min[Dim], max[Dim];
+  for (int d=0; d<Dim; ++d)
+  {
+    const bool upper = (index >> d) & 1;
+    min[d] = upper ? nodeCenter[d] : minBoxPosition[d];
+    max[d] = upper ? maxBoxPosition[d] : nodeCenter[d];
+  }
+
+  return new (AllocateNode()) SpatialTree(TreeTraits<Dim>::MakeVector(min), TreeTraits<Dim>::MakeVector(max), this);
+}
+
+template<int Dim>
+void* SpatialTree<Dim>::AllocateNode()
+{
+  // Blocks of one huge page
+  static const std::size_t blockNodes = ((2 << 20) - Numa::cacheLine) / sizeof(SpatialTree);
+
+  const std::size_t block = context->usedNodes / blockNodes;
+  if (block==context->nodeBlocks.size())
+    context->nodeBlocks.push_back(Numa::Allocate(blockNodes, sizeof(SpatialTree)));
+
+  SpatialTree *nodes = static_cast<SpatialTree*>(context->nodeBlocks[block]);
+  return &nodes[context->usedNodes++ % blockNodes];
+}
+
+template<int Dim>
+void SpatialTree<Dim>::ComputeMassDistribution()
+{
+  if (nodeParticlesCount==1)
+  {
+    State *state = particleData.particleState;
+    ParticleParameters *parameters = particleData.particleParameters;
+    assert(state);
+    assert(parameters);
+
+    firstChildNode = NULL;
+    nodeMass = parameters->mass;
+    const double *position = GetPosition(state);
+    for (int d=0; d<Dim; ++d)
+      massCenter[d] = position[d];
+    secondMoment = 0;
+    extent = 0;
+  }
+  else
+  {
+    // Depth first links: the first child follows the node, the last one continues where the node does
+    SpatialTree *last = NULL;
+    firstChildNode = NULL;
+    for (int c=0; c<Children; ++c)
+    {
+      if (childNode[c])
+      {
+        if (last)
+          last->nextNode = childNode[c];
+        else
+          firstChildNode = childNode[c];
+        last = childNode[c];
+      }
+    }
+    if (last)
+      last->nextNode = nextNode;
+
+    nodeMass = 0;
+    for (int d=0; d<Dim; ++d)
+      massCenter[d] = 0;
+
+    for (int c=0; c<Children; ++c)
+    {
+      if (childNode[c])
+      {
+        childNode[c]->ComputeMassDistribution();
+        nodeMass += childNode[c]->nodeMass;
+        for (int d=0; d<Dim; ++d)
+          massCenter[d] += childNode[c]->massCenter[d] * childNode[c]->nodeMass;
+      }
+    }
+
+    for (int d=0; d<Dim; ++d)
+      massCenter[d] /= nodeMass;
+
+    // Moved to the new centre by the parallel axis theorem, the extent is bounded by the child spheres
+    secondMoment = 0;
+    extent = 0;
+    for (int c=0; c<Children; ++c)
+    {
+      if (childNode[c])
+      {
+        double distance2 = 0;
+        for (int d=0; d<Dim; ++d)
+        {
+          const double delta = childNode[c]->massCenter[d] - massCenter[d];
+          distance2 += delta * delta;
+        }
+        secondMoment += childNode[c]->secondMoment + childNode[c]->nodeMass * distance2;
+        extent = std::max(extent, std::sqrt(distance2) + childNode[c]->extent);
+      }
+    }
+  }
+
+  double offset2 = 0;
+  for (int d=0; d<Dim; ++d)
+    offset2 += (massCenter[d] - nodeCenter[d]) * (massCenter[d] - nodeCenter[d]);
+  centerOffset = std::sqrt(offset2);
+}
+
+template<int Dim>
+void SpatialTree<Dim>::CalculateAcceleration(const double *position, const State *self, const Data &p2,
+                                             double *acceleration, double *potential) const
+{
+  if (self==p2.particleState)
+    return;
+
+  double delta[Dim];
+  const double r2 = GetSeparation(position, p2.particleState, delta);
+  if (r2>0)
+    AddMonopole(delta, std::sqrt(r2), p2.particleParameters->mass, acceleration, potential);
+}
+
+template<int Dim>
+typename SpatialTree<Dim>::Vector SpatialTree<Dim>::CalculateForce(const Data &p1) const
+{
+  TreeCounters counters;
+  return CalculateForce(p1, counters);
+}
+
+template<int Dim>
+typename SpatialTree<Dim>::Vector SpatialTree<Dim>::CalculateForce(const Data &p1, TreeCounters &counters) const
+{
+  return CalculateForce(p1, counters, NULL);
+}
+
+template<int Dim>
+typename SpatialTree<Dim>::Vector SpatialTree<Dim>::CalculateForce(const Data &p1, TreeCounters &counters, double *potential) const
+{
+  return CalculateForce(p1, counters, potential, 0);
+}
+
+template<int Dim>
+typename SpatialTree<Dim>::Vector SpatialTree<Dim>::CalculateForce(const Data &p1, TreeCounters &counters, double *potential,
+                                                                   double lastAcceleration) const
+{
+  if (potential)
+    *potential = 0;
+
+  const double *position = GetPosition(p1.particleState);
+  double acceleration[Dim] = {0};
+
+  // Calculate the force from the tree to the particle p1
+  const double tolerance = context->accuracy * lastAcceleration;
+  if (context->mixedPrecision && context->splitScale==0)
+  {
+    static thread_local TreeInteractions<Dim> interactions;
+    interactions.Clear();
+    CalculateTreeForce(position, p1.particleState, tolerance, counters, acceleration, potential, &interactions);
+    const float offset[Dim] = {0};
+    SumInteractions(interactions, offset, acceleration, potential);
+  }
+  else
+  {
+    CalculateTreeForce(position, p1.particleState, tolerance, counters, acceleration, potential, NULL);
+  }
+
+  // Calculate the force from particles not in the tree
+  const std::vector<Data> &outsideParticles = context->outsideParticles;
+  counters.interactions += outsideParticles.size();
+  for (std::size_t i=0; i<outsideParticles.size(); ++i)
+    CalculateAcceleration(position, p1.particleState, outsideParticles[i], acceleration, potential);
+
+  return TreeTraits<Dim>::MakeVector(acceleration);
+}
+
+template<int Dim>
+bool SpatialTree<Dim>::IsAcceptable(double r, double tolerance) const
+{
+  const double size = maxBoxPosition[0] - minBoxPosition[0];
+  const double G = context->gravitationalConstant;
+
+  // The error bounds only hold outside of the sphere around the mass centre that holds the particles
+  switch (context->criterion)
+  {
+  case OPENING_OFFSET:
+    return r >= size / context->theta + centerOffset;
+  case OPENING_SALMON_WARREN:
+    // The dipole vanishes around the mass centre, 3 G B2 / ((r - b)^2 r^2) bounds the quadrupole and higher terms
+    if (tolerance>0)
+      return r > extent && 3 * G * secondMoment <= tolerance * (r - extent) * (r - extent) * r * r;
+    break;
+  case OPENING_RELATIVE:
+    if (tolerance>0)
+      return r > extent && G * nodeMass * size * size <= tolerance * r * r * r * r;
+    break;
+  default:
+    break;
+  }
+
+  return size/r <= context->theta;
+}
+
+template<int Dim>
+void SpatialTree<Dim>::CalculateTreeForce(const double *position, const State *self, double tolerance, TreeCounters &counters,
+                                          double *acceleration, double *potential, TreeInteractions<Dim> *interactions) const
+{
+  // One loop over the links of the subtree, the sums and counters stay in locals until the end
+  const double softening = context->softening;
+  const bool shortRange = context->splitScale>0;
+  double sum[Dim] = {0}, potentialSum = 0;
+  double *sumPotential = potential ? &potentialSum : NULL;
+  long long interactionCount = 0, openedCount = 0;
+
+  const SpatialTree *node = this;
+  while (node!=nextNode)
+  {
+    if (shortRange && node->IsBeyondCutoff(position))
+    {
+      // Left to the particle mesh
+      node->maxDivided = false;
+      node = node->nextNode;
+    }
+    else if (node->nodeParticlesCount==1)
+    {
+      ++interactionCount;
+      const Data &p2 = node->particleData;
+      if (p2.particleState!=self)
+      {
+        double delta[Dim];
+        const double r2 = GetSeparation(position, p2.particleState, delta);
+        if (interactions)
+          interactions->Add(delta, p2.particleParameters->mass, softening);
+        else if (r2>0)
+          AddMonopole(delta, std::sqrt(r2), p2.particleParameters->mass, sum, sumPotential);
+      }
+      node = node->nextNode;
+    }
+    else
+    {
+      double delta[Dim], r2 = 0;
+      for (int d=0; d<Dim; ++d)
+      {
+        delta[d] = node->massCenter[d] - position[d];
+        r2 += delta[d] * delta[d];
+      }
+
+      const double r = std::sqrt(r2);
+      if (node->IsAcceptable(r, tolerance))
+      {
+        ++interactionCount;
+        node->maxDivided = false;
+
+        if (interactions)
+          interactions->Add(delta, node->nodeMass, 0);
+        else
+          AddMonopole(delta, r, node->nodeMass, sum, sumPotential);
+        node = node->nextNode;
+      }
+      else
+      {
+        // Only an empty root has no child to descend to
+        ++openedCount;
+        node->maxDivided = true;
+        node = node->firstChildNode ? node->firstChildNode : node->nextNode;
+      }
+    }
+  }
+
+  for (int d=0; d<Dim; ++d)
+    acceleration[d] += sum[d];
+  if (potential)
+    *potential += potentialSum;
+  counters.interactions += interactionCount;
+  counters.nodesOpened += openedCount;
+}
+
+template<int Dim>
+void SpatialTree<Dim>::GetGroups(int maxParticles, std::vector<const SpatialTree*> &groups) const
+{
+  if (nodeParticlesCount<=maxParticles)
+  {
+    groups.push_back(this);
+    return;
+  }
+
+  for (int c=0; c<Children; ++c)
+  {
+    if (childNode[c])
+      childNode[c]->GetGroups(maxParticles, groups);
+  }
+}
+
+template<int Dim>
+void SpatialTree<Dim>::GetParticles(std::vector<Data> &particles) const
+{
+  if (nodeParticlesCount==1)
+  {
+    particles.push_back(particleData);
+    return;
+  }
+
+  for (int c=0; c<Children; ++c)
+  {
+    if (childNode[c])
+      childNode[c]->GetParticles(particles);
+  }
+}
+
+template<int Dim>
+void SpatialTree<Dim>::CalculateGroupForces(const std::vector<Data> &particles, double lastAcceleration, TreeCounters &counters,
+                                            double *accelerations, double *potentials) const
+{
+  if (particles.empty())
+    return;
+
+  // Offsets from the centre of the bounding box of the group
+  double groupMin[Dim], groupMax[Dim], center[Dim];
+  for (int d=0; d<Dim; ++d)
+  {
+    groupMin[d] = GetPosition(particles[0].particleState)[d];
+    groupMax[d] = groupMin[d];
+  }
+  for (std::size_t k=1; k<particles.size(); ++k)
+  {
+    const double *position = GetPosition(particles[k].particleState);
+    for (int d=0; d<Dim; ++d)
+    {
+      groupMin[d] = std::min(groupMin[d], position[d]);
+      groupMax[d] = std::max(groupMax[d], position[d]);
+    }
+  }
+  for (int d=0; d<Dim; ++d)
+    center[d] = groupMin[d] + (groupMax[d] - groupMin[d])/2.0;
+
+  static thread_local TreeInteractions<Dim> interactions;
+  interactions.Clear();
+  CollectGroupInteractions(center, groupMin, groupMax, context->accuracy * lastAcceleration, counters, interactions);
+
+  const std::vector<Data> &outsideParticles = context->outsideParticles;
+  const float softening = (float)context->softening;
+  for (std::size_t k=0; k<particles.size(); ++k)
+  {
+    const double *position = GetPosition(particles[k].particleState);
+    double *acceleration = &accelerations[Dim*k];
+    double *potential = potentials ? &potentials[k] : NULL;
+    float offset[Dim];
+    for (int d=0; d<Dim; ++d)
+    {
+      offset[d] = (float)(position[d] - center[d]);
+      acceleration[d] = 0;
+    }
+    if (potential)
+      *potential = 0;
+
+    SumInteractions(interactions, offset, acceleration, potential);
+
+    // The particle itself is in the list, at the softening length it only adds to the potential
+    if (potential)
+      *potential += context->gravitationalConstant * ((float)particles[k].particleParameters->mass / std::sqrt(softening));
+
+    // Without the particle itself
+    counters.interactions += interactions.GetCount() - 1 + outsideParticles.size();
+    for (std::size_t i=0; i<outsideParticles.size(); ++i)
+      CalculateAcceleration(position, particles[k].particleState, outsideParticles[i], acceleration, potential);
+  }
+}
+
+template<int Dim>
+void SpatialTree<Dim>::CollectGroupInteractions(const double *center, const double *groupMin, const double *groupMax,
+                                                double tolerance, TreeCounters &counters,
+                                                TreeInteractions<Dim> &interactions) const
+{
+  const SpatialTree *node = this;
+  while (node!=nextNode)
+  {
+    if (node->nodeParticlesCount==1)
+    {
+      const double *position = GetPosition(node->particleData.particleState);
+      double delta[Dim];
+      for (int d=0; d<Dim; ++d)
+        delta[d] = position[d] - center[d];
+      interactions.Add(delta, node->particleData.particleParameters->mass, context->softening);
+      node = node->nextNode;
+      continue;
+    }
+
+    // The criterion has to hold for the nearest point of the group
+    double delta[Dim], r2 = 0;
+    for (int d=0; d<Dim; ++d)
+    {
+      delta[d] = node->massCenter[d] - center[d];
+      const double outside = std::max(0.0, std::max(groupMin[d] - node->massCenter[d], node->massCenter[d] - groupMax[d]));
+      r2 += outside * outside;
+    }
+
+    if (node->IsAcceptable(std::sqrt(r2), tolerance))
+    {
+      interactions.Add(delta, node->nodeMass, 0);
+      node = node->nextNode;
+    }
+    else
+    {
+      ++counters.nodesOpened;
+      node = node->firstChildNode ? node->firstChildNode : node->nextNode;
+    }
+  }
+}
+
+template<int Dim>
+void SpatialTree<Dim>::SumInteractions(const TreeInteractions<Dim> &interactions, const float *offset,
+                                       double *acceleration, double *potential) const
+{
+  // Blocks short enough for float partial sums, every block is added to the double sums
+  static const int block = 64;
+  float factor[block], potentialFactor[block];
+
+  const int count = interactions.GetCount();
+  const float *delta[Dim];
+  for (int d=0; d<Dim; ++d)
+    delta[d] = interactions.delta[d].data();
+  const float *mass = interactions.mass.data(), *softening = interactions.softening.data();
+  const double G = context->gravitationalConstant;
+
+  for (int begin=0; begin<count; begin+=block)
+  {
+    const int n = std::min(block, count - begin);
+
+    #pragma omp simd
+    for (int j=0; j<n; ++j)
+    {
+      float r2 = softening[begin + j];
+      for (int d=0; d<Dim; ++d)
+        r2 += (delta[d][begin + j] - offset[d]) * (delta[d][begin + j] - offset[d]);
+      const float inverse = 1.0f / std::sqrt(r2);
+      potentialFactor[j] = mass[begin + j] * inverse;
+      factor[j] = potentialFactor[j] * inverse * inverse;
+    }
+
+    for (int d=0; d<Dim; ++d)
+    {
+      const float *component = delta[d] + begin, origin = offset[d];
+      float sum = 0;
+      #pragma omp simd reduction(+:sum)
+      for (int j=0; j<n; ++j)
+        sum += factor[j] * (component[j] - origin);
+      acceleration[d] += G * sum;
+    }
+
+    if (potential)
+    {
+      float sum = 0;
+      #pragma omp simd reduction(+:sum)
+      for (int j=0; j<n; ++j)
+        sum += potentialFactor[j];
+      *potential -= G * sum;
+    }
+  }
+}
+
+template<int Dim>
+const std::vector<typename SpatialTree<Dim>::Data>& SpatialTree<Dim>::GetOutsideParticles() const
+{
+  return context->outsideParticles;
+}
+
+template<int Dim>
+void SpatialTree<Dim>::GetTreeStatistics(int &nodes, int &depth) const
+{
+  nodes = 1;
+  depth = 0;
+  for (int c=0; c<Children; ++c)
+  {
+    if (childNode[c])
+    {
+      int childNodes, childDepth;
+      childNode[c]->GetTreeStatistics(childNodes, childDepth);
+      nodes += childNodes;
+      depth = std::max(depth, childDepth + 1);
+    }
+  }
+}
+
+template<int Dim>
+void SpatialTree<Dim>::DumpNode(int child, int level)
+{
+  for (int c=0; c<Children; ++c)
+  {
+    if (childNode[c])
+    {
+      childNode[c]->DumpNode(c, level+1);
+    }
+  }
+}
+
+template<int Dim>
+void SpatialTree<Dim>::Insert(const Data &newParticle, int level)
+{
+  const double *p1 = GetPosition(newParticle.particleState);
+
+  // Written so that NaN positions fail as well
+  for (int d=0; d<Dim; ++d)
+  {
+    if (!(p1[d] >= minBoxPosition[d] && p1[d] <= maxBoxPosition[d]))
+    {
+      std::stringstream ss;
+      ss << "Particle position (";
+      for (int i=0; i<Dim; ++i)
+        ss << (i ? ", " : "") << p1[i];
+      ss << ") is outside tree node (";
+      for (int i=0; i<Dim; ++i)
+        ss << (i ? ", " : "") << "min[" << i << "]=" << minBoxPosition[i] << ", max[" << i << "]=" << maxBoxPosition[i];
+      ss << ")";
+      throw std::runtime_error(ss.str());
+    }
+  }
+
+  if (nodeParticlesCount>1)
+  {
+    int child = GetChildIndex(p1);
+    if (!childNode[child])
+      childNode[child] = CreateChildNode(child);
+
+    childNode[child]->Insert(newParticle, level+1);
+  }
+  else if (nodeParticlesCount==1)
+  {
+    assert(IsExternal() || IsRoot());
+
+    const double *p2 = GetPosition(particleData.particleState);
+
+    bool samePosition = true;
+    for (int d=0; d<Dim; ++d)
+      samePosition = samePosition && (p1[d] == p2[d]);
+
+    if (samePosition)
+    {
+      context->outsideParticles.push_back(newParticle);
+    }
+    else
+    {
+      int child = GetChildIndex(p2);
+      if (childNode[child]==NULL)
+        childNode[child] = CreateChildNode(child);
+      childNode[child]->Insert(particleData, level+1);
+      particleData.Reset();
+
+      child = GetChildIndex(p1);
+      if (!childNode[child])
+        childNode[child] = CreateChildNode(child);
+      childNode[child]->Insert(newParticle, level+1);
+    }
+  }
+  else if (nodeParticlesCount==0)
+  {
+    particleData = newParticle;
+  }
+
+  nodeParticlesCount++;
+}
+
+// The 2D and 3D trees are compiled here
+template class SpatialTree<2>;
+template class SpatialTree<3>;
+template struct TreeInteractions<2>;
+template struct TreeInteractions<3>;
+template struct TreeContext<2>;
+template struct TreeContext<3>;
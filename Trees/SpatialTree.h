@@ -0,0 +1,226 @@
+#ifndef _SPATIALTREE
+#define _SPATIALTREE
+
+// Standard includes
+#include <vector>
+#include <memory>
+
+// Project includes
+#include "../Structs/Vectors.h"
+#include "../Structs/Particles.h"
+
+// Force traversal counters, every thread keeps its own instance
+struct TreeCounters
+{
+  TreeCounters();
+
+  long long interactions;   // particle-node and particle-particle interactions
+  long long nodesOpened;    // nodes that failed the opening criterion
+};
+
+// When a node is accepted as one mass at its mass centre, r is the distance to that centre
+enum OpeningCriterion
+{
+  OPENING_GEOMETRIC = 0,    // box width / r <= theta
+  OPENING_OFFSET,           // r >= box width / theta + distance of the mass centre from the box centre
+  OPENING_SALMON_WARREN,    // Salmon-Warren bound of the monopole error <= accuracy |a_old|
+  OPENING_RELATIVE          // G M width^2 / r^4 <= accuracy |a_old|
+};
+
+// Types of the particles in Dim dimensions. The packed particle states start with their Dim coordinates,
+// so they are read as one array.
+template<int Dim> struct TreeTraits;
+
+template<> struct TreeTraits<2>
+{
+  typedef Vector2D Vector;
+  typedef ParticleState2D State;
+  typedef ParticleData2D Data;
+
+  static Vector MakeVector(const double *c) { return Vector2D(c[0], c[1]); }
+  static void GetComponents(const Vector &v, double *c) { c[0] = v.x; c[1] = v.y; }
+  static double DefaultTheta() { return 1.0; }
+};
+
+template<> struct TreeTraits<3>
+{
+  typedef Vector3D Vector;
+  typedef ParticleState3D State;
+  typedef ParticleData3D Data;
+
+  static Vector MakeVector(const double *c) { return Vector3D(c[0], c[1], c[2]); }
+  static void GetComponents(const Vector &v, double *c) { c[0] = v.x; c[1] = v.y; c[2] = v.z; }
+  static double DefaultTheta() { return 0.5; }
+};
+
+// Interactions collected by the tree walk for the single precision kernel. The offsets are taken in double
+// from the particle or the group centre and then rounded, so they keep float precision for near and far sources.
+template<int Dim>
+struct TreeInteractions
+{
+  TreeInteractions();
+
+  void Clear();
+  void Add(const double *delta, double mass, double softening);
+  int GetCount() const;
+
+  std::vector<float> delta[Dim];
+  std::vector<float> mass;
+  std::vector<float> softening;   // 0 for nodes, the monopoles are not softened
+  int count;                      // the vectors only grow, entries from count on are unused
+};
+
+// Settings, overflow list and node memory of one tree, owned by the root and shared by all of its nodes
+template<int Dim>
+struct TreeContext
+{
+  TreeContext();
+  ~TreeContext();
+
+  double theta;
+  OpeningCriterion criterion;
+  double accuracy;      // error relative to the previous |a| of the particle, error bounded criteria only
+  double gravitationalConstant;
+  double softening;
+  double splitScale;    // TreePM split scale, 0 for the full force
+  double cutoff;
+  bool mixedPrecision;
+  std::vector<typename TreeTraits<Dim>::Data> outsideParticles;
+  // Child nodes are placed in blocks that are kept over the rebuilds. The blocks are first touched by all
+  // threads, so the nodes are spread over the sockets instead of sitting on the one of the building thread.
+  std::vector<void*> nodeBlocks;
+  std::size_t usedNodes;
+};
+
+// Barnes-Hut tree of 2^Dim children per node, Quadtree and Octree are its 2D and 3D instances.
+// Child c covers the upper half of the node along axis d when bit d of c is set.
+template<int Dim>
+class SpatialTree
+{
+public:
+
+  static constexpr int Dimensions = Dim;
+  static constexpr int Children = 1 << Dim;
+
+  typedef typename TreeTraits<Dim>::Vector Vector;
+  typedef typename TreeTraits<Dim>::State State;
+  typedef typename TreeTraits<Dim>::Data Data;
+
+  SpatialTree(const Vector &min,
+              const Vector &max,
+              SpatialTree *parent=nullptr);
+  ~SpatialTree();
+
+  void Reset(const Vector &min,
+             const Vector &max);
+
+  bool IsRoot() const;
+  bool IsExternal() const;
+  bool IsDevided() const;
+
+  void ClearStatistics();
+
+  int GetAllNodesParticles() const;
+  double GetMass() const;
+  Vector GetMassCenter() const;
+  Vector GetMinimumDimension() const;
+  Vector GetMaximumDimension() const;
+
+  double GetTheta() const;
+  void SetTheta(double newTheta);
+  OpeningCriterion GetOpeningCriterion() const;
+  double GetOpeningAccuracy() const;
+  void SetOpeningCriterion(OpeningCriterion criterion, double accuracy);
+  double GetSoftening() const;
+  void SetSoftening(double newSoftening);
+  double GetGravitationalConstant() const;
+  void SetGravitationalConstant(double G);
+  // TreePM: only the erfc(r/2rs)/r part within cutoff is summed, rs=0 restores the full force
+  double GetSplitScale() const;
+  void SetShortRange(double splitScale, double cutoff);
+  // Single precision offsets and kernel with double sums, the short range TreePM force stays in double
+  bool IsMixedPrecision() const;
+  void SetMixedPrecision(bool enabled);
+
+  void Insert(const Data &newParticle, int level);
+
+  int GetChildIndex(const double *position) const;
+  SpatialTree* CreateChildNode(int index);
+
+  void ComputeMassDistribution();
+
+  Vector CalculateForce(const Data &p) const;
+  Vector CalculateForce(const Data &p, TreeCounters &counters) const;
+  // Also sets the potential per unit mass at the particle when not NULL
+  Vector CalculateForce(const Data &p, TreeCounters &counters, double *potential) const;
+  // The error bounded criteria need the magnitude of the last acceleration of the particle, with 0
+  // they fall back to the geometric one
+  Vector CalculateForce(const Data &p, TreeCounters &counters, double *potential, double lastAcceleration) const;
+  // Nodes of at most maxParticles particles in depth first order, the leaves of a node
+  void GetGroups(int maxParticles, std::vector<const SpatialTree*> &groups) const;
+  void GetParticles(std::vector<Data> &particles) const;
+  // Mixed precision only: one walk for the particles of a group, accepted nodes hold for all of them.
+  // Dim accelerations per particle, potentials when not NULL. Needs a softening, the group is part of its own list.
+  void CalculateGroupForces(const std::vector<Data> &particles, double lastAcceleration, TreeCounters &counters,
+                            double *accelerations, double *potentials) const;
+  void GetTreeStatistics(int &nodes, int &depth) const;
+  void DumpNode(int child, int level);
+  // Particles at the position of another one, they are kept beside the tree
+  const std::vector<Data>& GetOutsideParticles() const;
+
+  static const double* GetPosition(const State *state);
+
+public:
+
+  SpatialTree *childNode[Children];
+
+private:
+
+  SpatialTree(const SpatialTree &ref);
+  SpatialTree& operator=(const SpatialTree &ref);
+
+  void SetBox(const double *min, const double *max);
+  void* AllocateNode();
+
+  // Accelerations and the potential per unit mass (when not NULL) are accumulated
+  void CalculateAcceleration(const double *position, const State *self, const Data &p2,
+                             double *acceleration, double *potential) const;
+  // Accepted nodes and leaves go to interactions instead of the sums when it is not NULL
+  void CalculateTreeForce(const double *position, const State *self, double tolerance, TreeCounters &counters,
+                          double *acceleration, double *potential, TreeInteractions<Dim> *interactions) const;
+  void CollectGroupInteractions(const double *center, const double *groupMin, const double *groupMax, double tolerance,
+                                TreeCounters &counters, TreeInteractions<Dim> &interactions) const;
+  // The offset of the particle from the centre the interactions were taken from
+  void SumInteractions(const TreeInteractions<Dim> &interactions, const float *offset,
+                       double *acceleration, double *potential) const;
+  bool IsAcceptable(double r, double tolerance) const;
+  bool IsBeyondCutoff(const double *position) const;
+  double GetShortRangeFactors(double r, double &potentialFactor) const;
+  // Offset of a particle from position, returns the squared distance with the softening
+  double GetSeparation(const double *position, const State *state, double *delta) const;
+  // Pull of a mass at offset delta and distance r, accumulated like CalculateAcceleration
+  void AddMonopole(const double *delta, double r, double mass, double *acceleration, double *potential) const;
+
+  Data particleData;
+
+  double nodeMass;
+  double massCenter[Dim];
+  double secondMoment;      // sum of m |x - mass centre|^2
+  double extent;            // bound of the distance of the particles from the mass centre
+  double centerOffset;      // distance of the mass centre from the box centre
+  double minBoxPosition[Dim];
+  double maxBoxPosition[Dim];
+  double nodeCenter[Dim];
+  SpatialTree *parentNode;
+  // Set by ComputeMassDistribution for the stackless walks: the next node after the subtree in depth first
+  // order, NULL after the root, and the first child to descend to
+  SpatialTree *firstChildNode;
+  SpatialTree *nextNode;
+  int nodeParticlesCount;
+  mutable bool maxDivided;
+
+  std::unique_ptr< TreeContext<Dim> > ownContext;   // root only
+  TreeContext<Dim> *context;
+};
+
+#endif
@@ -0,0 +1,160 @@
+// Standard includes
+#include <cmath>
+#include <algorithm>
+
+// Project includes
+#include "Diagnostics.h"
+
+namespace
+{
+  const int reductionBlock = 4096;
+  const int sums = 5;
+
+  // Kinetic and potential energy, momentum and angular momentum of particles [begin, end)
+  void AddParticles(const ParticleState2D *state, const ParticleParameters *parameters, const double *potential,
+                    const double *externalPotential, int begin, int end, double *sum)
+  {
+    for (int i=begin; i<end; ++i)
+    {
+      const ParticleState2D &s = state[i];
+      const double m = parameters[i].mass;
+
+      sum[0] += 0.5 * m * (s.velocityX*s.velocityX + s.velocityY*s.velocityY);
+      sum[1] += 0.5 * m * potential[i]; // every pair is counted twice
+      if (externalPotential)
+        sum[1] += m * externalPotential[i];
+      sum[2] += m * s.velocityX;
+      sum[3] += m * s.velocityY;
+      sum[4] += m * (s.positionX*s.velocityY - s.positionY*s.velocityX);
+    }
+  }
+}
+
+DiagnosticsSample::DiagnosticsSample()
+  :time(0)
+  ,kineticEnergy(0)
+  ,potentialEnergy(0)
+  ,totalEnergy(0)
+  ,momentumX(0)
+  ,momentumY(0)
+  ,angularMomentum(0)
+  ,virialRatio(0)
+{}
+
+Diagnostics::Diagnostics()
+  :initial()
+  ,last()
+  ,samples(0)
+  ,deterministic(false)
+  ,blockSums()
+{}
+
+void Diagnostics::Sample(const ParticleState2D *state,
+                         const ParticleParameters *parameters,
+                         const double *potential,
+                         const double *externalPotential,
+                         int particles,
+                         double time)
+{
+  double kinetic = 0, potentialEnergy = 0, momentumX = 0, momentumY = 0, angularMomentum = 0;
+  const int blocks = (particles + reductionBlock - 1) / reductionBlock;
+
+  if (deterministic)
+  {
+    blockSums.assign((std::size_t)blocks * sums, 0);
+
+    #pragma omp parallel for schedule(static)
+    for (int b=0; b<blocks; ++b)
+      AddParticles(state, parameters, potential, externalPotential, b * reductionBlock,
+                   std::min((b + 1) * reductionBlock, particles), &blockSums[(std::size_t)b * sums]);
+
+    for (int b=0; b<blocks; ++b)
+    {
+      const double *sum = &blockSums[(std::size_t)b * sums];
+      kinetic += sum[0];
+      potentialEnergy += sum[1];
+      momentumX += sum[2];
+      momentumY += sum[3];
+      angularMomentum += sum[4];
+    }
+  }
+  else
+  {
+    #pragma omp parallel for reduction(+:kinetic,potentialEnergy,momentumX,momentumY,angularMomentum)
+    for (int b=0; b<blocks; ++b)
+    {
+      double sum[sums] = {};
+      AddParticles(state, parameters, potential, externalPotential, b * reductionBlock,
+                   std::min((b + 1) * reductionBlock, particles), sum);
+
+      kinetic += sum[0];
+      potentialEnergy += sum[1];
+      momentumX += sum[2];
+      momentumY += sum[3];
+      angularMomentum += sum[4];
+    }
+  }
+
+  DiagnosticsSample sample;
+  sample.time = time;
+  sample.kineticEnergy = kinetic;
+  sample.potentialEnergy = potentialEnergy;
+  sample.momentumX = momentumX;
+  sample.momentumY = momentumY;
+  sample.angularMomentum = angularMomentum;
+  SetSample(sample);
+}
+
+void Diagnostics::SetSample(const DiagnosticsSample &sample)
+{
+  last = sample;
+  last.totalEnergy = last.kineticEnergy + last.potentialEnergy;
+  last.virialRatio = (last.potentialEnergy!=0) ? 2*last.kineticEnergy / std::fabs(last.potentialEnergy) : 0;
+
+  if (samples++==0)
+    initial = last;
+}
+
+void Diagnostics::SetDeterministic(bool enabled)
+{
+  deterministic = enabled;
+}
+
+bool Diagnostics::HasSample() const
+{
+  return samples>0;
+}
+
+const DiagnosticsSample& Diagnostics::GetSample() const
+{
+  return last;
+}
+
+const DiagnosticsSample& Diagnostics::GetInitialSample() const
+{
+  return initial;
+}
+
+double Diagnostics::GetEnergyError() const
+{
+  if (initial.totalEnergy==0)
+    return 0;
+
+  return (last.totalEnergy - initial.totalEnergy) / std::fabs(initial.totalEnergy);
+}
+
+void Diagnostics::WriteJsonLine(std::ostream &out, unsigned long long step) const
+{
+  // Energy drift is often below the default 6 digits
+  std::streamsize precision = out.precision(12);
+  out << "{\"step\":" << step << ",\"time\":" << last.time
+      << ",\"kinetic_energy\":" << last.kineticEnergy
+      << ",\"potential_energy\":" << last.potentialEnergy
+      << ",\"total_energy\":" << last.totalEnergy
+      << ",\"energy_error\":" << GetEnergyError()
+      << ",\"momentum_x\":" << last.momentumX
+      << ",\"momentum_y\":" << last.momentumY
+      << ",\"angular_momentum\":" << last.angularMomentum
+      << ",\"virial_ratio\":" << last.virialRatio << "}\n";
+  out.precision(precision);
+}
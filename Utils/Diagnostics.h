@@ -0,0 +1,65 @@
+#ifndef _DIAGNOSTICS
+#define _DIAGNOSTICS
+
+// Standard includes
+#include <ostream>
+#include <vector>
+
+// Project includes
+#include "../Structs/Particles.h"
+
+// Conservation diagnostics of one sampled state, in solar masses, parsecs and years
+struct DiagnosticsSample
+{
+  DiagnosticsSample();
+
+  double time;
+  double kineticEnergy;
+  double potentialEnergy;
+  double totalEnergy;
+  double momentumX;
+  double momentumY;
+  double angularMomentum;   // about the origin
+  double virialRatio;       // 2K/|W|, 1 in equilibrium
+};
+
+class Diagnostics
+{
+public:
+
+  Diagnostics();
+
+  // Reduces a state whose potential per unit mass was filled by the force pass,
+  // the external potential (analytic halos, may be NULL) is not shared between pairs
+  void Sample(const ParticleState2D *state,
+              const ParticleParameters *parameters,
+              const double *potential,
+              const double *externalPotential,
+              int particles,
+              double time);
+
+  // Records a sample reduced elsewhere, e.g. summed over MPI ranks
+  void SetSample(const DiagnosticsSample &sample);
+
+  // Sums fixed blocks of particles and then the blocks in order, independent of the thread count
+  void SetDeterministic(bool enabled);
+
+  bool HasSample() const;
+  const DiagnosticsSample& GetSample() const;
+  const DiagnosticsSample& GetInitialSample() const;
+
+  // Drift of the total energy since the first sample
+  double GetEnergyError() const;
+
+  void WriteJsonLine(std::ostream &out, unsigned long long step) const;
+
+private:
+
+  DiagnosticsSample initial;
+  DiagnosticsSample last;
+  unsigned long long samples;
+  bool deterministic;
+  std::vector<double> blockSums;
+};
+
+#endif
@@ -0,0 +1,108 @@
+// Standard includes
+#include <cmath>
+#include <stdexcept>
+#include <algorithm>
+
+// Project includes
+#include "FFT.h"
+
+FFT2D::FFT2D(int n)
+  :size(n)
+  ,bitReversed(n)
+  ,twiddles(n/2)
+{
+  if (!IsPowerOfTwo(n))
+    throw std::runtime_error("FFT size must be a power of two.");
+
+  int bits = 0;
+  while ((1 << bits) < n)
+    ++bits;
+
+  for (int i=0; i<n; ++i)
+  {
+    int reversed = 0;
+    for (int b=0; b<bits; ++b)
+      reversed |= ((i >> b) & 1) << (bits - 1 - b);
+    bitReversed[i] = reversed;
+  }
+
+  for (int i=0; i<n/2; ++i)
+    twiddles[i] = std::polar(1.0, -2 * M_PI * i / n);
+}
+
+bool FFT2D::IsPowerOfTwo(int n)
+{
+  return n>0 && (n & (n - 1))==0;
+}
+
+int FFT2D::GetSize() const
+{
+  return size;
+}
+
+void FFT2D::Forward(std::vector< std::complex<double> > &grid) const
+{
+  Transform(grid, false);
+}
+
+void FFT2D::Inverse(std::vector< std::complex<double> > &grid) const
+{
+  Transform(grid, true);
+
+  const double scale = 1.0 / ((double)size * size);
+  const long long cells = (long long)size * size;
+
+  #pragma omp parallel for schedule(static)
+  for (long long i=0; i<cells; ++i)
+    grid[i] *= scale;
+}
+
+void FFT2D::Transform(std::vector< std::complex<double> > &grid, bool inverse) const
+{
+  #pragma omp parallel
+  {
+    #pragma omp for schedule(static)
+    for (int row=0; row<size; ++row)
+      Transform1D(&grid[(long long)row * size], inverse);
+
+    // Columns are gathered into a contiguous buffer of every thread
+    std::vector< std::complex<double> > column(size);
+
+    #pragma omp for schedule(static)
+    for (int col=0; col<size; ++col)
+    {
+      for (int row=0; row<size; ++row)
+        column[row] = grid[(long long)row * size + col];
+
+      Transform1D(&column[0], inverse);
+
+      for (int row=0; row<size; ++row)
+        grid[(long long)row * size + col] = column[row];
+    }
+  }
+}
+
+void FFT2D::Transform1D(std::complex<double> *data, bool inverse) const
+{
+  for (int i=0; i<size; ++i)
+  {
+    if (i<bitReversed[i])
+      std::swap(data[i], data[bitReversed[i]]);
+  }
+
+  // Iterative Cooley-Tukey butterflies
+  for (int length=2; length<=size; length<<=1)
+  {
+    const int half = length / 2, step = size / length;
+    for (int start=0; start<size; start+=length)
+    {
+      for (int k=0; k<half; ++k)
+      {
+        std::complex<double> w = inverse ? std::conj(twiddles[k*step]) : twiddles[k*step];
+        std::complex<double> odd = w * data[start + k + half];
+        data[start + k + half] = data[start + k] - odd;
+        data[start + k] += odd;
+      }
+    }
+  }
+}
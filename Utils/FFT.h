@@ -0,0 +1,33 @@
+#ifndef _FFT
+#define _FFT
+
+// Standard includes
+#include <vector>
+#include <complex>
+
+// Radix-2 complex FFT of a square size x size grid stored row by row.
+// Rows and then columns are transformed in parallel, the inverse is scaled by 1/size^2.
+class FFT2D
+{
+public:
+
+  explicit FFT2D(int size);
+
+  int GetSize() const;
+
+  void Forward(std::vector< std::complex<double> > &grid) const;
+  void Inverse(std::vector< std::complex<double> > &grid) const;
+
+  static bool IsPowerOfTwo(int n);
+
+private:
+
+  void Transform(std::vector< std::complex<double> > &grid, bool inverse) const;
+  void Transform1D(std::complex<double> *data, bool inverse) const;
+
+  int size;
+  std::vector<int> bitReversed;
+  std::vector< std::complex<double> > twiddles;
+};
+
+#endif
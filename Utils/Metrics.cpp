@@ -0,0 +1,234 @@
+// Standard includes
+#include <cstring>
+#include <algorithm>
+
+// Project includes
+#include "Metrics.h"
+
+namespace
+{
+  const char *phaseNames[Metrics::PHASES] = {"tree_build", "mass_distribution", "force", "integrator", "render"};
+  const char *counterNames[Metrics::COUNTERS] = {"interactions", "nodes_opened"};
+}
+
+Metrics::Metrics()
+  :threadSlots()
+  ,lastNodeTraffic()
+  ,peakBandwidth(0)
+  ,treeNodes(0)
+  ,treeDepth(0)
+  ,steps(0)
+{
+  memset(currentPhases, 0, sizeof(currentPhases));
+  memset(lastPhases, 0, sizeof(lastPhases));
+  memset(totalPhases, 0, sizeof(totalPhases));
+  memset(lastCounters, 0, sizeof(lastCounters));
+  memset(totalCounters, 0, sizeof(totalCounters));
+}
+
+const char* Metrics::GetPhaseName(Phase phase)
+{
+  return phaseNames[phase];
+}
+
+const char* Metrics::GetCounterName(Counter counter)
+{
+  return counterNames[counter];
+}
+
+void Metrics::AddPhaseTime(Phase phase, double seconds)
+{
+  currentPhases[phase] += seconds;
+}
+
+void Metrics::PrepareThreads(int threads)
+{
+  // Must be called outside of parallel regions
+  if ((int)threadSlots.size()<threads)
+  {
+    ThreadSlot empty;
+    memset(&empty, 0, sizeof(empty));
+    threadSlots.resize(threads, empty);
+  }
+}
+
+void Metrics::AddThreadCounters(int thread, long long interactions, long long nodesOpened)
+{
+  // Every thread owns its slot, no synchronization needed
+  ThreadSlot &slot = threadSlots[thread];
+  slot.values[INTERACTIONS] += interactions;
+  slot.values[NODES_OPENED] += nodesOpened;
+}
+
+void Metrics::AddThreadTraffic(int thread, int node, long long bytes)
+{
+  ThreadSlot &slot = threadSlots[thread];
+  slot.traffic += bytes;
+  slot.node = node;
+}
+
+void Metrics::SetPeakBandwidth(double bytesPerSecond)
+{
+  peakBandwidth = bytesPerSecond;
+}
+
+void Metrics::SetTreeStatistics(int nodes, int depth)
+{
+  treeNodes = nodes;
+  treeDepth = depth;
+}
+
+void Metrics::EndStep(double stepSeconds)
+{
+  // Integrator arithmetic is what is left of the step after the model phases
+  double model = currentPhases[TREE_BUILD] + currentPhases[MASS_DISTRIBUTION] + currentPhases[FORCE];
+  currentPhases[INTEGRATOR] += std::max(stepSeconds - model, 0.0);
+
+  for (int p=0; p<PHASES; ++p)
+  {
+    lastPhases[p] = currentPhases[p];
+    totalPhases[p] += currentPhases[p];
+    currentPhases[p] = 0;
+  }
+
+  for (int c=0; c<COUNTERS; ++c)
+  {
+    lastCounters[c] = 0;
+    for (std::size_t t=0; t<threadSlots.size(); ++t)
+    {
+      lastCounters[c] += threadSlots[t].values[c];
+      threadSlots[t].values[c] = 0;
+    }
+    totalCounters[c] += lastCounters[c];
+  }
+
+  // Threads may have moved between nodes unless pinned, the traffic goes to the last one seen
+  lastNodeTraffic.clear();
+  for (std::size_t t=0; t<threadSlots.size(); ++t)
+  {
+    ThreadSlot &slot = threadSlots[t];
+    if (slot.traffic==0)
+      continue;
+
+    if ((int)lastNodeTraffic.size()<=slot.node)
+      lastNodeTraffic.resize(slot.node + 1, 0);
+    lastNodeTraffic[slot.node] += slot.traffic;
+    slot.traffic = 0;
+  }
+
+  ++steps;
+}
+
+double Metrics::GetPhaseTime(Phase phase) const
+{
+  return lastPhases[phase];
+}
+
+long long Metrics::GetCounter(Counter counter) const
+{
+  return lastCounters[counter];
+}
+
+int Metrics::GetTreeNodes() const
+{
+  return treeNodes;
+}
+
+int Metrics::GetTreeDepth() const
+{
+  return treeDepth;
+}
+
+unsigned long long Metrics::GetSteps() const
+{
+  return steps;
+}
+
+int Metrics::GetMemoryNodes() const
+{
+  return (int)lastNodeTraffic.size();
+}
+
+double Metrics::GetNodeBandwidth(int node) const
+{
+  return (lastPhases[FORCE]>0) ? lastNodeTraffic[node] / lastPhases[FORCE] : 0;
+}
+
+double Metrics::GetNodeUtilization(int node) const
+{
+  return (peakBandwidth>0) ? GetNodeBandwidth(node) / peakBandwidth : 0;
+}
+
+void Metrics::WriteJsonLine(std::ostream &out, unsigned long long step, double time) const
+{
+  out << "{\"step\":" << step << ",\"time\":" << time;
+  for (int p=0; p<PHASES; ++p)
+    out << ",\"" << phaseNames[p] << "_seconds\":" << lastPhases[p];
+  for (int c=0; c<COUNTERS; ++c)
+    out << ",\"" << counterNames[c] << "\":" << lastCounters[c];
+  out << ",\"tree_nodes\":" << treeNodes << ",\"tree_depth\":" << treeDepth;
+  if (!lastNodeTraffic.empty())
+  {
+    out << ",\"node_bandwidth\":[";
+    for (int n=0; n<GetMemoryNodes(); ++n)
+      out << (n ? "," : "") << GetNodeBandwidth(n);
+    out << "]";
+    if (peakBandwidth>0)
+    {
+      out << ",\"node_utilization\":[";
+      for (int n=0; n<GetMemoryNodes(); ++n)
+        out << (n ? "," : "") << GetNodeUtilization(n);
+      out << "]";
+    }
+  }
+  out << "}\n";
+}
+
+void Metrics::WritePrometheus(std::ostream &out, unsigned long long step, double time) const
+{
+  out << "# TYPE galaxy_step counter\ngalaxy_step " << step << "\n";
+  out << "# TYPE galaxy_simulation_time gauge\ngalaxy_simulation_time " << time << "\n";
+
+  out << "# TYPE galaxy_phase_seconds gauge\n";
+  for (int p=0; p<PHASES; ++p)
+    out << "galaxy_phase_seconds{phase=\"" << phaseNames[p] << "\"} " << lastPhases[p] << "\n";
+
+  out << "# TYPE galaxy_phase_seconds_total counter\n";
+  for (int p=0; p<PHASES; ++p)
+    out << "galaxy_phase_seconds_total{phase=\"" << phaseNames[p] << "\"} " << totalPhases[p] << "\n";
+
+  for (int c=0; c<COUNTERS; ++c)
+  {
+    out << "# TYPE galaxy_" << counterNames[c] << " gauge\ngalaxy_" << counterNames[c] << " " << lastCounters[c] << "\n";
+    out << "# TYPE galaxy_" << counterNames[c] << "_total counter\ngalaxy_" << counterNames[c] << "_total " << totalCounters[c] << "\n";
+  }
+
+  out << "# TYPE galaxy_tree_nodes gauge\ngalaxy_tree_nodes " << treeNodes << "\n";
+  out << "# TYPE galaxy_tree_depth gauge\ngalaxy_tree_depth " << treeDepth << "\n";
+
+  if (lastNodeTraffic.empty())
+    return;
+
+  out << "# TYPE galaxy_node_bandwidth_bytes gauge\n";
+  for (int n=0; n<GetMemoryNodes(); ++n)
+    out << "galaxy_node_bandwidth_bytes{node=\"" << n << "\"} " << GetNodeBandwidth(n) << "\n";
+
+  if (peakBandwidth<=0)
+    return;
+
+  out << "# TYPE galaxy_node_bandwidth_utilization gauge\n";
+  for (int n=0; n<GetMemoryNodes(); ++n)
+    out << "galaxy_node_bandwidth_utilization{node=\"" << n << "\"} " << GetNodeUtilization(n) << "\n";
+}
+
+ScopedPhase::ScopedPhase(Metrics &phaseMetrics, Metrics::Phase timedPhase)
+  :metrics(phaseMetrics)
+  ,phase(timedPhase)
+  ,start(std::chrono::steady_clock::now())
+{}
+
+ScopedPhase::~ScopedPhase()
+{
+  std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+  metrics.AddPhaseTime(phase, elapsed.count());
+}
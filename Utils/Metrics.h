@@ -0,0 +1,101 @@
+#ifndef _METRICS
+#define _METRICS
+
+// Standard includes
+#include <string>
+#include <vector>
+#include <chrono>
+#include <ostream>
+
+class Metrics
+{
+public:
+
+  enum Phase
+  {
+    TREE_BUILD = 0,
+    MASS_DISTRIBUTION,
+    FORCE,
+    INTEGRATOR,
+    RENDER,
+    PHASES
+  };
+
+  enum Counter
+  {
+    INTERACTIONS = 0,   // particle-node and particle-particle force evaluations
+    NODES_OPENED,       // tree nodes descended into during the force traversal
+    COUNTERS
+  };
+
+  Metrics();
+
+  // Phase times and counters are accumulated over all model evaluations of one step
+  void AddPhaseTime(Phase phase, double seconds);
+  void PrepareThreads(int threads);
+  void AddThreadCounters(int thread, long long interactions, long long nodesOpened);
+  // Bytes a thread on this NUMA node read from memory in the force pass
+  void AddThreadTraffic(int thread, int node, long long bytes);
+  void SetTreeStatistics(int nodes, int depth);
+  void SetPeakBandwidth(double bytesPerSecond);
+  void EndStep(double stepSeconds);
+
+  double GetPhaseTime(Phase phase) const;
+  long long GetCounter(Counter counter) const;
+  int GetTreeNodes() const;
+  int GetTreeDepth() const;
+  unsigned long long GetSteps() const;
+  // Per node memory bandwidth of the force pass, no nodes without hardware counters
+  int GetMemoryNodes() const;
+  double GetNodeBandwidth(int node) const;
+  // Fraction of the configured peak, 0 when it is unknown
+  double GetNodeUtilization(int node) const;
+
+  void WriteJsonLine(std::ostream &out, unsigned long long step, double time) const;
+  void WritePrometheus(std::ostream &out, unsigned long long step, double time) const;
+
+  static const char* GetPhaseName(Phase phase);
+  static const char* GetCounterName(Counter counter);
+
+private:
+
+  // One slot per thread, padded to two cache lines so threads never share a line
+  struct ThreadSlot
+  {
+    long long values[COUNTERS];
+    long long traffic;
+    int node;
+    char padding[128 - (COUNTERS + 1)*sizeof(long long) - sizeof(int)];
+  };
+
+  std::vector<ThreadSlot> threadSlots;
+  double currentPhases[PHASES];
+  double lastPhases[PHASES];
+  double totalPhases[PHASES];
+  long long lastCounters[COUNTERS];
+  long long totalCounters[COUNTERS];
+  std::vector<long long> lastNodeTraffic;
+  double peakBandwidth;
+  int treeNodes;
+  int treeDepth;
+  unsigned long long steps;
+};
+
+class ScopedPhase
+{
+public:
+
+  ScopedPhase(Metrics &metrics, Metrics::Phase phase);
+  ~ScopedPhase();
+
+private:
+
+  ScopedPhase(const ScopedPhase &ref);
+  ScopedPhase& operator=(const ScopedPhase &ref);
+
+  Metrics &metrics;
+  Metrics::Phase phase;
+  std::chrono::steady_clock::time_point start;
+};
+
+#endif
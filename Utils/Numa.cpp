@@ -0,0 +1,267 @@
+// Standard includes
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <algorithm>
+#include <fstream>
+#include <mutex>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include <omp.h>
+
+// Project includes
+#include "Numa.h"
+
+namespace
+{
+  const std::size_t hugePageSize = 2 << 20;
+  const std::size_t headerSize = 64;    // keeps the data cache line aligned
+
+  struct MappingHeader
+  {
+    void *base;
+    std::size_t length;
+  };
+
+  bool useHugePages = false;
+  Numa::Affinity threadAffinity = Numa::NONE;
+  int pinnedThreads = 0;
+  std::mutex settingsMutex;     // models of an ensemble may pass at the same time
+
+  int ReadNode(int cpu)
+  {
+    // The cpu directory links to its node
+    for (int node=0; node<1024; ++node)
+    {
+      char path[128];
+      snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/node%d", cpu, node);
+      if (access(path, F_OK)==0)
+        return node;
+      snprintf(path, sizeof(path), "/sys/devices/system/node/node%d", node);
+      if (access(path, F_OK)!=0)
+        break;
+    }
+    return 0;
+  }
+
+  std::vector<int> ReadCpuNodes()
+  {
+    const long cpus = std::max(sysconf(_SC_NPROCESSORS_CONF), 1L);
+    std::vector<int> nodes(cpus);
+    for (long c=0; c<cpus; ++c)
+      nodes[c] = ReadNode((int)c);
+    return nodes;
+  }
+
+  // Node of every cpu, read once
+  const std::vector<int>& GetCpuNodes()
+  {
+    static const std::vector<int> nodes = ReadCpuNodes();
+    return nodes;
+  }
+
+  // Cpus of the process before any thread was pinned
+  const cpu_set_t& GetAllowedCpus()
+  {
+    struct AllowedCpus
+    {
+      AllowedCpus()
+      {
+        CPU_ZERO(&set);
+        if (sched_getaffinity(0, sizeof(set), &set)!=0)
+          CPU_ZERO(&set);
+      }
+      cpu_set_t set;
+    };
+
+    static const AllowedCpus allowed;
+    return allowed.set;
+  }
+
+  struct MissCounter
+  {
+    MissCounter()
+      :descriptor(-1)
+    {
+      perf_event_attr attributes;
+      memset(&attributes, 0, sizeof(attributes));
+      attributes.size = sizeof(attributes);
+      attributes.type = PERF_TYPE_HARDWARE;
+      attributes.config = PERF_COUNT_HW_CACHE_MISSES;
+      attributes.exclude_kernel = 1;
+      attributes.exclude_hv = 1;
+      descriptor = (int)syscall(SYS_perf_event_open, &attributes, 0, -1, -1, 0);
+    }
+
+    ~MissCounter()
+    {
+      if (descriptor>=0)
+        close(descriptor);
+    }
+
+    int descriptor;
+  };
+}
+
+void Numa::Configure(bool hugePages, Affinity affinity)
+{
+  std::lock_guard<std::mutex> lock(settingsMutex);
+  useHugePages = hugePages;
+  if (affinity!=threadAffinity)
+    pinnedThreads = 0;
+  threadAffinity = affinity;
+}
+
+Numa::Affinity Numa::GetAffinity(const std::string &name)
+{
+  if (name=="close")
+    return CLOSE;
+  else if (name=="spread")
+    return SPREAD;
+  else if (name.empty() || name=="none")
+    return NONE;
+
+  throw std::runtime_error("Unknown thread affinity '" + name + "', use none, close or spread.");
+}
+
+bool Numa::GetHugePages()
+{
+  return useHugePages;
+}
+
+int Numa::GetNodes()
+{
+  const std::vector<int> &nodes = GetCpuNodes();
+  return *std::max_element(nodes.begin(), nodes.end()) + 1;
+}
+
+int Numa::GetCurrentNode()
+{
+  const int cpu = sched_getcpu();
+  const std::vector<int> &nodes = GetCpuNodes();
+  return (cpu>=0 && cpu<(int)nodes.size()) ? nodes[cpu] : 0;
+}
+
+void* Numa::Allocate(std::size_t count, std::size_t elementSize)
+{
+  const std::size_t bytes = count * elementSize;
+  const std::size_t alignment = useHugePages ? hugePageSize : 0;
+  const std::size_t length = headerSize + bytes + alignment;
+
+  void *base = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (base==MAP_FAILED)
+    throw std::runtime_error("Can't map memory for the particle arrays.");
+
+  char *start = static_cast<char*>(base);
+  if (useHugePages)
+  {
+    // Transparent huge pages need 2 MB aligned ranges, the hint is ignored where they are off
+    start += (hugePageSize - (std::size_t)start % hugePageSize) % hugePageSize;
+    madvise(start, headerSize + bytes, MADV_HUGEPAGE);
+  }
+
+  MappingHeader *header = reinterpret_cast<MappingHeader*>(start);
+  header->base = base;
+  header->length = length;
+  char *data = start + headerSize;
+
+  // First touch in the static partition of the force loop
+  #pragma omp parallel
+  {
+    const std::size_t threads = omp_get_num_threads(), thread = omp_get_thread_num();
+    const std::size_t chunk = count / threads, rest = count % threads;
+    const std::size_t begin = thread * chunk + std::min(thread, rest);
+    const std::size_t end = begin + chunk + (thread<rest ? 1 : 0);
+    memset(data + begin * elementSize, 0, (end - begin) * elementSize);
+  }
+
+  return data;
+}
+
+void Numa::Free(void *memory)
+{
+  if (memory==NULL)
+    return;
+
+  const MappingHeader *header = reinterpret_cast<const MappingHeader*>(static_cast<char*>(memory) - headerSize);
+  munmap(header->base, header->length);
+}
+
+std::vector<int> Numa::GetCpuOrder()
+{
+  const cpu_set_t &allowed = GetAllowedCpus();
+  const std::vector<int> &nodes = GetCpuNodes();
+  std::vector<std::vector<int> > nodeCpus(GetNodes());
+  for (int c=0; c<(int)nodes.size() && c<CPU_SETSIZE; ++c)
+  {
+    if (CPU_ISSET(c, &allowed))
+      nodeCpus[nodes[c]].push_back(c);
+  }
+
+  std::size_t cpus = 0, mostCpus = 0;
+  for (std::size_t n=0; n<nodeCpus.size(); ++n)
+  {
+    cpus += nodeCpus[n].size();
+    mostCpus = std::max(mostCpus, nodeCpus[n].size());
+  }
+
+  std::vector<int> order;
+  order.reserve(cpus);
+  if (threadAffinity==CLOSE)
+  {
+    for (std::size_t n=0; n<nodeCpus.size(); ++n)
+      order.insert(order.end(), nodeCpus[n].begin(), nodeCpus[n].end());
+  }
+  else
+  {
+    // Round robin over the nodes
+    for (std::size_t i=0; i<mostCpus; ++i)
+    {
+      for (std::size_t n=0; n<nodeCpus.size(); ++n)
+      {
+        if (i<nodeCpus[n].size())
+          order.push_back(nodeCpus[n][i]);
+      }
+    }
+  }
+
+  return order;
+}
+
+void Numa::PinThreads(int threads)
+{
+  std::lock_guard<std::mutex> lock(settingsMutex);
+  if (threadAffinity==NONE || threads==pinnedThreads || omp_in_parallel())
+    return;
+
+  const std::vector<int> order = GetCpuOrder();
+  if (order.empty())
+    return;
+
+  #pragma omp parallel num_threads(threads)
+  {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(order[omp_get_thread_num() % order.size()], &set);
+    sched_setaffinity(0, sizeof(set), &set);
+  }
+
+  pinnedThreads = threads;
+}
+
+long long Numa::ReadThreadMisses()
+{
+  // Opened by every thread for itself on first use
+  static thread_local MissCounter counter;
+  if (counter.descriptor<0)
+    return -1;
+
+  long long misses = 0;
+  if (read(counter.descriptor, &misses, sizeof(misses))!=(ssize_t)sizeof(misses))
+    return -1;
+
+  return misses;
+}
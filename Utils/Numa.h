@@ -0,0 +1,53 @@
+#ifndef _NUMA
+#define _NUMA
+
+// Standard includes
+#include <cstddef>
+#include <string>
+#include <vector>
+
+// NUMA placement of the large arrays and thread pinning. Arrays are mapped untouched and zeroed by the current
+// thread team in static chunks, the same partition as the force loop, so every page lands on the socket of the
+// thread that works on it.
+class Numa
+{
+public:
+
+  enum Affinity
+  {
+    NONE = 0,   // threads left to the scheduler
+    CLOSE,      // consecutive threads on consecutive cores, one socket is filled first
+    SPREAD      // consecutive threads alternate between the sockets
+  };
+
+  // Process wide, set once before the first allocation
+  static void Configure(bool hugePages, Affinity affinity);
+  static Affinity GetAffinity(const std::string &name);
+  static bool GetHugePages();
+
+  static int GetNodes();
+  static int GetCurrentNode();
+
+  // Zeroed memory for count elements, Free releases it
+  template<class T>
+  static T* AllocateArray(std::size_t count)
+  {
+    return static_cast<T*>(Allocate(count, sizeof(T)));
+  }
+  static void* Allocate(std::size_t count, std::size_t elementSize);
+  static void Free(void *memory);
+
+  // Pins the threads of the next parallel regions of this size, only outside of parallel regions
+  static void PinThreads(int threads);
+
+  // Last level cache misses of the calling thread so far, -1 when the hardware counters are not available
+  static long long ReadThreadMisses();
+
+  static const int cacheLine = 64;
+
+private:
+
+  static std::vector<int> GetCpuOrder();
+};
+
+#endif
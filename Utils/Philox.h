@@ -0,0 +1,55 @@
+#ifndef _PHILOX
+#define _PHILOX
+
+// Standard includes
+#include <stdint.h>
+
+// Philox4x32-10 counter-based random number generator (Salmon et al., SC'11).
+// Every (key, counter) pair maps to its own four random words, so any particle
+// can draw its numbers independently of the order and of the thread doing it.
+class Philox
+{
+public:
+
+  explicit Philox(uint64_t seed)
+  {
+    key[0] = (uint32_t)seed;
+    key[1] = (uint32_t)(seed >> 32);
+  }
+
+  void Generate(uint32_t counter0, uint32_t counter1, uint32_t counter2, uint32_t counter3, uint32_t result[4]) const
+  {
+    uint32_t c[4] = {counter0, counter1, counter2, counter3};
+    uint32_t k[2] = {key[0], key[1]};
+
+    for (int round=0; round<10; ++round)
+    {
+      uint64_t product0 = (uint64_t)0xD2511F53 * c[0],
+               product1 = (uint64_t)0xCD9E8D57 * c[2];
+
+      uint32_t next[4] = {(uint32_t)(product1 >> 32) ^ c[1] ^ k[0],
+                          (uint32_t)product1,
+                          (uint32_t)(product0 >> 32) ^ c[3] ^ k[1],
+                          (uint32_t)product0};
+
+      c[0] = next[0]; c[1] = next[1]; c[2] = next[2]; c[3] = next[3];
+      k[0] += 0x9E3779B9;
+      k[1] += 0xBB67AE85;
+    }
+
+    result[0] = c[0]; result[1] = c[1]; result[2] = c[2]; result[3] = c[3];
+  }
+
+  // Uniform double in [0,1) from 53 random bits
+  static double ToUniform(uint32_t high, uint32_t low)
+  {
+    uint64_t bits = ((uint64_t)high << 21) ^ (low >> 11);
+    return bits * (1.0 / 9007199254740992.0);
+  }
+
+private:
+
+  uint32_t key[2];
+};
+
+#endif
@@ -0,0 +1,171 @@
+// Standard includes
+#include <fstream>
+#include <stdexcept>
+#include <sstream>
+#include <cstdio>
+
+// Library includes
+#include <omp.h>
+
+// Project includes
+#include "Tracer.h"
+
+bool Tracer::enabled = false;
+std::size_t Tracer::capacity = 0;
+std::chrono::steady_clock::time_point Tracer::origin = std::chrono::steady_clock::now();
+std::mutex Tracer::registryMutex;
+std::vector<Tracer::ThreadBuffer*> Tracer::buffers;
+thread_local Tracer::ThreadBuffer* Tracer::threadBuffer = NULL;
+
+namespace
+{
+  void WriteEscaped(std::ostream &out, const std::string &text)
+  {
+    for (std::size_t i=0; i<text.size(); ++i)
+    {
+      if (text[i]=='"' || text[i]=='\\')
+        out << '\\';
+      out << text[i];
+    }
+  }
+}
+
+bool Tracer::Enable(std::size_t eventsPerThread)
+{
+#ifdef TRACING
+  // Must be called before the first traced scope
+  capacity = eventsPerThread;
+  origin = std::chrono::steady_clock::now();
+  enabled = capacity>0;
+  return true;
+#else
+  return false;
+#endif
+}
+
+bool Tracer::IsEnabled()
+{
+  return enabled;
+}
+
+int64_t Tracer::GetTimestamp()
+{
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - origin).count();
+}
+
+Tracer::ThreadBuffer* Tracer::GetThreadBuffer()
+{
+  if (threadBuffer)
+    return threadBuffer;
+
+  // First event of this thread, the only time the lock is taken
+  ThreadBuffer *buffer = new ThreadBuffer();
+  buffer->events.resize(capacity);
+  buffer->count = 0;
+  buffer->dropped = 0;
+
+  std::ostringstream name;
+  if (omp_in_parallel())
+    name << "OpenMP thread " << omp_get_thread_num();
+  else
+    name << "Thread";
+
+  {
+    std::lock_guard<std::mutex> lock(registryMutex);
+    buffer->id = (int)buffers.size();
+    if (!omp_in_parallel())
+      name << " " << buffer->id;
+    buffer->name = name.str();
+    buffers.push_back(buffer);
+  }
+
+  threadBuffer = buffer;
+  return buffer;
+}
+
+void Tracer::Record(const char *name, int64_t begin, int64_t end)
+{
+  ThreadBuffer *buffer = GetThreadBuffer();
+
+  std::size_t count = buffer->count.load(std::memory_order_relaxed);
+  if (count>=buffer->events.size())
+  {
+    buffer->dropped.fetch_add(1, std::memory_order_relaxed);
+    return;
+  }
+
+  ThreadBuffer::Event &event = buffer->events[count];
+  event.name = name;
+  event.begin = begin;
+  event.end = end;
+  buffer->count.store(count + 1, std::memory_order_release);
+}
+
+void Tracer::SetThreadName(const std::string &name)
+{
+  if (!enabled)
+    return;
+
+  ThreadBuffer *buffer = GetThreadBuffer();
+  std::lock_guard<std::mutex> lock(registryMutex);
+  buffer->name = name;
+}
+
+uint64_t Tracer::GetEventsCount()
+{
+  std::lock_guard<std::mutex> lock(registryMutex);
+  uint64_t events = 0;
+  for (std::size_t i=0; i<buffers.size(); ++i)
+    events += buffers[i]->count.load(std::memory_order_acquire);
+  return events;
+}
+
+uint64_t Tracer::GetDroppedEvents()
+{
+  std::lock_guard<std::mutex> lock(registryMutex);
+  uint64_t dropped = 0;
+  for (std::size_t i=0; i<buffers.size(); ++i)
+    dropped += buffers[i]->dropped.load(std::memory_order_relaxed);
+  return dropped;
+}
+
+void Tracer::Dump(const std::string &fileName)
+{
+  // Written next to the target and renamed, a viewer never loads half a trace
+  std::string tempName = fileName + ".tmp";
+  std::ofstream out(tempName.c_str());
+  if (!out)
+    throw std::runtime_error("Cannot create trace file " + tempName);
+
+  out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+  out.precision(3);
+  out << std::fixed;
+
+  bool first = true;
+  std::lock_guard<std::mutex> lock(registryMutex);
+  for (std::size_t b=0; b<buffers.size(); ++b)
+  {
+    const ThreadBuffer *buffer = buffers[b];
+
+    out << (first ? "" : ",\n") << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << buffer->id << ",\"args\":{\"name\":\"";
+    WriteEscaped(out, buffer->name);
+    out << "\"}}";
+    first = false;
+
+    // Timestamps and durations are in microseconds
+    std::size_t count = buffer->count.load(std::memory_order_acquire);
+    for (std::size_t i=0; i<count; ++i)
+    {
+      const ThreadBuffer::Event &event = buffer->events[i];
+      out << ",\n{\"name\":\"";
+      WriteEscaped(out, event.name);
+      out << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << buffer->id
+          << ",\"ts\":" << event.begin * 1e-3 << ",\"dur\":" << (event.end - event.begin) * 1e-3 << "}";
+    }
+  }
+  out << "\n]}\n";
+  out.close();
+
+  if (!out || std::rename(tempName.c_str(), fileName.c_str())!=0)
+    throw std::runtime_error("Cannot write trace file " + fileName);
+}
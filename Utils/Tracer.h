@@ -0,0 +1,100 @@
+#ifndef _TRACER
+#define _TRACER
+
+// Standard includes
+#include <string>
+#include <vector>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+// Timeline of the execution of every thread, written in the Chrome trace-event
+// format (chrome://tracing, ui.perfetto.dev).
+//
+// Scopes are only recorded when the code is compiled with -DTRACING and the
+// tracer was enabled at run time. Without TRACING the TRACE_SCOPE macro expands
+// to nothing, so the instrumented code is exactly the untraced code.
+class Tracer
+{
+public:
+
+  // Preallocates eventsPerThread events for every thread that records,
+  // returns false if the tracer wasn't compiled in
+  static bool Enable(std::size_t eventsPerThread);
+  static bool IsEnabled();
+
+  static int64_t GetTimestamp();
+  static void Record(const char *name, int64_t begin, int64_t end);
+  static void SetThreadName(const std::string &name);
+
+  // Writes all events recorded so far, recording threads may keep running
+  static void Dump(const std::string &fileName);
+  static uint64_t GetEventsCount();
+  static uint64_t GetDroppedEvents();
+
+private:
+
+  // Written only by its own thread, the count publishes the events to Dump
+  struct ThreadBuffer
+  {
+    struct Event
+    {
+      const char *name;
+      int64_t begin;
+      int64_t end;
+    };
+
+    std::vector<Event> events;
+    std::atomic<std::size_t> count;
+    std::atomic<uint64_t> dropped;
+    std::string name;
+    int id;
+  };
+
+  static ThreadBuffer* GetThreadBuffer();
+
+  static bool enabled;
+  static std::size_t capacity;
+  static std::chrono::steady_clock::time_point origin;
+  static std::mutex registryMutex;
+  static std::vector<ThreadBuffer*> buffers;
+
+  // Buffers live until the process ends, so a dump never sees a dangling one
+  static thread_local ThreadBuffer *threadBuffer;
+};
+
+// Records the lifetime of the scope as one complete ('X') event
+class TraceScope
+{
+public:
+
+  explicit TraceScope(const char *scopeName)
+    :name(Tracer::IsEnabled() ? scopeName : NULL)
+    ,begin(name ? Tracer::GetTimestamp() : 0)
+  {}
+
+  ~TraceScope()
+  {
+    if (name)
+      Tracer::Record(name, begin, Tracer::GetTimestamp());
+  }
+
+private:
+
+  TraceScope(const TraceScope &ref);
+  TraceScope& operator=(const TraceScope &ref);
+
+  const char *name;
+  int64_t begin;
+};
+
+#ifdef TRACING
+  #define TRACE_JOIN_NAME(name, line) name##line
+  #define TRACE_SCOPE_NAME(line) TRACE_JOIN_NAME(traceScope, line)
+  #define TRACE_SCOPE(name) TraceScope TRACE_SCOPE_NAME(__LINE__)(name)
+#else
+  #define TRACE_SCOPE(name)
+#endif
+
+#endif
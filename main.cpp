@@ -7,6 +7,7 @@
 
 // Project includes
 #include "DisplayWindow.h"
+#include "Models/NBody.h"
 
 int main(int argc, char** argv)
 {
@@ -16,6 +17,7 @@ int main(int argc, char** argv)
     Json::Value json;
     std::ifstream configFile("config.json", std::ifstream::binary);
     configFile >> json;
+    NBody::ConfigureMemory(json);
 
     // Run OpenGL window
     DisplayWindow mainWindow(json);